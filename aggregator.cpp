@@ -0,0 +1,157 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <aggregator.h>
+#include <map>
+
+using namespace std;
+
+/**
+ * Create an aggregator with no variables
+ */
+Aggregator::Aggregator()
+{
+}
+
+/**
+ * Allocate the slot of a variable, reusing a slot that has been released
+ * if there is one
+ *
+ * @param asset		The asset the statistics of the variable are sent in
+ * @param datapoint	The datapoint name of the variable
+ * @return		The slot
+ */
+unsigned int Aggregator::allocate(const string *asset, const string *datapoint)
+{
+	unsigned int slot;
+	if (!m_free.empty())
+	{
+		slot = m_free.back();
+		m_free.pop_back();
+	}
+	else
+	{
+		slot = m_count.size();
+		m_min.push_back(0.0);
+		m_max.push_back(0.0);
+		m_sum.push_back(0.0);
+		m_first.push_back(0.0);
+		m_last.push_back(0.0);
+		m_count.push_back(0);
+		m_asset.push_back(NULL);
+		m_datapoint.push_back(NULL);
+	}
+	m_count[slot] = 0;
+	m_asset[slot] = asset;
+	m_datapoint[slot] = datapoint;
+	return slot;
+}
+
+/**
+ * Release the slot of a variable that is no longer aggregated, discarding
+ * any values recorded in the current window
+ *
+ * @param slot	The slot
+ */
+void Aggregator::release(unsigned int slot)
+{
+	m_count[slot] = 0;
+	m_asset[slot] = NULL;
+	m_datapoint[slot] = NULL;
+	m_free.push_back(slot);
+}
+
+/**
+ * Change the asset the statistics of a variable are sent in, keeping the
+ * values recorded in the current window
+ *
+ * @param slot	The slot
+ * @param asset	The new asset
+ */
+void Aggregator::rename(unsigned int slot, const string *asset)
+{
+	m_asset[slot] = asset;
+}
+
+/**
+ * Release every slot and the memory that holds them
+ */
+void Aggregator::clear()
+{
+	m_min.clear();
+	m_max.clear();
+	m_sum.clear();
+	m_first.clear();
+	m_last.clear();
+	m_count.clear();
+	m_asset.clear();
+	m_datapoint.clear();
+	m_touched.clear();
+	m_free.clear();
+}
+
+/**
+ * Create the readings for the window that has ended and start a new window.
+ * There is one reading for each asset that has variables with values in the
+ * window, holding the minimum, maximum, mean, first and last value and the
+ * number of values of each of those variables.
+ *
+ * @param start		The start of the window, the timestamp of the readings
+ * @param readings	The readings created are appended to this
+ */
+void Aggregator::flush(const struct timeval& start, vector<Reading *>& readings)
+{
+	map<const string *, vector<Datapoint *> > assets;
+	vector<const string *> order;
+	for (auto slot : m_touched)
+	{
+		unsigned long count = m_count[slot];
+		if (count == 0)
+			continue;	// Released during the window
+		m_count[slot] = 0;
+		auto it = assets.find(m_asset[slot]);
+		if (it == assets.end())
+		{
+			it = assets.insert(make_pair(m_asset[slot], vector<Datapoint *>())).first;
+			order.push_back(m_asset[slot]);
+		}
+		const string& name = *m_datapoint[slot];
+		vector<Datapoint *>& points = it->second;
+		DatapointValue min(m_min[slot]);
+		points.push_back(new Datapoint(name + "_min", min));
+		DatapointValue max(m_max[slot]);
+		points.push_back(new Datapoint(name + "_max", max));
+		DatapointValue mean(m_sum[slot] / count);
+		points.push_back(new Datapoint(name + "_mean", mean));
+		DatapointValue first(m_first[slot]);
+		points.push_back(new Datapoint(name + "_first", first));
+		DatapointValue last(m_last[slot]);
+		points.push_back(new Datapoint(name + "_last", last));
+		DatapointValue n((long)count);
+		points.push_back(new Datapoint(name + "_count", n));
+	}
+	m_touched.clear();
+	for (auto asset : order)
+	{
+		Reading *reading = new Reading(*asset, assets[asset]);
+		reading->setUserTimestamp(start);
+		readings.push_back(reading);
+	}
+}
+
+/**
+ * Return the memory used by the aggregator
+ *
+ * @return	The size of the aggregator in bytes
+ */
+size_t Aggregator::bytes() const
+{
+	return m_count.capacity() * (5 * sizeof(double) + sizeof(unsigned long) + 2 * sizeof(string *))
+		+ (m_touched.capacity() + m_free.capacity()) * sizeof(unsigned int);
+}
@@ -0,0 +1,385 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <logger.h>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * The number of values of each variable to ask for in a single HistoryRead
+ * request, the server returns a continuation point for any that remain
+ */
+#define HISTORY_VALUES_PER_NODE	1000
+
+/**
+ * Callback for the responses to the HistoryRead requests of a backfill
+ */
+static void historyCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+			void *response)
+{
+	BackfillRequest *request = (BackfillRequest *)userdata;
+	request->session->opcua->historyResponse(request, (UA_HistoryReadResponse *)response);
+}
+
+/**
+ * Record where the gap in the data of a session begins, the source timestamp
+ * of the last value received for each of its variables. This is called when
+ * the session loses its connection, before the monitored items of the session
+ * are recreated. A backfill that is still in progress is abandoned. The first
+ * value each item receives once the session has recovered is recorded again.
+ *
+ * @param session	The session that has lost its connection
+ */
+void OPCUA::collectGap(Session *session)
+{
+	Backfill& backfill = session->backfill;
+	if (backfill.end)
+	{
+		Logger::getLogger()->warn("Session %d lost its connection during a backfill, %d variables have not been backfilled",
+				session->index, (int)(backfill.nodes.size() - backfill.first));
+	}
+	clearBackfill(session);
+
+	lock_guard<mutex> guard(m_contextMutex);
+	m_contextPool.forEach([&](MonitoredItemContext *context) {
+		if (context->shard->session != session)
+			return;
+		context->firstSource = 0;
+		if (context->lastSource == 0 || UA_NodeId_isNull(&context->nodeId))
+			return;
+		BackfillNode node;
+		UA_NodeId_copy(&context->nodeId, &node.nodeId);
+		node.start = node.last = context->lastSource;
+		UA_ByteString_init(&node.continuationPoint);
+		node.asset = context->asset;
+		node.datapoint = context->datapoint;
+		node.decoder = context->decoder;
+		node.shard = context->shard;
+		node.subscriptionId = context->shard->subscriptionId;
+		node.context = NULL;
+		node.done = false;
+		backfill.nodes.push_back(node);
+	});
+}
+
+/**
+ * Start to read the gap in the data of a session from the history of the
+ * server, once the session has recovered. The values queued by the server
+ * for subscriptions that were reactivated or transferred are delivered to
+ * the session, so only the variables whose subscription had to be created
+ * again are read. The variables are ordered by the start of their gap so
+ * that each batch reads a similar span of history. Each variable is matched
+ * with its monitored item, so that the values from the first value the item
+ * receives live onwards are not read from the history as well.
+ *
+ * @param session	The session that has recovered
+ * @param end		The time the session recovered, before its monitored
+ *			items were created again
+ */
+void OPCUA::startBackfill(Session *session, UA_DateTime end)
+{
+	Backfill& backfill = session->backfill;
+	vector<BackfillNode>& nodes = backfill.nodes;
+	size_t kept = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (!m_polled && nodes[i].shard->subscriptionId == nodes[i].subscriptionId)
+			UA_NodeId_clear(&nodes[i].nodeId);
+		else
+			nodes[kept++] = nodes[i];
+	}
+	nodes.resize(kept);
+	if (nodes.empty())
+		return;
+	stable_sort(nodes.begin(), nodes.end(),
+			[](const BackfillNode& a, const BackfillNode& b) { return a.start < b.start; });
+	unordered_map<UA_NodeId, size_t, NodeIdHash, NodeIdEqual> index;
+	for (size_t i = 0; i < nodes.size(); i++)
+		index[nodes[i].nodeId] = i;
+	{
+		lock_guard<mutex> guard(m_contextMutex);
+		m_contextPool.forEach([&](MonitoredItemContext *context) {
+			if (context->shard->session != session || UA_NodeId_isNull(&context->nodeId))
+				return;
+			auto it = index.find(context->nodeId);
+			if (it != index.end())
+				nodes[it->second].context = context;
+		});
+	}
+	backfill.end = end;
+	backfill.first = 0;
+	backfill.count = 0;
+	backfill.inFlight = false;
+	backfill.credit = 0.0;
+	backfill.refilled = backfill.started = chrono::steady_clock::now();
+	backfill.values = 0;
+	backfill.unsupported = 0;
+	Logger::getLogger()->info("Session %d is reading the history of %d variables to fill the gap in their data",
+			session->index, (int)nodes.size());
+}
+
+/**
+ * Send the values read from the history of the server that are due, at no
+ * more than the backfill rate, and read more history once the values waiting
+ * to be sent run low. This is called on every iteration of the thread of the
+ * session while a backfill is in progress.
+ *
+ * @param session	The session to backfill
+ * @param timeout	The longest time the thread of the session may wait
+ * @return		The time the thread of the session may wait
+ */
+UA_UInt32 OPCUA::backfill(Session *session, UA_UInt32 timeout)
+{
+	Backfill& backfill = session->backfill;
+	auto now = chrono::steady_clock::now();
+	double rate = m_backfillRate;
+	backfill.credit += chrono::duration<double>(now - backfill.refilled).count() * rate;
+	if (backfill.credit > rate)
+		backfill.credit = rate;	// Allow a burst of at most a second of values
+	backfill.refilled = now;
+	while (backfill.credit >= 1.0 && !backfill.ready.empty())
+	{
+		queueReading(session, NULL, backfill.ready.front());
+		backfill.ready.pop_front();
+		backfill.credit -= 1.0;
+		backfill.values++;
+	}
+
+	// Give the items created again two publish cycles to receive their first
+	// value live, the history is read up to that value
+	long settle = 2 * (m_polled ? (long)m_pollInterval : m_reportingInterval);
+	if (!backfill.inFlight && backfill.ready.size() < rate
+			&& now - backfill.started >= chrono::milliseconds(settle))
+		sendHistoryRead(session);
+	if (!backfill.end)
+		return timeout;		// The backfill was abandoned
+	if (!backfill.inFlight && backfill.ready.empty() && backfill.first >= backfill.nodes.size())
+	{
+		Logger::getLogger()->info("Session %d backfilled %lu values of %d variables in %ld ms, %lu variables have no history",
+				session->index, backfill.values, (int)backfill.nodes.size(),
+				(long)chrono::duration_cast<chrono::milliseconds>(now - backfill.started).count(),
+				backfill.unsupported);
+		clearBackfill(session);
+		return timeout;
+	}
+	if (backfill.ready.empty())
+		return timeout;
+	UA_UInt32 wait = (1.0 - backfill.credit) * 1000.0 / rate + 1;
+	return wait < timeout ? wait : timeout;
+}
+
+/**
+ * Send the next HistoryRead request of a backfill. Every request of a batch
+ * reads the raw values of the whole gap, the first request of each variable
+ * from the start and the rest from the continuation point the server returned.
+ * The batch is complete once the server has returned every value of its
+ * variables.
+ *
+ * @param session	The session to backfill
+ */
+void OPCUA::sendHistoryRead(Session *session)
+{
+	Backfill& backfill = session->backfill;
+	vector<size_t> pending;
+	while (backfill.first < backfill.nodes.size())
+	{
+		if (backfill.count == 0)
+		{
+			UA_UInt32 chunk = m_historyChunk ? m_historyChunk : MAX_NODES_PER_HISTORY_READ;
+			backfill.count = backfill.nodes.size() - backfill.first;
+			if (backfill.count > chunk)
+				backfill.count = chunk;
+		}
+		for (size_t i = backfill.first; i < backfill.first + backfill.count; i++)
+		{
+			if (!backfill.nodes[i].done)
+				pending.push_back(i);
+		}
+		if (!pending.empty())
+			break;
+		backfill.first += backfill.count;
+		backfill.count = 0;
+	}
+	if (pending.empty())
+		return;
+
+	UA_ReadRawModifiedDetails details;
+	UA_ReadRawModifiedDetails_init(&details);
+	details.isReadModified = false;
+	details.startTime = backfill.nodes[backfill.first].start;
+	details.endTime = backfill.end;
+	details.numValuesPerNode = HISTORY_VALUES_PER_NODE;
+	details.returnBounds = false;
+
+	vector<UA_HistoryReadValueId> ids(pending.size());
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		BackfillNode& node = backfill.nodes[pending[i]];
+		ids[i].nodeId = node.nodeId;
+		ids[i].continuationPoint = node.continuationPoint;
+	}
+	UA_HistoryReadRequest request;
+	UA_HistoryReadRequest_init(&request);
+	UA_ExtensionObject_setValue(&request.historyReadDetails, &details,
+			&UA_TYPES[UA_TYPES_READRAWMODIFIEDDETAILS]);
+	request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+	request.releaseContinuationPoints = false;
+	request.nodesToRead = ids.data();
+	request.nodesToReadSize = ids.size();
+
+	BackfillRequest *historyRequest = new BackfillRequest;
+	historyRequest->session = session;
+	historyRequest->generation = backfill.generation;
+	historyRequest->nodes.swap(pending);
+	UA_UInt32 requestId;
+	UA_StatusCode rval = __UA_Client_AsyncService(session->client, &request,
+			&UA_TYPES[UA_TYPES_HISTORYREADREQUEST], historyCallback,
+			&UA_TYPES[UA_TYPES_HISTORYREADRESPONSE], historyRequest, &requestId);
+	if (rval != UA_STATUSCODE_GOOD)
+	{
+		// A lost connection is seen by the session thread
+		Logger::getLogger()->error("Session %d failed to send a HistoryRead request: %s",
+				session->index, UA_StatusCode_name(rval));
+		delete historyRequest;
+		return;
+	}
+	backfill.inFlight = true;
+}
+
+/**
+ * Handle the response to a HistoryRead request of a backfill. The values
+ * returned are held until every variable of the batch has been read up to
+ * their timestamp, the values that are no longer held are then sent in
+ * timestamp order. A variable the server keeps no history of is skipped.
+ *
+ * @param request	The HistoryRead request, which is deleted
+ * @param response	The response from the server
+ */
+void OPCUA::historyResponse(BackfillRequest *request, UA_HistoryReadResponse *response)
+{
+	Session *session = request->session;
+	Backfill& backfill = session->backfill;
+	if (request->generation != backfill.generation)
+	{
+		// The backfill has been abandoned since the request was sent
+		delete request;
+		return;
+	}
+	backfill.inFlight = false;
+	UA_StatusCode status = response->responseHeader.serviceResult;
+	if (status != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Session %d failed to read the history of %d variables, the backfill is abandoned: %s",
+				session->index, (int)request->nodes.size(), UA_StatusCode_name(status));
+		delete request;
+		clearBackfill(session);
+		return;
+	}
+
+	for (size_t i = 0; i < request->nodes.size(); i++)
+	{
+		BackfillNode& node = backfill.nodes[request->nodes[i]];
+		UA_ByteString_clear(&node.continuationPoint);
+		if (i >= response->resultsSize || UA_StatusCode_isBad(response->results[i].statusCode))
+		{
+			node.done = true;
+			backfill.unsupported++;
+			continue;
+		}
+		UA_HistoryReadResult& result = response->results[i];
+		const UA_ExtensionObject& data = result.historyData;
+		if ((data.encoding == UA_EXTENSIONOBJECT_DECODED || data.encoding == UA_EXTENSIONOBJECT_DECODED_NODELETE)
+				&& data.content.decoded.type == &UA_TYPES[UA_TYPES_HISTORYDATA])
+		{
+			UA_HistoryData *history = (UA_HistoryData *)data.content.decoded.data;
+			for (size_t j = 0; j < history->dataValuesSize; j++)
+			{
+				UA_DataValue *value = &history->dataValues[j];
+				UA_DateTime timestamp;
+				if (value->hasSourceTimestamp)
+					timestamp = value->sourceTimestamp;
+				else if (value->hasServerTimestamp)
+					timestamp = value->serverTimestamp;
+				else
+					continue;
+				node.last = timestamp;
+				// The first value was received before the gap, the
+				// last is received once the session has recovered
+				if (!value->hasValue || timestamp <= node.start || timestamp >= backfill.end)
+					continue;
+				// The item has received this value live since it was created again
+				if (node.context && node.context->firstSource && timestamp >= node.context->firstSource)
+					continue;
+				DatapointValue dpv(0L);
+				node.decoder(&(value->value), dpv, m_maxArrayLength);
+				struct timeval tv;
+				if (!valueTimestamp(value, &tv))
+				{
+					UA_DateTime dt = timestamp - UA_DATETIME_UNIX_EPOCH;
+					tv.tv_sec = dt / UA_DATETIME_SEC;
+					tv.tv_usec = (dt % UA_DATETIME_SEC) / UA_DATETIME_USEC;
+				}
+				Reading *reading = new Reading(*node.asset, new Datapoint(*node.datapoint, dpv));
+				reading->setUserTimestamp(tv);
+				backfill.held.push_back(make_pair(timestamp, reading));
+			}
+		}
+		if (result.continuationPoint.length > 0)
+			UA_ByteString_copy(&result.continuationPoint, &node.continuationPoint);
+		else
+			node.done = true;
+	}
+	delete request;
+
+	// Values up to the oldest timestamp read of the variables that have
+	// more values to come are complete, any that follow are held
+	UA_DateTime watermark = backfill.end;
+	for (size_t i = backfill.first; i < backfill.first + backfill.count; i++)
+	{
+		if (!backfill.nodes[i].done && backfill.nodes[i].last < watermark)
+			watermark = backfill.nodes[i].last;
+	}
+	stable_sort(backfill.held.begin(), backfill.held.end(),
+			[](const pair<UA_DateTime, Reading *>& a, const pair<UA_DateTime, Reading *>& b)
+			{ return a.first < b.first; });
+	size_t released = 0;
+	while (released < backfill.held.size() && backfill.held[released].first <= watermark)
+		backfill.ready.push_back(backfill.held[released++].second);
+	backfill.held.erase(backfill.held.begin(), backfill.held.begin() + released);
+}
+
+/**
+ * End the backfill of a session, discarding any values not yet sent. The
+ * responses to requests that are still outstanding are ignored.
+ *
+ * @param session	The session
+ */
+void OPCUA::clearBackfill(Session *session)
+{
+	Backfill& backfill = session->backfill;
+	for (auto& node : backfill.nodes)
+	{
+		UA_NodeId_clear(&node.nodeId);
+		UA_ByteString_clear(&node.continuationPoint);
+	}
+	backfill.nodes.clear();
+	for (auto& held : backfill.held)
+		delete held.second;
+	backfill.held.clear();
+	for (auto reading : backfill.ready)
+		delete reading;
+	backfill.ready.clear();
+	backfill.generation++;
+	backfill.end = 0;
+	backfill.first = 0;
+	backfill.count = 0;
+	backfill.inFlight = false;
+}
@@ -0,0 +1,368 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <logger.h>
+#include <stdlib.h>
+
+using namespace std;
+
+/**
+ * The number of browse paths to translate in a single request if the server
+ * does not report a MaxNodesPerTranslateBrowsePathsToNodeIds operation limit
+ */
+#define MAX_PATHS_PER_TRANSLATE	1000
+
+/**
+ * An element of a browse path, the namespace is -1 if none was given
+ */
+typedef pair<int, string> PathElement;
+
+/**
+ * Split a browse path of the form 2:MyObjects/2:MyDevice/2:MyLevel into
+ * its elements. Each element is a browse name with an optional namespace
+ * index.
+ *
+ * @param path	The browse path
+ * @return	The elements of the path
+ */
+static vector<PathElement> parseBrowsePath(const string& path)
+{
+	vector<PathElement> elements;
+	size_t start = 0;
+	while (start <= path.size())
+	{
+		size_t end = path.find('/', start);
+		if (end == string::npos)
+			end = path.size();
+		string name = path.substr(start, end - start);
+		int ns = -1;
+		size_t colon = name.find(':');
+		if (colon != string::npos && colon > 0 && name.find_first_not_of("0123456789") == colon)
+		{
+			ns = atoi(name.substr(0, colon).c_str());
+			name = name.substr(colon + 1);
+		}
+		if (!name.empty())
+			elements.push_back(PathElement(ns, name));
+		start = end + 1;
+	}
+	return elements;
+}
+
+/**
+ * Resolve the browse paths given as subscriptions to the node ids of the
+ * nodes they name. A path of more than one browse name starts at the objects
+ * folder and follows
+ * hierarchical references, an element without a namespace index takes the
+ * namespace of the element before it, or, if it is the first element, is
+ * tried in every namespace of the server. All of the paths not already
+ * resolved are translated in as few TranslateBrowsePathsToNodeIds requests
+ * as the MaxNodesPerTranslateBrowsePathsToNodeIds operation limit of the
+ * server allows. The resolved node ids are kept, so a reconfiguration that
+ * adds subscriptions only translates the new paths, until the namespace
+ * array of the server changes. A path that is a single browse name is first
+ * translated from the objects folder, and if it does not name a node directly
+ * below the objects folder the tree is searched for it.
+ *
+ * @param paths	The browse paths to resolve
+ * @param roots	The node ids of the resolved nodes are appended to this
+ */
+void OPCUA::resolveBrowsePaths(const vector<string>& paths, vector<UA_NodeId>& roots)
+{
+	if (m_resolvedNamespaces != m_namespaces)
+	{
+		clearResolved();
+		m_resolvedNamespaces = m_namespaces;
+	}
+
+	// The element names are referenced by the requests, so every path is
+	// parsed before any request is built
+	vector<vector<PathElement> > parsed(paths.size());
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (m_resolved.find(paths[i]) == m_resolved.end())
+			parsed[i] = parseBrowsePath(paths[i]);
+	}
+
+	vector<vector<UA_RelativePathElement> > elements;
+	vector<size_t> owners;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (parsed[i].empty())
+			continue;
+		vector<UA_UInt16> namespaces;
+		if (parsed[i][0].first >= 0)
+			namespaces.push_back(parsed[i][0].first);
+		else
+			for (size_t ns = 0; ns < m_namespaces.size() || ns == 0; ns++)
+				namespaces.push_back(ns);
+		for (auto ns : namespaces)
+		{
+			vector<UA_RelativePathElement> path;
+			for (auto& element : parsed[i])
+			{
+				if (element.first >= 0)
+					ns = element.first;
+				UA_RelativePathElement pathElement;
+				UA_RelativePathElement_init(&pathElement);
+				pathElement.referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+				pathElement.includeSubtypes = true;
+				pathElement.targetName = UA_QUALIFIEDNAME(ns, (char *)element.second.c_str());
+				path.push_back(pathElement);
+			}
+			elements.push_back(path);
+			owners.push_back(i);
+		}
+	}
+
+	if (!elements.empty())
+	{
+		UA_UInt32 chunkSize = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERTRANSLATEBROWSEPATHSTONODEIDS,
+			MAX_PATHS_PER_TRANSLATE);
+		int requests = 0;
+		for (size_t base = 0; base < elements.size(); base += chunkSize)
+		{
+			size_t n = elements.size() - base;
+			if (n > chunkSize)
+				n = chunkSize;
+
+			vector<UA_BrowsePath> browsePaths(n);
+			for (size_t i = 0; i < n; i++)
+			{
+				UA_BrowsePath_init(&browsePaths[i]);
+				browsePaths[i].startingNode = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
+				browsePaths[i].relativePath.elements = elements[base + i].data();
+				browsePaths[i].relativePath.elementsSize = elements[base + i].size();
+			}
+			UA_TranslateBrowsePathsToNodeIdsRequest request;
+			UA_TranslateBrowsePathsToNodeIdsRequest_init(&request);
+			request.browsePaths = browsePaths.data();
+			request.browsePathsSize = n;
+			UA_TranslateBrowsePathsToNodeIdsResponse response =
+				UA_Client_Service_translateBrowsePathsToNodeIds(m_client, request);
+			requests++;
+			if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+			{
+				Logger::getLogger()->error("Failed to translate %d browse paths: %s", (int)n,
+						UA_StatusCode_name(response.responseHeader.serviceResult));
+			}
+			for (size_t i = 0; i < n && i < response.resultsSize; i++)
+			{
+				const UA_BrowsePathResult& result = response.results[i];
+				if (result.statusCode != UA_STATUSCODE_GOOD)
+					continue;
+				for (size_t j = 0; j < result.targetsSize; j++)
+				{
+					// Targets on other servers, or only partly resolved, are not used
+					if (result.targets[j].remainingPathIndex != UA_UINT32_MAX
+							|| result.targets[j].targetId.serverIndex != 0)
+						continue;
+					UA_NodeId id;
+					UA_NodeId_copy(&result.targets[j].targetId.nodeId, &id);
+					m_resolved[paths[owners[base + i]]].push_back(id);
+				}
+			}
+			UA_TranslateBrowsePathsToNodeIdsResponse_clear(&response);
+		}
+		Logger::getLogger()->info("Translated %d browse paths in %d requests", (int)elements.size(), requests);
+	}
+
+	// A single browse name that is not of a node directly below the
+	// objects folder names a node anywhere below it
+	vector<string> names;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (parsed[i].size() == 1 && m_resolved.find(paths[i]) == m_resolved.end())
+			names.push_back(paths[i]);
+	}
+	if (!names.empty())
+		findBrowseNames(names);
+
+	for (auto& path : paths)
+	{
+		auto it = m_resolved.find(path);
+		if (it == m_resolved.end())
+		{
+			Logger::getLogger()->error("Unable to find the node %s given in the subscriptions", path.c_str());
+			continue;
+		}
+		for (auto& id : it->second)
+		{
+			Logger::getLogger()->debug("Adding subscriptions for node '%s'", path.c_str());
+			UA_NodeId root;
+			UA_NodeId_copy(&id, &root);
+			roots.push_back(root);
+		}
+	}
+}
+
+/**
+ * Find the nodes anywhere below the objects folder whose browse names match
+ * subscriptions that are a single browse name. The objects are browsed a
+ * level at a time, each level in as few Browse requests as the
+ * MaxNodesPerBrowse operation limit of the server allows, and every node
+ * that matches a name is resolved, as a name without a namespace index
+ * matches in any namespace. The search is only made for names that the
+ * translation of browse paths did not resolve, and the results are kept
+ * with the translated paths.
+ *
+ * @param names	The subscriptions to find, each a single browse name
+ */
+void OPCUA::findBrowseNames(const vector<string>& names)
+{
+	vector<pair<PathElement, string> > wanted;
+	for (auto& name : names)
+		wanted.push_back(make_pair(parseBrowsePath(name)[0], name));
+
+	NodeIdSet visited;
+	vector<UA_NodeId> level, next;
+	size_t found = 0;
+	auto match = [&](const UA_BrowseResult& result) {
+		for (size_t i = 0; i < result.referencesSize; i++)
+		{
+			const UA_ReferenceDescription& ref = result.references[i];
+			if (ref.nodeId.serverIndex != 0 || visited.find(ref.nodeId.nodeId) != visited.end())
+				continue;
+			UA_NodeId id;
+			UA_NodeId_copy(&ref.nodeId.nodeId, &id);
+			visited.insert(id);
+			string browseName((char *)ref.browseName.name.data, ref.browseName.name.length);
+			for (auto& name : wanted)
+			{
+				if (name.first.second.compare(browseName) == 0 && (name.first.first < 0
+						|| name.first.first == ref.browseName.namespaceIndex))
+				{
+					UA_NodeId_copy(&ref.nodeId.nodeId, &id);
+					m_resolved[name.second].push_back(id);
+					found++;
+				}
+			}
+			if (ref.nodeClass == UA_NODECLASS_OBJECT)
+			{
+				UA_NodeId_copy(&ref.nodeId.nodeId, &id);
+				next.push_back(id);
+			}
+		}
+	};
+
+	UA_UInt32 chunkSize = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERBROWSE,
+			MAX_NODES_PER_BROWSE);
+	level.push_back(UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER));
+	visited.insert(level[0]);
+	int requests = 0;
+	bool complete = true;
+	while (complete && !level.empty())
+	{
+		for (size_t base = 0; complete && base < level.size(); base += chunkSize)
+		{
+			size_t n = level.size() - base;
+			if (n > chunkSize)
+				n = chunkSize;
+			UA_BrowseRequest bReq;
+			UA_BrowseRequest_init(&bReq);
+			bReq.requestedMaxReferencesPerNode = 0;
+			bReq.nodesToBrowse = (UA_BrowseDescription *)UA_Array_new(n, &UA_TYPES[UA_TYPES_BROWSEDESCRIPTION]);
+			bReq.nodesToBrowseSize = n;
+			for (size_t i = 0; i < n; i++)
+			{
+				UA_BrowseDescription *desc = &bReq.nodesToBrowse[i];
+				UA_NodeId_copy(&level[base + i], &desc->nodeId);
+				desc->browseDirection = UA_BROWSEDIRECTION_FORWARD;
+				desc->referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+				desc->includeSubtypes = true;
+				desc->nodeClassMask = UA_NODECLASS_OBJECT | UA_NODECLASS_VARIABLE;
+				desc->resultMask = UA_BROWSERESULTMASK_NODECLASS | UA_BROWSERESULTMASK_BROWSENAME;
+			}
+			UA_BrowseResponse response = UA_Client_Service_browse(m_client, bReq);
+			UA_BrowseRequest_clear(&bReq);
+			requests++;
+			vector<UA_ByteString> continuations;
+			if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+			{
+				Logger::getLogger()->error("Browse of %d nodes to find browse names failed: %s", (int)n,
+						UA_StatusCode_name(response.responseHeader.serviceResult));
+				complete = false;
+			}
+			for (size_t i = 0; complete && i < response.resultsSize; i++)
+			{
+				match(response.results[i]);
+				if (response.results[i].continuationPoint.length > 0)
+				{
+					UA_ByteString cp;
+					UA_ByteString_copy(&response.results[i].continuationPoint, &cp);
+					continuations.push_back(cp);
+				}
+			}
+			UA_BrowseResponse_clear(&response);
+
+			while (!continuations.empty())
+			{
+				UA_BrowseNextRequest nReq;
+				UA_BrowseNextRequest_init(&nReq);
+				// Continuation points left when the browse failed are released
+				nReq.releaseContinuationPoints = !complete;
+				nReq.continuationPoints = (UA_ByteString *)UA_Array_new(continuations.size(),
+								&UA_TYPES[UA_TYPES_BYTESTRING]);
+				nReq.continuationPointsSize = continuations.size();
+				for (size_t i = 0; i < continuations.size(); i++)
+					nReq.continuationPoints[i] = continuations[i];
+				continuations.clear();
+				UA_BrowseNextResponse nResp = UA_Client_Service_browseNext(m_client, nReq);
+				UA_BrowseNextRequest_clear(&nReq);
+				requests++;
+				if (complete && nResp.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+				{
+					Logger::getLogger()->error("BrowseNext to find browse names failed: %s",
+							UA_StatusCode_name(nResp.responseHeader.serviceResult));
+					complete = false;
+				}
+				for (size_t i = 0; complete && i < nResp.resultsSize; i++)
+				{
+					match(nResp.results[i]);
+					if (nResp.results[i].continuationPoint.length > 0)
+					{
+						UA_ByteString cp;
+						UA_ByteString_copy(&nResp.results[i].continuationPoint, &cp);
+						continuations.push_back(cp);
+					}
+				}
+				UA_BrowseNextResponse_clear(&nResp);
+			}
+		}
+		level.swap(next);
+		for (auto& id : next)
+			UA_NodeId_clear(&id);
+		next.clear();
+	}
+	for (auto& id : level)
+		UA_NodeId_clear(&id);
+	for (auto& id : visited)
+		UA_NodeId_clear(const_cast<UA_NodeId *>(&id));
+
+	if (!complete)
+		Logger::getLogger()->warn("The search for browse names was cut short, some may not have been found");
+	Logger::getLogger()->info("Searched %d nodes for %d browse names in %d requests, %d nodes found",
+			(int)visited.size(), (int)names.size(), requests, (int)found);
+}
+
+/**
+ * Release the node ids of the browse paths that have been resolved
+ */
+void OPCUA::clearResolved()
+{
+	for (auto& it : m_resolved)
+	{
+		for (auto& id : it.second)
+			UA_NodeId_clear(&id);
+	}
+	m_resolved.clear();
+}
@@ -0,0 +1,119 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <contextpool.h>
+
+using namespace std;
+
+/**
+ * Create an empty pool
+ */
+ContextPool::ContextPool() : m_used(CONTEXT_BLOCK), m_inUse(0)
+{
+}
+
+/**
+ * Destroy the pool and every context in it
+ */
+ContextPool::~ContextPool()
+{
+	clear();
+}
+
+/**
+ * Allocate a context, reusing one that has been released if there is one.
+ * A context that is not in use has no plugin.
+ *
+ * @return	The context
+ */
+MonitoredItemContext *ContextPool::allocate()
+{
+	MonitoredItemContext *context;
+	if (!m_free.empty())
+	{
+		context = m_free.back();
+		m_free.pop_back();
+	}
+	else
+	{
+		if (m_used == CONTEXT_BLOCK)
+		{
+			MonitoredItemContext *block = new MonitoredItemContext[CONTEXT_BLOCK];
+			for (size_t i = 0; i < CONTEXT_BLOCK; i++)
+			{
+				block[i].opcua = NULL;
+				block[i].trace = NULL;
+			}
+			m_blocks.push_back(block);
+			m_used = 0;
+		}
+		context = &m_blocks.back()[m_used++];
+	}
+	m_inUse++;
+	return context;
+}
+
+/**
+ * Return a context to the pool
+ *
+ * @param context	The context, which must have been allocated from this pool
+ */
+void ContextPool::release(MonitoredItemContext *context)
+{
+	delete context->trace;
+	context->trace = NULL;
+	context->opcua = NULL;
+	m_free.push_back(context);
+	m_inUse--;
+}
+
+/**
+ * Release every context in the pool and the memory that holds them
+ */
+void ContextPool::clear()
+{
+	forEach([](MonitoredItemContext *context) { delete context->trace; });
+	for (auto block : m_blocks)
+		delete[] block;
+	m_blocks.clear();
+	m_free.clear();
+	m_free.shrink_to_fit();
+	m_used = CONTEXT_BLOCK;
+	m_inUse = 0;
+}
+
+/**
+ * Call a function for every context in use
+ *
+ * @param fn	The function to call
+ */
+void ContextPool::forEach(const function<void(MonitoredItemContext *)>& fn)
+{
+	for (size_t b = 0; b < m_blocks.size(); b++)
+	{
+		size_t n = b == m_blocks.size() - 1 ? m_used : CONTEXT_BLOCK;
+		for (size_t i = 0; i < n; i++)
+		{
+			if (m_blocks[b][i].opcua)
+				fn(&m_blocks[b][i]);
+		}
+	}
+}
+
+/**
+ * Return the memory used by the pool
+ *
+ * @return	The size of the pool in bytes
+ */
+size_t ContextPool::bytes() const
+{
+	return m_blocks.size() * CONTEXT_BLOCK * sizeof(MonitoredItemContext)
+		+ m_free.capacity() * sizeof(MonitoredItemContext *);
+}
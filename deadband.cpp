@@ -0,0 +1,261 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <logger.h>
+#include <rapidjson/document.h>
+#include <fnmatch.h>
+#include <math.h>
+
+using namespace std;
+
+/**
+ * The interval at which each session looks for variables whose values are
+ * due to be sent again, in milliseconds
+ */
+#define HEARTBEAT_INTERVAL	1000
+
+/**
+ * Return the current time of the monotonic clock in milliseconds
+ */
+static long monotonicTime()
+{
+	return chrono::duration_cast<chrono::milliseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Parse a set of report by exception settings, any setting that is not given
+ * is left unchanged
+ *
+ * @param value		The JSON object holding the settings
+ * @param settings	The settings to update
+ */
+static void parseException(const rapidjson::Value& value, ExceptionSettings& settings)
+{
+	if (value.HasMember("deadbandValue") && value["deadbandValue"].IsNumber())
+		settings.deadbandValue = value["deadbandValue"].GetDouble();
+	if (value.HasMember("maxAge") && value["maxAge"].IsUint())
+		settings.maxAge = value["maxAge"].GetUint();
+	if (value.HasMember("deadbandType") && value["deadbandType"].IsString())
+	{
+		string type = value["deadbandType"].GetString();
+		if (type.compare("None") == 0)
+			settings.deadbandType = DeadbandNone;
+		else if (type.compare("Absolute") == 0)
+			settings.deadbandType = DeadbandAbsolute;
+		else if (type.compare("Relative") == 0)
+			settings.deadbandType = DeadbandRelative;
+		else if (type.compare("Percent") == 0)
+		{
+			// The plugin does not read the EURange that an OPC UA percent deadband is relative to
+			Logger::getLogger()->error("The report by exception deadband type 'Percent' is not supported, use 'Relative' for a percentage of the last value sent");
+		}
+		else
+			Logger::getLogger()->error("Invalid report by exception deadband type '%s'", type.c_str());
+	}
+}
+
+/**
+ * Set the client side report by exception settings, a default and a set of
+ * overrides for the variables whose datapoint name matches a pattern. The
+ * settings are kept if the configuration has not changed, as the contexts of
+ * the monitored items refer to them.
+ *
+ * @param json	The report by exception configuration
+ */
+void
+OPCUA::setReportByException(const string& json)
+{
+	if (!m_exceptionConfig.empty() && json.compare(m_exceptionConfig) == 0)
+		return;
+	m_exceptionConfig = json;
+	m_exception.deadbandType = DeadbandNone;
+	m_exception.deadbandValue = 0.0;
+	m_exception.maxAge = 0;
+	m_exceptionOverrides.clear();
+	m_heartbeats = false;
+
+	rapidjson::Document doc;
+	doc.Parse(json.c_str());
+	if (doc.HasParseError() || !doc.IsObject())
+	{
+		Logger::getLogger()->error("Invalid report by exception configuration, every value will be sent");
+		return;
+	}
+	if (doc.HasMember("default") && doc["default"].IsObject())
+	{
+		parseException(doc["default"], m_exception);
+	}
+	m_heartbeats = m_exception.maxAge > 0;
+	if (doc.HasMember("overrides") && doc["overrides"].IsArray())
+	{
+		const rapidjson::Value& overrides = doc["overrides"];
+		for (rapidjson::SizeType i = 0; i < overrides.Size(); i++)
+		{
+			if (!overrides[i].IsObject() || !overrides[i].HasMember("pattern")
+					|| !overrides[i]["pattern"].IsString())
+			{
+				Logger::getLogger()->error("Report by exception override is missing a pattern");
+				continue;
+			}
+			ExceptionSettings settings = m_exception;
+			parseException(overrides[i], settings);
+			m_heartbeats |= settings.maxAge > 0;
+			m_exceptionOverrides.push_back(make_pair(string(overrides[i]["pattern"].GetString()), settings));
+		}
+	}
+}
+
+/**
+ * Select the report by exception settings of a monitored item, from the
+ * first override whose pattern matches its datapoint name or the default.
+ * Items whose settings would send every value are not filtered at all. The
+ * last value sent is forgotten, so the next value of the item is sent.
+ * Items with a maximum age are held in the heartbeat list of their session.
+ *
+ * @param context	The context of the monitored item
+ */
+void
+OPCUA::updateException(MonitoredItemContext *context)
+{
+	const ExceptionSettings *settings = &m_exception;
+	for (auto& override : m_exceptionOverrides)
+	{
+		if (fnmatch(override.first.c_str(), context->datapoint->c_str(), 0) == 0)
+		{
+			settings = &override.second;
+			break;
+		}
+	}
+	if (settings->deadbandType == DeadbandNone && settings->maxAge == 0)
+		settings = NULL;
+	context->exception = settings;
+	context->hasLast = false;
+
+	vector<MonitoredItemContext *>& heartbeats = context->shard->session->heartbeats;
+	if (settings && settings->maxAge)
+	{
+		if (context->heartbeat == HEARTBEAT_NONE)
+		{
+			context->heartbeat = heartbeats.size();
+			heartbeats.push_back(context);
+		}
+	}
+	else if (context->heartbeat != HEARTBEAT_NONE)
+	{
+		removeHeartbeat(context);
+	}
+}
+
+/**
+ * Remove a monitored item from the heartbeat list of its session. The last
+ * item of the list takes its place.
+ *
+ * @param context	The context of the monitored item
+ */
+void
+OPCUA::removeHeartbeat(MonitoredItemContext *context)
+{
+	vector<MonitoredItemContext *>& heartbeats = context->shard->session->heartbeats;
+	MonitoredItemContext *last = heartbeats.back();
+	heartbeats[context->heartbeat] = last;
+	last->heartbeat = context->heartbeat;
+	heartbeats.pop_back();
+	context->heartbeat = HEARTBEAT_NONE;
+}
+
+/**
+ * Decide whether the value of a monitored item is sent. A numeric value is
+ * suppressed if it is within the deadband of the last value sent, unless the
+ * last value sent is older than the maximum age. With no deadband only values
+ * equal to the last value sent are suppressed. Values that are not numeric are
+ * always sent. This is only called on the thread of the session of the item.
+ *
+ * @param context	The context of the monitored item
+ * @param value		The new value of the item
+ * @return		True if the value is to be sent
+ */
+bool
+OPCUA::reportByException(MonitoredItemContext *context, const DatapointValue& value)
+{
+	DatapointValue::dataTagType type = value.getType();
+	if (type != DatapointValue::T_INTEGER && type != DatapointValue::T_FLOAT)
+		return true;
+	const ExceptionSettings *settings = context->exception;
+	bool integer = type == DatapointValue::T_INTEGER;
+	double v = integer ? value.toInt() : value.toDouble();
+	long now = monotonicTime();
+	if (context->hasLast)
+	{
+		double deadband = 0.0;
+		if (settings->deadbandType == DeadbandAbsolute)
+			deadband = settings->deadbandValue;
+		else if (settings->deadbandType == DeadbandRelative)
+			deadband = fabs(context->lastValue) * settings->deadbandValue / 100.0;
+		if (fabs(v - context->lastValue) <= deadband
+				&& (settings->maxAge == 0 || now - context->lastSent < (long)settings->maxAge))
+		{
+			// Only the thread of the session writes the count
+			atomic<unsigned long>& suppressed = context->shard->suppressed;
+			suppressed.store(suppressed.load(memory_order_relaxed) + 1, memory_order_relaxed);
+			return false;
+		}
+	}
+	context->lastValue = v;
+	context->lastInteger = integer;
+	context->lastSent = now;
+	context->hasLast = true;
+	return true;
+}
+
+/**
+ * Send the last value again for the monitored items of a session that have a
+ * maximum age and have sent no value for that long, as the server only sends
+ * values that have changed. The items are checked once a second, only those
+ * in the heartbeat list of the session being looked at. The readings carry
+ * the time the heartbeat was sent.
+ *
+ * @param session	The session whose items are checked
+ */
+void
+OPCUA::heartbeat(Session *session)
+{
+	if (!m_heartbeats)
+		return;
+	auto clock = chrono::steady_clock::now();
+	if (clock < session->nextHeartbeat)
+		return;
+	session->nextHeartbeat = clock + chrono::milliseconds(HEARTBEAT_INTERVAL);
+
+	long now = monotonicTime();
+	vector<MonitoredItemContext *> due;
+	{
+		// Other sessions may be creating items while they recover
+		lock_guard<mutex> guard(m_contextMutex);
+		for (auto context : session->heartbeats)
+		{
+			if (context->hasLast && now - context->lastSent >= (long)context->exception->maxAge)
+				due.push_back(context);
+		}
+	}
+	struct timeval tv = { 0, 0 };
+	for (auto context : due)
+	{
+		context->lastSent = now;
+		DatapointValue value(0L);
+		if (context->lastInteger)
+			value = DatapointValue((long)context->lastValue);
+		else
+			value = DatapointValue(context->lastValue);
+		sendValue(context, value, false, tv);
+		atomic<unsigned long>& heartbeats = context->shard->heartbeats;
+		heartbeats.store(heartbeats.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	}
+}
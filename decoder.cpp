@@ -0,0 +1,486 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <time.h>
+#include <limits.h>
+
+using namespace std;
+
+/**
+ * The number of data type kinds defined by open62541, the built in types
+ * occupy the first 25 kinds in the same order as they appear in UA_TYPES
+ */
+#define DECODER_KINDS	31
+
+/**
+ * A decoder for a scalar of one data type kind. The caller has already
+ * checked the variant holds a scalar of that kind.
+ */
+typedef void (*ScalarDecoder)(const void *data, const UA_DataType *type, DatapointValue& value,
+		size_t maxArrayLength);
+
+static void decodeScalar(const UA_Variant *variant, DatapointValue& value, size_t maxArrayLength);
+
+/**
+ * Base64 encode binary data
+ *
+ * @param data	The data to encode
+ * @param len	The length of the data
+ * @return	The base64 encoded data
+ */
+static string base64(const UA_Byte *data, size_t len)
+{
+	static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	string rval;
+	rval.reserve(((len + 2) / 3) * 4);
+	for (size_t i = 0; i < len; i += 3)
+	{
+		UA_UInt32 n = data[i] << 16;
+		if (i + 1 < len)
+			n |= data[i + 1] << 8;
+		if (i + 2 < len)
+			n |= data[i + 2];
+		rval += alphabet[(n >> 18) & 0x3f];
+		rval += alphabet[(n >> 12) & 0x3f];
+		rval += i + 1 < len ? alphabet[(n >> 6) & 0x3f] : '=';
+		rval += i + 2 < len ? alphabet[n & 0x3f] : '=';
+	}
+	return rval;
+}
+
+static void decodeBoolean(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((long)*(const UA_Boolean *)data);
+}
+
+static void decodeSByte(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((long)*(const UA_SByte *)data);
+}
+
+static void decodeByte(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((long)*(const UA_Byte *)data);
+}
+
+static void decodeInt16(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((long)*(const UA_Int16 *)data);
+}
+
+static void decodeUInt16(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((long)*(const UA_UInt16 *)data);
+}
+
+/**
+ * Enumerations are encoded as Int32 values
+ */
+static void decodeInt32(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((long)*(const UA_Int32 *)data);
+}
+
+/**
+ * Values that do not fit in a long, on platforms where a long has 32 bits,
+ * are decoded as a double rather than wrapping
+ */
+static void decodeUInt32(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	UA_UInt32 v = *(const UA_UInt32 *)data;
+	if (v > (unsigned long)LONG_MAX)
+		value.setValue((double)v);
+	else
+		value.setValue((long)v);
+}
+
+static void decodeInt64(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	UA_Int64 v = *(const UA_Int64 *)data;
+	if (v > LONG_MAX || v < LONG_MIN)
+		value.setValue((double)v);
+	else
+		value.setValue((long)v);
+}
+
+/**
+ * Values above LONG_MAX are decoded as a double rather than wrapping to a
+ * negative integer
+ */
+static void decodeUInt64(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	UA_UInt64 v = *(const UA_UInt64 *)data;
+	if (v > (UA_UInt64)LONG_MAX)
+		value.setValue((double)v);
+	else
+		value.setValue((long)v);
+}
+
+static void decodeFloat(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((double)*(const UA_Float *)data);
+}
+
+static void decodeDouble(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((double)*(const UA_Double *)data);
+}
+
+/**
+ * Strings and XmlElements
+ */
+static void decodeString(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	const UA_String *str = (const UA_String *)data;
+	value = DatapointValue(string((const char *)str->data, str->length));
+}
+
+/**
+ * DateTimes are converted to an ISO 8601 string in UTC
+ */
+static void decodeDateTime(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	UA_DateTime dt = *(const UA_DateTime *)data - UA_DATETIME_UNIX_EPOCH;
+	time_t seconds = dt / UA_DATETIME_SEC;
+	long usec = (dt % UA_DATETIME_SEC) / UA_DATETIME_USEC;
+	if (usec < 0)
+	{
+		seconds--;
+		usec += 1000000;
+	}
+	struct tm tm;
+	gmtime_r(&seconds, &tm);
+	char buf[80];
+	size_t len = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buf + len, sizeof(buf) - len, ".%06ldZ", usec);
+	value = DatapointValue(string(buf));
+}
+
+static void decodeGuid(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	const UA_Guid *guid = (const UA_Guid *)data;
+	char buf[40];
+	snprintf(buf, sizeof(buf), "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+			guid->data1, guid->data2, guid->data3,
+			guid->data4[0], guid->data4[1], guid->data4[2], guid->data4[3],
+			guid->data4[4], guid->data4[5], guid->data4[6], guid->data4[7]);
+	value = DatapointValue(string(buf));
+}
+
+/**
+ * ByteStrings are base64 encoded
+ */
+static void decodeByteString(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	const UA_ByteString *str = (const UA_ByteString *)data;
+	value = DatapointValue(base64(str->data, str->length));
+}
+
+static void decodeNodeId(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value = DatapointValue(nodeIdToString((const UA_NodeId *)data));
+}
+
+static void decodeExpandedNodeId(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value = DatapointValue(nodeIdToString(&((const UA_ExpandedNodeId *)data)->nodeId));
+}
+
+/**
+ * StatusCodes are returned as their numeric value
+ */
+static void decodeStatusCode(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	value.setValue((long)*(const UA_StatusCode *)data);
+}
+
+/**
+ * QualifiedNames are returned as the browse name form <namespace>:<name>
+ */
+static void decodeQualifiedName(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	const UA_QualifiedName *name = (const UA_QualifiedName *)data;
+	value = DatapointValue(to_string(name->namespaceIndex) + ":"
+			+ string((const char *)name->name.data, name->name.length));
+}
+
+/**
+ * LocalizedTexts are returned as the text, the locale is discarded
+ */
+static void decodeLocalizedText(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	const UA_LocalizedText *text = (const UA_LocalizedText *)data;
+	value = DatapointValue(string((const char *)text->text.data, text->text.length));
+}
+
+/**
+ * ExtensionObjects that the client has been able to decode are decoded
+ * according to the kind of their content, those it has not are returned as
+ * the base64 encoding of their body
+ */
+static void decodeExtensionObject(const void *data, const UA_DataType *, DatapointValue& value,
+		size_t maxArrayLength)
+{
+	const UA_ExtensionObject *eo = (const UA_ExtensionObject *)data;
+	if (eo->encoding >= UA_EXTENSIONOBJECT_DECODED)
+	{
+		UA_Variant inner;
+		UA_Variant_init(&inner);
+		UA_Variant_setScalar(&inner, eo->content.decoded.data, eo->content.decoded.type);
+		decodeScalar(&inner, value, maxArrayLength);
+	}
+	else
+	{
+		value = DatapointValue(base64(eo->content.encoded.body.data, eo->content.encoded.body.length));
+	}
+}
+
+static void decodeDataValue(const void *data, const UA_DataType *, DatapointValue& value,
+		size_t maxArrayLength)
+{
+	decodeVariant(&((const UA_DataValue *)data)->value, value, maxArrayLength);
+}
+
+static void decodeNestedVariant(const void *data, const UA_DataType *, DatapointValue& value,
+		size_t maxArrayLength)
+{
+	decodeVariant((const UA_Variant *)data, value, maxArrayLength);
+}
+
+static void decodeDiagnosticInfo(const void *data, const UA_DataType *, DatapointValue& value, size_t)
+{
+	const UA_DiagnosticInfo *info = (const UA_DiagnosticInfo *)data;
+	if (info->hasAdditionalInfo)
+		value = DatapointValue(string((const char *)info->additionalInfo.data, info->additionalInfo.length));
+	else if (info->hasInnerStatusCode)
+		value.setValue((long)info->innerStatusCode);
+	else
+		value.setValue((long)info->symbolicId);
+}
+
+/**
+ * Structures and other types with no natural datapoint representation are
+ * returned as the name of their type
+ */
+static void decodeStructure(const void *, const UA_DataType *type, DatapointValue& value, size_t)
+{
+	value = DatapointValue(string(type->typeName ? type->typeName : "Structure"));
+}
+
+/**
+ * The scalar decoders indexed by data type kind
+ */
+static const ScalarDecoder scalarDecoders[DECODER_KINDS] = {
+	decodeBoolean,		// Boolean
+	decodeSByte,		// SByte
+	decodeByte,		// Byte
+	decodeInt16,		// Int16
+	decodeUInt16,		// UInt16
+	decodeInt32,		// Int32
+	decodeUInt32,		// UInt32
+	decodeInt64,		// Int64
+	decodeUInt64,		// UInt64
+	decodeFloat,		// Float
+	decodeDouble,		// Double
+	decodeString,		// String
+	decodeDateTime,		// DateTime
+	decodeGuid,		// Guid
+	decodeByteString,	// ByteString
+	decodeString,		// XmlElement
+	decodeNodeId,		// NodeId
+	decodeExpandedNodeId,	// ExpandedNodeId
+	decodeStatusCode,	// StatusCode
+	decodeQualifiedName,	// QualifiedName
+	decodeLocalizedText,	// LocalizedText
+	decodeExtensionObject,	// ExtensionObject
+	decodeDataValue,	// DataValue
+	decodeNestedVariant,	// Variant
+	decodeDiagnosticInfo,	// DiagnosticInfo
+	decodeStructure,	// Decimal
+	decodeInt32,		// Enum
+	decodeStructure,	// Structure
+	decodeStructure,	// Optional structure
+	decodeStructure,	// Union
+	decodeStructure		// Bit field cluster
+};
+
+/**
+ * Decode a scalar variant using the decoder for its data type kind
+ *
+ * @param variant		The variant to decode, which must hold a scalar
+ * @param value			The datapoint value to set
+ * @param maxArrayLength	The maximum number of elements of a nested array to decode
+ */
+static void decodeScalar(const UA_Variant *variant, DatapointValue& value, size_t maxArrayLength)
+{
+	if (variant->type->typeKind < DECODER_KINDS)
+		scalarDecoders[variant->type->typeKind](variant->data, variant->type, value, maxArrayLength);
+}
+
+/**
+ * Convert a contiguous array of numeric values into doubles
+ */
+template<typename T>
+static void convertArray(const void *data, size_t n, double *out)
+{
+	const T *in = (const T *)data;
+	for (size_t i = 0; i < n; i++)
+		out[i] = (double)in[i];
+}
+
+typedef void (*ArrayConverter)(const void *data, size_t n, double *out);
+
+/**
+ * The converters for arrays of the numeric data type kinds, Boolean to Double
+ */
+static const ArrayConverter arrayConverters[] = {
+	convertArray<UA_Boolean>,
+	convertArray<UA_SByte>,
+	convertArray<UA_Byte>,
+	convertArray<UA_Int16>,
+	convertArray<UA_UInt16>,
+	convertArray<UA_Int32>,
+	convertArray<UA_UInt32>,
+	convertArray<UA_Int64>,
+	convertArray<UA_UInt64>,
+	convertArray<UA_Float>,
+	convertArray<UA_Double>
+};
+
+/**
+ * Decode an array of numeric values. A two dimensional array becomes a two
+ * dimensional datapoint array, any other array becomes a one dimensional
+ * datapoint array holding the elements in the order they were sent.
+ *
+ * @param variant		The variant holding the array
+ * @param value			The datapoint value to set
+ * @param maxArrayLength	The maximum number of elements to decode, any
+ *				further elements are discarded
+ */
+static void decodeArray(const UA_Variant *variant, DatapointValue& value, size_t maxArrayLength)
+{
+	UA_UInt32 kind = variant->type->typeKind;
+	if (kind >= sizeof(arrayConverters) / sizeof(arrayConverters[0]))
+		return;
+	ArrayConverter convert = arrayConverters[kind];
+	size_t length = variant->arrayLength;
+	if (length > maxArrayLength)
+	{
+		length = maxArrayLength;
+	}
+
+	if (variant->arrayDimensionsSize == 2 && variant->arrayDimensions[1] > 0)
+	{
+		size_t columns = variant->arrayDimensions[1];
+		size_t rows = length / columns;
+		vector<vector<double> *> *matrix = new vector<vector<double> *>;
+		matrix->reserve(rows);
+		for (size_t row = 0; row < rows; row++)
+		{
+			vector<double> *values = new vector<double>(columns);
+			convert((const char *)variant->data + row * columns * variant->type->memSize,
+					columns, values->data());
+			matrix->push_back(values);
+		}
+		value = DatapointValue(matrix);
+	}
+	else
+	{
+		vector<double> values(length);
+		convert(variant->data, length, values.data());
+		value = DatapointValue(values);
+	}
+}
+
+/**
+ * Decode a variant of any type into a datapoint value. This is used for
+ * variables whose data type does not allow a more specific decoder to be
+ * chosen when the monitored item is created, or if the server sends a
+ * value of a different type to the one it declared.
+ *
+ * @param variant		The variant to decode
+ * @param value			The datapoint value to set
+ * @param maxArrayLength	The maximum number of elements of an array to decode
+ */
+void decodeVariant(const UA_Variant *variant, DatapointValue& value, size_t maxArrayLength)
+{
+	if (variant->type && UA_Variant_isScalar(variant))
+	{
+		decodeScalar(variant, value, maxArrayLength);
+	}
+	else if (variant->type && variant->arrayLength > 0)
+	{
+		decodeArray(variant, value, maxArrayLength);
+	}
+}
+
+/**
+ * Decoder for variables declared with one of the built in data types. The
+ * scalar decoder for the kind is called directly if the value is of the
+ * declared type, otherwise the general decoder is used.
+ */
+template<int KIND>
+static void decodeKind(const UA_Variant *variant, DatapointValue& value, size_t maxArrayLength)
+{
+	if (variant->type && variant->type->typeKind == KIND && UA_Variant_isScalar(variant))
+		scalarDecoders[KIND](variant->data, variant->type, value, maxArrayLength);
+	else
+		decodeVariant(variant, value, maxArrayLength);
+}
+
+/**
+ * The decoders for variables declared with a built in data type, indexed
+ * by data type kind
+ */
+static const VariantDecoder builtinDecoders[] = {
+	decodeKind<UA_DATATYPEKIND_BOOLEAN>,
+	decodeKind<UA_DATATYPEKIND_SBYTE>,
+	decodeKind<UA_DATATYPEKIND_BYTE>,
+	decodeKind<UA_DATATYPEKIND_INT16>,
+	decodeKind<UA_DATATYPEKIND_UINT16>,
+	decodeKind<UA_DATATYPEKIND_INT32>,
+	decodeKind<UA_DATATYPEKIND_UINT32>,
+	decodeKind<UA_DATATYPEKIND_INT64>,
+	decodeKind<UA_DATATYPEKIND_UINT64>,
+	decodeKind<UA_DATATYPEKIND_FLOAT>,
+	decodeKind<UA_DATATYPEKIND_DOUBLE>,
+	decodeKind<UA_DATATYPEKIND_STRING>,
+	decodeKind<UA_DATATYPEKIND_DATETIME>,
+	decodeKind<UA_DATATYPEKIND_GUID>,
+	decodeKind<UA_DATATYPEKIND_BYTESTRING>,
+	decodeKind<UA_DATATYPEKIND_XMLELEMENT>,
+	decodeKind<UA_DATATYPEKIND_NODEID>,
+	decodeKind<UA_DATATYPEKIND_EXPANDEDNODEID>,
+	decodeKind<UA_DATATYPEKIND_STATUSCODE>,
+	decodeKind<UA_DATATYPEKIND_QUALIFIEDNAME>,
+	decodeKind<UA_DATATYPEKIND_LOCALIZEDTEXT>,
+	decodeKind<UA_DATATYPEKIND_EXTENSIONOBJECT>,
+	decodeKind<UA_DATATYPEKIND_DATAVALUE>,
+	decodeKind<UA_DATATYPEKIND_VARIANT>,
+	decodeKind<UA_DATATYPEKIND_DIAGNOSTICINFO>
+};
+
+/**
+ * Choose the decoder to use for the values of a variable, based on the
+ * DataType attribute of the variable. The built in data types have numeric
+ * node ids in namespace 0 of one more than their data type kind.
+ *
+ * @param dataType	The data type of the variable
+ * @return		The decoder for values of the variable
+ */
+VariantDecoder selectDecoder(const UA_NodeId *dataType)
+{
+	if (dataType->namespaceIndex != 0 || dataType->identifierType != UA_NODEIDTYPE_NUMERIC)
+		return decodeVariant;
+	UA_UInt32 kind = dataType->identifier.numeric - 1;
+	if (kind < sizeof(builtinDecoders) / sizeof(builtinDecoders[0]))
+		return builtinDecoders[kind];
+	return decodeVariant;
+}
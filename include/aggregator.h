@@ -0,0 +1,75 @@
+#ifndef _AGGREGATOR_H
+#define _AGGREGATOR_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <reading.h>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+/**
+ * The aggregate slot of a monitored item whose values are not aggregated
+ */
+#define AGGREGATE_NONE	0xFFFFFFFFU
+
+/**
+ * The statistics of the values of a set of variables over a window of time.
+ * Each variable has a slot, the statistics are held in a structure of arrays
+ * indexed by the slot so that recording a value touches only a few adjacent
+ * words and costs a handful of arithmetic operations. An aggregator belongs
+ * to a session and is only used by the thread of that session.
+ */
+class Aggregator
+{
+	public:
+		Aggregator();
+		unsigned int	allocate(const std::string *asset, const std::string *datapoint);
+		void		release(unsigned int slot);
+		void		rename(unsigned int slot, const std::string *asset);
+		void		clear();
+		void		flush(const struct timeval& start, std::vector<Reading *>& readings);
+		size_t		bytes() const;
+
+		/**
+		 * Add a value to the statistics of the current window
+		 *
+		 * @param slot	The slot of the variable
+		 * @param value	The value
+		 */
+		void		record(unsigned int slot, double value)
+				{
+					if (m_count[slot]++ == 0)
+					{
+						m_touched.push_back(slot);
+						m_first[slot] = m_min[slot] = m_max[slot] = value;
+						m_sum[slot] = 0.0;
+					}
+					if (value < m_min[slot])
+						m_min[slot] = value;
+					if (value > m_max[slot])
+						m_max[slot] = value;
+					m_sum[slot] += value;
+					m_last[slot] = value;
+				}
+	private:
+		std::vector<double>		m_min;
+		std::vector<double>		m_max;
+		std::vector<double>		m_sum;
+		std::vector<double>		m_first;
+		std::vector<double>		m_last;
+		std::vector<unsigned long>	m_count;
+		std::vector<const std::string *>
+						m_asset;
+		std::vector<const std::string *>
+						m_datapoint;
+		std::vector<unsigned int>	m_touched;	// Slots with values in the window
+		std::vector<unsigned int>	m_free;
+};
+#endif
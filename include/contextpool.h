@@ -0,0 +1,48 @@
+#ifndef _CONTEXTPOOL_H
+#define _CONTEXTPOOL_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <vector>
+#include <functional>
+#include <stddef.h>
+
+/**
+ * The number of contexts allocated together in one block
+ */
+#define CONTEXT_BLOCK	1024
+
+struct MonitoredItemContext;
+
+/**
+ * A pool of monitored item contexts. The contexts are allocated in large
+ * contiguous blocks rather than individually, so that the contexts of the
+ * items of a subscription are packed together in memory and are released
+ * in one operation when the plugin stops or is reconfigured. The context of
+ * an item that is deleted on its own is returned to the pool for reuse.
+ * The pool is not thread safe, the caller must serialise access to it.
+ */
+class ContextPool
+{
+	public:
+		ContextPool();
+		~ContextPool();
+		MonitoredItemContext	*allocate();
+		void			release(MonitoredItemContext *context);
+		void			clear();
+		void			forEach(const std::function<void(MonitoredItemContext *)>& fn);
+		size_t			inUse() const { return m_inUse; }
+		size_t			bytes() const;
+	private:
+		std::vector<MonitoredItemContext *>	m_blocks;
+		std::vector<MonitoredItemContext *>	m_free;
+		size_t					m_used;
+		size_t					m_inUse;
+};
+#endif
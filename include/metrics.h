@@ -0,0 +1,71 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The number of bits of precision kept for each latency, values within
+ * one bucket differ by no more than 1 part in 2^(LATENCY_PRECISION - 1)
+ */
+#define LATENCY_PRECISION	4
+
+/**
+ * The largest latency recorded, in microseconds, larger values are
+ * recorded as this value
+ */
+#define LATENCY_MAX		(1ULL << 40)
+
+/**
+ * A histogram of latencies in microseconds. The buckets have a fixed
+ * relative precision, in the style of an HDR histogram, so that a small
+ * array of counters covers latencies from microseconds to days. Recording
+ * a value is a single atomic increment and may be done from any thread.
+ */
+class LatencyHistogram
+{
+	public:
+		/**
+		 * The percentiles of the latencies recorded, in microseconds
+		 */
+		typedef struct {
+			uint64_t	count;
+			uint64_t	p50;
+			uint64_t	p90;
+			uint64_t	p99;
+			uint64_t	max;
+		} Summary;
+
+		LatencyHistogram();
+		void		record(uint64_t value);
+		Summary		collect();
+	private:
+		static size_t	bucket(uint64_t value);
+		static uint64_t	bucketValue(size_t bucket);
+		static const size_t	BUCKETS = (41 - LATENCY_PRECISION) * (1 << (LATENCY_PRECISION - 1))
+						+ (1 << LATENCY_PRECISION);
+		std::atomic<uint64_t>	m_counts[BUCKETS];
+};
+
+/**
+ * The performance metrics gathered by the plugin
+ */
+typedef struct {
+	std::atomic<uint64_t>	readings;
+	std::atomic<uint64_t>	itemsCreated;
+	std::atomic<uint64_t>	itemFailures;
+	std::atomic<long>	browseTime;
+	std::atomic<long>	monitorTime;
+	LatencyHistogram	sourceLatency;
+	LatencyHistogram	ingestLatency;
+} Metrics;
+#endif
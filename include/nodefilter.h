@@ -0,0 +1,64 @@
+#ifndef _NODEFILTER_H
+#define _NODEFILTER_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <open62541/client_highlevel.h>
+#include <string>
+#include <vector>
+#include <regex>
+
+/**
+ * A set of include and exclude rules that select the nodes found by
+ * browsing the server. A rule may match the browse path of a node, with
+ * a glob or a regular expression, its node class, its data type and its
+ * namespace, and matches a node only if every condition it has matches.
+ * The first rule that matches a node decides whether it is included.
+ * The rules are compiled once, when the configuration is parsed, so that
+ * evaluating them during the browse is cheap.
+ */
+class NodeFilter
+{
+	public:
+		NodeFilter();
+		~NodeFilter();
+		bool		parse(const std::string& json);
+		bool		empty() const { return m_rules.empty(); }
+		bool		dryRun() const { return m_dryRun; }
+		bool		usesBrowsePath() const { return m_usesBrowsePath; }
+		bool		usesDataType() const { return m_usesDataType; }
+		void		start(const std::vector<std::string>& namespaces);
+		bool		excludeObject(const std::string& path, const UA_NodeId *id);
+		bool		excludeVariable(const std::string& path, const UA_NodeId *id,
+						const UA_NodeId *dataType);
+		void		report() const;
+	private:
+		typedef struct {
+			bool		exclude;
+			UA_NodeClass	nodeClass;
+			std::string	glob;
+			bool		hasRegex;
+			std::regex	regex;
+			bool		hasDataType;
+			UA_NodeId	dataType;
+			int		ns;
+			std::string	namespaceUri;
+			std::string	description;
+			unsigned long	matched;
+		} Rule;
+		const Rule	*match(UA_NodeClass nodeClass, const std::string& path,
+					const UA_NodeId *id, const UA_NodeId *dataType);
+		void		clear();
+		std::vector<Rule>	m_rules;
+		bool			m_dryRun;
+		bool			m_hasInclude;
+		bool			m_usesBrowsePath;
+		bool			m_usesDataType;
+};
+#endif
@@ -22,10 +22,416 @@
 #include <stdlib.h>
 #include <map>
 #include <thread>
+#include <sys/time.h>
+#include <chrono>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <atomic>
+#include <condition_variable>
+#include <readingqueue.h>
+#include <metrics.h>
+#include <nodefilter.h>
+#include <contextpool.h>
+#include <aggregator.h>
+
+/**
+ * A variable found in the OPC UA server that we will monitor for data changes
+ */
+typedef struct {
+	UA_NodeId	nodeId;
+	UA_NodeId	dataType;
+	std::string	datapoint;
+	std::string	asset;		// Empty if the asset is named after the variable
+	UA_UInt32	monitoredItemId;
+	unsigned int	shard;
+} MonitoredNode;
+
+/**
+ * A decoder that converts the value in a variant into a datapoint value.
+ * Arrays longer than the maximum array length are truncated.
+ */
+typedef void (*VariantDecoder)(const UA_Variant *variant, DatapointValue& value,
+				size_t maxArrayLength);
+
+VariantDecoder	selectDecoder(const UA_NodeId *dataType);
+void		decodeVariant(const UA_Variant *variant, DatapointValue& value, size_t maxArrayLength);
+
+/**
+ * The datapoints waiting to be sent in a batch for a single asset. When the
+ * ingest queue overflows with the coalesce policy the latest reading of the
+ * asset is also held here, until the ingest thread collects it. When the
+ * last known values of an asset are carried in its readings the last value
+ * of each of its datapoints is kept.
+ */
+typedef struct AssetBatch {
+	const std::string		*asset;
+	std::vector<Datapoint *>	points;
+	bool				hasTimestamp;
+	struct timeval			timestamp;
+	std::atomic<Reading *>		latest;
+	struct AssetBatch		*next;
+	unsigned long			flushes;
+	std::map<std::string, std::pair<DatapointValue, unsigned long> >
+					lastValues;	// Value and flush it was last sent in
+} AssetBatch;
+
+/**
+ * The number of monitored items to create in a single call if the server
+ * does not report a MaxMonitoredItemsPerCall operation limit
+ */
+#define MAX_ITEMS_PER_CALL	1000
+
+/**
+ * The number of nodes to browse in a single request if the server does not
+ * report a MaxNodesPerBrowse operation limit
+ */
+#define MAX_NODES_PER_BROWSE	100
+
+/**
+ * The number of nodes to read in a single request if the server does not
+ * report a MaxNodesPerRead operation limit
+ */
+#define MAX_NODES_PER_READ	1000
+
+/**
+ * The number of variables to read the history of in a single request if the
+ * server does not report a MaxNodesPerHistoryReadData operation limit
+ */
+#define MAX_NODES_PER_HISTORY_READ	100
+
+/**
+ * The time to wait for the other sessions to pause while the node cache is
+ * reconciled, in milliseconds
+ */
+#define SESSION_PAUSE_TIMEOUT	5000
+
+class OPCUA;
+struct MonitoredItemContext;
+struct Shard;
+
+/**
+ * A variable whose values were missed while a session was disconnected,
+ * to be read from the history of the server
+ */
+typedef struct {
+	UA_NodeId		nodeId;
+	UA_DateTime		start;		// Source timestamp of the last value received
+	UA_DateTime		last;		// Source timestamp of the last value read
+	UA_ByteString		continuationPoint;
+	const std::string	*asset;
+	const std::string	*datapoint;
+	VariantDecoder		decoder;
+	struct Shard		*shard;
+	UA_UInt32		subscriptionId;	// The subscription of the variable when the gap began
+	const struct MonitoredItemContext
+				*context;	// The item once the session has recovered, or NULL
+	bool			done;
+} BackfillNode;
+
+/**
+ * The values of a session read from the history of the server to fill the
+ * gap left while the session was disconnected. The variables are read in
+ * batches, the values of a batch are sent in timestamp order and at a
+ * limited rate so that they do not hold up the values of the live data.
+ */
+typedef struct {
+	std::vector<BackfillNode>	nodes;		// In the order of the start of their gap
+	UA_DateTime			end;		// The time the session recovered, 0 if idle
+	size_t				first;		// The first node of the batch being read
+	size_t				count;		// The number of nodes in the batch
+	unsigned int			generation;
+	bool				inFlight;
+	std::vector<std::pair<UA_DateTime, Reading *> >
+					held;		// May precede values still to be read
+	std::deque<Reading *>		ready;		// In timestamp order, waiting to be sent
+	double				credit;		// The number of values that may be sent
+	std::chrono::steady_clock::time_point
+					refilled;
+	std::chrono::steady_clock::time_point
+					started;
+	unsigned long			values;
+	unsigned long			unsupported;	// Variables the server has no history of
+} Backfill;
+
+/**
+ * A session with the OPC UA server, serviced by its own thread. The
+ * datapoints waiting to be sent in batches are held per session so that
+ * the threads share no state when handling data changes.
+ */
+typedef struct {
+	OPCUA				*opcua;
+	unsigned int			index;
+	UA_Client			*client;
+	std::thread			*thread;
+	std::map<std::string, AssetBatch>
+					pending;
+	std::vector<AssetBatch *>	dirty;
+	unsigned int			pendingCount;
+	std::chrono::steady_clock::time_point
+					pendingSince;
+	ReadingQueue			*queue;
+	std::atomic<AssetBatch *>	coalesced;
+	std::atomic<unsigned long>	dropped;
+	std::atomic<unsigned long>	coalescedCount;
+	unsigned int			reconnects;
+	long				lastRecovery;
+	long				downtime;
+	std::vector<size_t>		pollNodes;
+	std::vector<UA_NodeId>		pollIds;
+	std::vector<struct MonitoredItemContext *>
+					pollContexts;
+	unsigned int			pollGeneration;
+	size_t				pollNext;
+	unsigned int			pollInFlight;
+	bool				polling;
+	std::chrono::steady_clock::time_point
+					nextPoll;
+	unsigned long			pollCycles;
+	unsigned long			pollOverruns;
+	std::chrono::steady_clock::time_point
+					nextHeartbeat;
+	std::vector<struct MonitoredItemContext *>
+					heartbeats;	// Items with a maximum age, guarded by m_contextMutex
+	Aggregator			aggregator;
+	long				windowEnd;	// Milliseconds since the epoch
+	Backfill			backfill;
+} Session;
+
+/**
+ * A read request sent by a session when polling the server
+ */
+typedef struct {
+	Session		*session;
+	unsigned int	generation;
+	size_t		first;
+	size_t		count;
+} PollRequest;
+
+/**
+ * A HistoryRead request sent by a session to fill the gap in its data
+ */
+typedef struct {
+	Session			*session;
+	unsigned int		generation;
+	std::vector<size_t>	nodes;		// The index of each node read in the backfill
+} BackfillRequest;
+
+/**
+ * A shard of the monitored items, held in one subscription of a session
+ */
+typedef struct Shard {
+	Session		*session;
+	unsigned int	index;
+	UA_UInt32	subscriptionId;
+	unsigned int	items;
+	std::atomic<unsigned long>
+			notifications;
+	unsigned long	reported;
+	std::atomic<unsigned long>
+			suppressed;	// Values suppressed by report by exception
+	unsigned long	reportedSuppressed;
+	std::atomic<unsigned long>
+			heartbeats;	// Unchanged values sent because of their age
+	unsigned long	reportedHeartbeats;
+} Shard;
+
+/**
+ * The state of the trace of a monitored item whose values are logged
+ */
+typedef struct {
+	bool					logged;
+	unsigned long				suppressed;
+	std::chrono::steady_clock::time_point	last;
+} TagTrace;
+
+/**
+ * The index in the heartbeat list of its session of an item with no maximum age
+ */
+#define HEARTBEAT_NONE	0xFFFFFFFFU
+
+/**
+ * The deadband of the client side report by exception. Unlike the percent
+ * deadband of OPC UA, which is relative to the EURange of the variable, the
+ * relative deadband is a percentage of the last value sent.
+ */
+typedef enum {
+	DeadbandNone,
+	DeadbandAbsolute,
+	DeadbandRelative
+} ExceptionDeadband;
+
+/**
+ * The client side report by exception settings of a set of variables. A
+ * numeric value is only sent if it differs from the last value sent by more
+ * than the deadband, or if the last value sent is older than the maximum age.
+ */
+typedef struct {
+	ExceptionDeadband	deadbandType;
+	double		deadbandValue;	// Absolute, or percent of the last value sent
+	unsigned int	maxAge;		// Milliseconds, 0 if there is no heartbeat
+} ExceptionSettings;
+
+/**
+ * The context of a monitored item. This is built when the item is created
+ * so that no lookups are required when a data change notification arrives.
+ * The asset and datapoint names are interned and shared between items.
+ * The last value sent is kept when values are reported by exception, the
+ * contexts are held in contiguous blocks so this forms a flat table of the
+ * last values of the variables.
+ */
+typedef struct MonitoredItemContext {
+	OPCUA			*opcua;
+	const std::string	*asset;
+	const std::string	*datapoint;
+	VariantDecoder		decoder;
+	Shard			*shard;
+	AssetBatch		*batch;
+	TagTrace		*trace;
+	UA_UInt32		monitoredItemId;
+	const ExceptionSettings	*exception;	// NULL if every value is sent
+	double			lastValue;	// The last numeric value sent
+	long			lastSent;	// Monotonic time it was sent in milliseconds
+	bool			hasLast;
+	bool			lastInteger;
+	unsigned int		aggregate;	// Slot in the aggregator of the session
+	unsigned int		heartbeat;	// Index in the heartbeat list of the session
+	UA_NodeId		nodeId;		// Only held when the gaps are backfilled
+	UA_DateTime		lastSource;	// Source timestamp of the last value, 0 if none
+	UA_DateTime		firstSource;	// Of the first value since the session connected
+} MonitoredItemContext;
+
+/**
+ * The monitoring settings requested for a monitored item
+ */
+typedef struct {
+	double		samplingInterval;
+	UA_UInt32	queueSize;
+	bool		discardOldest;
+	UA_DeadbandType	deadbandType;
+	double		deadbandValue;
+} MonitoringSettings;
+
+/**
+ * Hash and equality of node ids, allowing them to be used in unordered containers
+ */
+struct NodeIdHash {
+	size_t operator()(const UA_NodeId& id) const { return UA_NodeId_hash(&id); }
+};
+struct NodeIdEqual {
+	bool operator()(const UA_NodeId& a, const UA_NodeId& b) const { return UA_NodeId_equal(&a, &b); }
+};
+typedef std::unordered_set<UA_NodeId, NodeIdHash, NodeIdEqual> NodeIdSet;
+
+std::string	nodeIdToString(const UA_NodeId *id);
+void		dataChangeHandler(UA_Client *client, UA_UInt32 subId, void *subContext,
+				UA_UInt32 monId, void *monContext, UA_DataValue *value);
+
+/**
+ * A node found while browsing the server, with its browse path from the
+ * subscription root and whether it lies below an object the filter excludes.
+ * An object also holds its name and the asset of the variables below it.
+ */
+typedef struct {
+	UA_NodeId	nodeId;
+	std::string	path;
+	bool		excluded;
+	std::string	object;
+	std::string	group;
+	unsigned int	depth;
+} BrowseNode;
+
+/**
+ * The stage of the startup pipeline a request belongs to
+ */
+typedef enum {
+	PipelineBrowse,		// Browse of a set of nodes
+	PipelineBrowseNext,	// Continuation of a browse
+	PipelineRead,		// Read of the data types of a batch of variables
+	PipelineCreate		// Creation of the monitored items of a shard
+} PipelineStage;
+
+/**
+ * The state of the pipelined browse of the server, and of the creation of
+ * monitored items for the variables it finds, while the plugin starts
+ */
+typedef struct {
+	bool				monitor;	// Create monitored items as variables are found
+	unsigned int			generation;
+	NodeIdSet			visited;
+	std::deque<BrowseNode>		queue;
+	std::vector<BrowseNode>		variables;	// Browse paths of the variables found
+	size_t				first;		// Index in m_nodes of the first variable to monitor
+	size_t				found;		// Index in m_nodes of the first variable found
+	size_t				next;		// Index in m_nodes of the next variable to monitor
+	unsigned int			browsing;	// Browse requests in flight
+	unsigned int			working;	// Read and create requests in flight
+	UA_UInt32			resultMask;
+	UA_UInt32			browseChunk;
+	UA_UInt32			readChunk;
+	UA_UInt32			itemChunk;
+	int				requests;
+	int				createRequests;
+	int				pruned;
+	int				excluded;
+	size_t				created;
+	size_t				failed;
+	bool				aborted;
+	bool				browsed;
+	bool				monitoring;
+	std::chrono::steady_clock::time_point
+					start;
+	std::chrono::steady_clock::time_point
+					browseEnd;
+	std::chrono::steady_clock::time_point
+					firstItems;
+} StartupPipeline;
+
+/**
+ * A request sent by the startup pipeline
+ */
+typedef struct {
+	OPCUA				*opcua;
+	unsigned int			generation;
+	PipelineStage			stage;
+	std::vector<BrowseNode>		parents;	// The nodes browsed
+	size_t				first;		// The variables whose data types are read
+	size_t				count;
+	std::vector<size_t>		nodes;		// The variables read or monitored
+	Shard				*shard;
+	std::vector<void *>		contexts;
+} PipelineRequest;
 
 class OPCUA
 {
 	public:
+		/**
+		 * The action taken when the ingest queue of a session is full
+		 */
+		typedef enum {
+			OverflowBlock,		// Wait for the ingest thread to make room
+			OverflowDropOldest,	// Discard the oldest queued reading
+			OverflowCoalesce	// Keep only the latest reading of each asset
+		} OverflowPolicy;
+
+		/**
+		 * The timestamp to use as the user timestamp of readings
+		 */
+		typedef enum {
+			TimestampSource,	// Source timestamp, or server if there is none
+			TimestampServer,	// Server timestamp
+			TimestampReceive	// The time the data change was received
+		} TimestampType;
+
+		/**
+		 * How the variables are mapped to assets
+		 */
+		typedef enum {
+			MapVariable,		// An asset per variable
+			MapParentObject,	// An asset per object holding variables
+			MapPathDepth		// An asset per object at a browse path depth
+		} AssetMapping;
+
 		OPCUA(const std::string& url);
 		~OPCUA();
 		void		clearSubscription();
@@ -36,6 +442,7 @@ class OPCUA
 		void		subscribeById(bool byId) { m_subscribeById = byId; };
 		void		start();
 		void		stop();
+		void		reconfigure(ConfigCategory *config);
 		void		ingest(std::vector<Datapoint *>  points);
 		void		registerIngest(void *data, void (*cb)(void *, Reading))
 				{
@@ -53,11 +460,188 @@ class OPCUA
 		void		setClientCert(const std::string& cert) { m_clientPublic = cert; }
 		void		setClientKey(const std::string& key) { m_clientPrivate = key; }
 		void		setRevocationList(const std::string& cert) { m_caCrl = cert; }
+		void		setReportingInterval(long interval) { m_reportingInterval = interval; }
+		void		setMaxArrayLength(size_t length) { m_maxArrayLength = length; }
+		void		setMonitoring(const std::string& json);
+		void		setReportByException(const std::string& json);
+		void		setAggregation(unsigned int window, const std::string& pattern)
+				{
+					m_aggregateWindow = window;
+					m_aggregatePattern = pattern;
+				}
+		void		setFilter(const std::string& json)
+				{
+					m_filterConfig = json;
+					m_filter.parse(json);
+				};
+		void		setTimestampType(const std::string& type);
+		void		setCacheNodes(bool cache) { m_cacheNodes = cache; }
+		void		setBatching(bool batching) { m_batching = batching; }
+		void		setMaxBatchSize(unsigned int size) { m_maxBatchSize = size; }
+		void		setFlushLatency(unsigned int latency) { m_flushLatency = latency; }
+		void		setSessions(unsigned int sessions) { m_sessionCount = sessions; }
+		void		setSubscriptionsPerSession(unsigned int subscriptions)
+				{
+					m_subscriptionsPerSession = subscriptions;
+				}
+		void		setIngestQueueSize(unsigned int size) { m_ingestQueueSize = size; }
+		void		setReconnectDelay(unsigned int min, unsigned int max)
+				{
+					m_reconnectMinDelay = min;
+					m_reconnectMaxDelay = max < min ? min : max;
+				}
+		void		setOverflowPolicy(const std::string& policy);
+		void		setStatistics(unsigned int interval, const std::string& output);
+		void		setTrace(const std::string& pattern, unsigned int interval);
+		void		setAssetMapping(const std::string& mapping);
+		void		setAssetPathDepth(unsigned int depth) { m_assetPathDepth = depth; }
+		void		setLastKnownValues(bool lastKnown) { m_lastKnownValues = lastKnown; }
+		void		setPolled(bool polled) { m_polled = polled; }
+		void		setPollInterval(unsigned int interval) { m_pollInterval = interval; }
+		void		setReadPipeline(unsigned int depth) { m_readPipeline = depth; }
+		void		pollResponse(PollRequest *request, UA_ReadResponse *response);
+		void		setStartupPipeline(unsigned int depth) { m_startupPipeline = depth; }
+		void		pipelineResponse(PipelineRequest *request, void *response);
+		void		setBackfill(bool backfill, unsigned int rate)
+				{
+					m_backfill = backfill;
+					m_backfillRate = rate;
+				}
+		void		historyResponse(BackfillRequest *request, UA_HistoryReadResponse *response);
+		void		updateLogLevel();
+		UA_LogLevel	logLevel() const { return m_logLevel; }
 		void		setConfiguration(ConfigCategory *config);
-		void		dataChanged(const std::string *name, UA_DataValue *value);
-		void		threadStart();
+		void		dataChanged(MonitoredItemContext *context, UA_DataValue *value);
+		void		threadStart(Session *session);
+		void		dispatcher();
+		void		connectLoop();
 	private:
-		int				addSubscribe(const UA_NodeId *node, bool active);
+		bool				browse(const std::vector<UA_NodeId>& roots);
+		int				browseResult(const UA_BrowseResult *result,
+						const BrowseNode& parent, NodeIdSet& visited,
+						std::deque<BrowseNode>& queue,
+						std::vector<BrowseNode>& variables, int& pruned);
+		int				filterNodes(size_t first, const std::vector<BrowseNode>& variables,
+						int pruned);
+		void				startPipeline(StartupPipeline& pipeline,
+						const std::vector<UA_NodeId>& roots,
+						bool monitor, size_t first);
+		bool				runPipeline(StartupPipeline& pipeline);
+		void				finishPipeline(StartupPipeline& pipeline);
+		PipelineRequest			*pipelineRequest(StartupPipeline& pipeline,
+						PipelineStage stage);
+		void				sendBrowse(StartupPipeline& pipeline);
+		void				sendBrowseNext(StartupPipeline& pipeline,
+						std::vector<UA_ByteString>& continuations,
+						std::vector<BrowseNode>& parents);
+		void				browseResults(StartupPipeline& pipeline,
+						PipelineRequest *request, UA_StatusCode status,
+						const UA_BrowseResult *results, size_t count);
+		void				sendTypeRead(StartupPipeline& pipeline);
+		void				monitorNodes(StartupPipeline& pipeline, size_t first,
+						size_t count);
+		void				sendCreate(StartupPipeline& pipeline, Shard *shard,
+						const std::vector<size_t>& nodes);
+		void				createResults(StartupPipeline& pipeline,
+						PipelineRequest *request,
+						const UA_CreateMonitoredItemsResponse *response);
+		void				createMonitoredItems(size_t first);
+		void				createMonitoredItems(Shard *shard,
+						const std::vector<size_t>& nodes,
+						UA_UInt32 chunkSize);
+		void				deleteMonitoredItems(Shard *shard,
+						std::vector<UA_UInt32>& ids);
+		void				modifyMonitoredItems();
+		void				modifySubscription();
+		void				monitoringParameters(const MonitoredNode& node,
+						UA_MonitoringParameters *params,
+						UA_DataChangeFilter *filter);
+		void				readDataTypes(size_t first);
+		void				readNamespaces();
+		UA_UInt32			operationLimit(UA_UInt32 limitId, UA_UInt32 defaultLimit);
+		void				clearNodes();
+		std::vector<UA_NodeId>		subscriptionRoots();
+		std::string			cacheFile();
+		std::string			filterKey();
+		bool				grouped() const { return m_assetMapping != MapVariable; }
+		/**
+		 * The asset whose batch holds the values of an item. Variables
+		 * that are not grouped into assets are batched together under
+		 * the asset name.
+		 */
+		const std::string&		batchAsset(const MonitoredItemContext *context) const
+						{ return m_batching && !grouped() ? m_asset : *context->asset; };
+		std::string			rootName(const UA_NodeId *root);
+		bool				loadCache();
+		void				saveCache();
+		bool				reconcile();
+		UA_Client			*connectClient();
+		UA_StatusCode			connect(UA_Client *client);
+		void				openSessions();
+		bool				createSubscription(Shard *shard);
+		void				startup();
+		void				recoverSession(Session *session);
+		void				restoreSubscriptions(Session *session, int& reactivated,
+						int& transferred, int& recreated);
+		bool				backoff(unsigned int delay, const std::atomic<bool>& stop);
+		void				retryReconcile();
+		bool				pauseSessions();
+		void				resumeSessions();
+		void				pauseSession();
+		void				closeSessions();
+		void				shardStatistics();
+		void				startThread();
+		void				stopThread();
+		void				flushPending(Session *session);
+		void				flushDue(Session *session);
+		void				startDispatcher();
+		void				flushAsset(Session *session, AssetBatch *batch);
+		void				queueReading(Session *session, AssetBatch *batch,
+						Reading *reading);
+		void				coalesce(Session *session, AssetBatch *batch,
+						Reading *reading);
+		bool				dispatch();
+		void				ingestReading(Reading *reading);
+		void				reportStatistics(Session *session);
+		void				updateTrace(MonitoredItemContext *context);
+		void				updateException(MonitoredItemContext *context);
+		bool				reportByException(MonitoredItemContext *context,
+						const DatapointValue& value);
+		void				heartbeat(Session *session);
+		void				removeHeartbeat(MonitoredItemContext *context);
+		void				updateAggregate(MonitoredItemContext *context);
+		UA_UInt32			aggregate(Session *session, UA_UInt32 timeout);
+		void				emitAggregates(Session *session, long windowStart);
+		void				releaseContext(MonitoredItemContext *context);
+		void				collectGap(Session *session);
+		void				startBackfill(Session *session, UA_DateTime end);
+		UA_UInt32			backfill(Session *session, UA_UInt32 timeout);
+		void				sendHistoryRead(Session *session);
+		void				clearBackfill(Session *session);
+		void				sendValue(const MonitoredItemContext *context,
+						DatapointValue& value, bool hasTimestamp,
+						const struct timeval& tv);
+		void				resolveBrowsePaths(const std::vector<std::string>& paths,
+							std::vector<UA_NodeId>& roots);
+		void				findBrowseNames(const std::vector<std::string>& names);
+		void				clearResolved();
+		void				buildPollLists();
+		void				clearPollLists();
+		void				registerPollNodes(Session *session);
+		UA_UInt32			poll(Session *session, UA_UInt32 timeout);
+		void				trace(const MonitoredItemContext *context,
+						const DatapointValue& value);
+		bool				queuesEmpty();
+		void				sessionStatistics();
+		bool				valueTimestamp(const UA_DataValue *value, struct timeval *tv);
+		MonitoredItemContext		*createContext(const MonitoredNode& node, Shard *shard);
+		AssetBatch			*assetBatch(std::map<std::string, AssetBatch>& pending,
+						const std::string& asset);
+		void				rebuildBatches(const std::string& previous);
+		void				releaseContexts(Shard *shard, const std::vector<UA_UInt32>& ids);
+		void				memoryReport();
+		const std::string		*intern(const std::string& name);
+		void				clearContexts();
 		std::vector<std::string>	m_subscriptions;
 		std::string			m_url;
 		std::string			m_asset;
@@ -81,10 +665,83 @@ class OPCUA
 		std::string			m_certAuth;
 		std::string			m_caCrl;
 		UA_Logger			m_UAlogger;
+		UA_LogLevel			m_logLevel;
+		std::string			m_tracePattern;
+		unsigned int			m_traceInterval;
+		bool				m_polled;
+		unsigned int			m_pollInterval;
+		unsigned int			m_readPipeline;
+		UA_UInt32			m_readChunk;
+		UA_UInt32			m_registerChunk;
+		AssetMapping			m_assetMapping;
+		unsigned int			m_assetPathDepth;
+		bool				m_lastKnownValues;
+		unsigned int			m_startupPipeline;
+		StartupPipeline			*m_pipeline;
+		unsigned int			m_pipelineGeneration;
 		std::map<std::string, bool>	m_subscriptionVariables;
-		UA_UInt32			m_subscriptionId;
-		std::thread			*m_thread;
-		bool				m_threadStop;
+		std::vector<Session *>		m_sessions;
+		std::vector<Shard *>		m_shards;
+		unsigned int			m_sessionCount;
+		unsigned int			m_subscriptionsPerSession;
+		std::vector<MonitoredNode>	m_nodes;
+		std::vector<std::string>	m_namespaces;
+		std::map<std::string, std::vector<UA_NodeId> >
+						m_resolved;
+		std::vector<std::string>	m_resolvedNamespaces;
+		bool				m_cacheNodes;
+		bool				m_reconcile;
+		unsigned int			m_reconcileDelay;	// 0 if no retry is due
+		std::chrono::steady_clock::time_point
+						m_nextReconcile;
+		long				m_reportingInterval;
+		size_t				m_maxArrayLength;
+		std::string			m_monitoringConfig;
+		std::string			m_filterConfig;
+		NodeFilter			m_filter;
+		MonitoringSettings		m_monitoring;
+		std::vector<std::pair<std::string, MonitoringSettings> >
+						m_monitoringOverrides;
+		std::string			m_exceptionConfig;
+		ExceptionSettings		m_exception;
+		std::vector<std::pair<std::string, ExceptionSettings> >
+						m_exceptionOverrides;
+		bool				m_heartbeats;
+		unsigned int			m_aggregateWindow;
+		std::string			m_aggregatePattern;
+		bool				m_backfill;
+		unsigned int			m_backfillRate;	// Values per second
+		UA_UInt32			m_historyChunk;
+		std::atomic<bool>		m_threadStop;
+		std::atomic<bool>		m_pausing;
+		unsigned int			m_paused;
+		std::mutex			m_pauseMutex;
+		std::condition_variable		m_pauseCV;
+		std::thread			*m_connectThread;
+		std::atomic<bool>		m_connectStop;
+		unsigned int			m_reconnectMinDelay;
+		unsigned int			m_reconnectMaxDelay;
+		UA_UInt32			m_maxItemsPerCall;
+		std::mutex			m_contextMutex;
+		Metrics				m_metrics;
+		unsigned int			m_statisticsInterval;
+		bool				m_statisticsLog;
+		bool				m_statisticsAsset;
+		std::chrono::steady_clock::time_point
+						m_lastReport;
+		TimestampType			m_timestampType;
+		bool				m_batching;
+		unsigned int			m_maxBatchSize;
+		unsigned int			m_flushLatency;
+		unsigned int			m_ingestQueueSize;
+		OverflowPolicy			m_overflowPolicy;
+		std::thread			*m_dispatcher;
+		std::atomic<bool>		m_dispatcherStop;
+		std::atomic<bool>		m_dispatcherIdle;
+		std::mutex			m_dispatcherMutex;
+		std::condition_variable		m_dispatcherCV;
+		ContextPool			m_contextPool;
+		std::unordered_set<std::string>	m_names;
 };
 
 #if 0
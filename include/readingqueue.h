@@ -0,0 +1,51 @@
+#ifndef _READINGQUEUE_H
+#define _READINGQUEUE_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <reading.h>
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * A bounded, lock free queue of readings between the thread that services
+ * a session with the OPC UA server and the thread that ingests the readings.
+ * There is a single producer and a single consumer. The producer may also
+ * remove the oldest reading when the queue is full, so the consumer claims
+ * each reading by advancing the head with a compare and swap.
+ */
+class ReadingQueue
+{
+	public:
+		ReadingQueue(size_t capacity);
+		~ReadingQueue();
+		bool		push(Reading *reading);
+		Reading		*pop();
+		Reading		*dropOldest();
+		size_t		depth() const
+				{
+					return m_tail.load(std::memory_order_acquire)
+						- m_head.load(std::memory_order_acquire);
+				}
+		size_t		capacity() const { return m_mask + 1; }
+		size_t		highWater() const { return m_highWater.load(std::memory_order_relaxed); }
+	private:
+		std::atomic<Reading *>	*m_slots;
+		size_t			m_mask;
+		// The head and tail are written by different threads, keep
+		// them in separate cache lines. The high water mark is only
+		// written by the producer.
+		char			m_pad1[64];
+		std::atomic<uint64_t>	m_head;
+		char			m_pad2[64];
+		std::atomic<uint64_t>	m_tail;
+		std::atomic<size_t>	m_highWater;
+		char			m_pad3[64];
+};
+#endif
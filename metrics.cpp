@@ -0,0 +1,104 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <metrics.h>
+
+using namespace std;
+
+/**
+ * Create an empty latency histogram
+ */
+LatencyHistogram::LatencyHistogram()
+{
+	for (size_t i = 0; i < BUCKETS; i++)
+		m_counts[i].store(0, memory_order_relaxed);
+}
+
+/**
+ * Return the bucket that holds a value. Values below 2^LATENCY_PRECISION
+ * have a bucket each, above that each power of two is divided into
+ * 2^(LATENCY_PRECISION - 1) buckets.
+ *
+ * @param value	The value
+ * @return	The index of the bucket
+ */
+size_t LatencyHistogram::bucket(uint64_t value)
+{
+	if (value < (1 << LATENCY_PRECISION))
+		return value;
+	if (value > LATENCY_MAX)
+		value = LATENCY_MAX;
+	int msb = 63 - __builtin_clzll(value);
+	int magnitude = msb - (LATENCY_PRECISION - 1);
+	return magnitude * (1 << (LATENCY_PRECISION - 1)) + (value >> magnitude);
+}
+
+/**
+ * Return the value at the middle of a bucket
+ *
+ * @param bucket	The index of the bucket
+ * @return		The value the bucket represents
+ */
+uint64_t LatencyHistogram::bucketValue(size_t bucket)
+{
+	if (bucket < (1 << LATENCY_PRECISION))
+		return bucket;
+	int magnitude = bucket / (1 << (LATENCY_PRECISION - 1)) - 1;
+	uint64_t sub = bucket - magnitude * (1 << (LATENCY_PRECISION - 1));
+	return (sub << magnitude) + ((1ULL << magnitude) >> 1);
+}
+
+/**
+ * Record a latency
+ *
+ * @param value	The latency in microseconds
+ */
+void LatencyHistogram::record(uint64_t value)
+{
+	m_counts[bucket(value)].fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * Return the percentiles of the latencies recorded since the last call
+ * and empty the histogram
+ *
+ * @return	The summary of the latencies recorded
+ */
+LatencyHistogram::Summary LatencyHistogram::collect()
+{
+	uint64_t counts[BUCKETS];
+	Summary summary = { 0, 0, 0, 0, 0 };
+	for (size_t i = 0; i < BUCKETS; i++)
+	{
+		counts[i] = m_counts[i].exchange(0, memory_order_relaxed);
+		summary.count += counts[i];
+	}
+	if (summary.count == 0)
+		return summary;
+
+	uint64_t p50 = (summary.count * 50 + 99) / 100;
+	uint64_t p90 = (summary.count * 90 + 99) / 100;
+	uint64_t p99 = (summary.count * 99 + 99) / 100;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKETS; i++)
+	{
+		if (counts[i] == 0)
+			continue;
+		uint64_t value = bucketValue(i);
+		if (seen < p50 && seen + counts[i] >= p50)
+			summary.p50 = value;
+		if (seen < p90 && seen + counts[i] >= p90)
+			summary.p90 = value;
+		if (seen < p99 && seen + counts[i] >= p99)
+			summary.p99 = value;
+		summary.max = value;
+		seen += counts[i];
+	}
+	return summary;
+}
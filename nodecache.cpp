@@ -0,0 +1,263 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <logger.h>
+#include <utils.h>
+#include <fstream>
+#include <functional>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+
+using namespace std;
+
+/**
+ * The version of the node cache file format, a cache written with any other
+ * version is ignored
+ */
+#define CACHE_VERSION	"open62541 node cache 3"
+
+/**
+ * Return the string form of a node id
+ *
+ * @param id	The node id
+ * @return	The node id as a string of the form ns=...;s=...
+ */
+string nodeIdToString(const UA_NodeId *id)
+{
+	UA_String str = UA_STRING_NULL;
+	UA_NodeId_print(id, &str);
+	string rval((char *)str.data, str.length);
+	UA_String_clear(&str);
+	return rval;
+}
+
+/**
+ * Escape a field of a line of the node cache, the fields are separated by
+ * tabs and the lines by newlines
+ *
+ * @param field	The field to escape
+ * @return	The field with backslashes, tabs and line breaks escaped
+ */
+static string escapeField(const string& field)
+{
+	string rval;
+	rval.reserve(field.size());
+	for (auto c : field)
+	{
+		switch (c)
+		{
+			case '\\':
+				rval += "\\\\";
+				break;
+			case '\t':
+				rval += "\\t";
+				break;
+			case '\n':
+				rval += "\\n";
+				break;
+			case '\r':
+				rval += "\\r";
+				break;
+			default:
+				rval += c;
+				break;
+		}
+	}
+	return rval;
+}
+
+/**
+ * Reverse the escaping of a field of a line of the node cache
+ *
+ * @param field	The escaped field
+ * @return	The field as it was before it was escaped
+ */
+static string unescapeField(const string& field)
+{
+	string rval;
+	rval.reserve(field.size());
+	for (size_t i = 0; i < field.size(); i++)
+	{
+		char c = field[i];
+		if (c == '\\' && i + 1 < field.size())
+		{
+			c = field[++i];
+			if (c == 't')
+				c = '\t';
+			else if (c == 'n')
+				c = '\n';
+			else if (c == 'r')
+				c = '\r';
+		}
+		rval += c;
+	}
+	return rval;
+}
+
+/**
+ * Return the filter configuration as a single line, the variables in the
+ * cache are those that remained once the filter was applied
+ *
+ * @return	The filter configuration
+ */
+string OPCUA::filterKey()
+{
+	string key = m_filterConfig;
+	for (auto& c : key)
+	{
+		if (c == '\n' || c == '\r')
+			c = ' ';
+	}
+	return key;
+}
+
+/**
+ * Return the name of the file used to cache the nodes resolved for the
+ * current server URL and subscription roots, and whether the roots are
+ * node ids or browse names
+ *
+ * @return	The path of the node cache file
+ */
+string OPCUA::cacheFile()
+{
+	string key = m_url + (m_subscribeById ? "\nbyid" : "\nbyname");
+	for (auto& item : m_subscriptions)
+	{
+		key += "\n" + item;
+	}
+	char buf[40];
+	snprintf(buf, sizeof(buf), "%016lx", (unsigned long)hash<string>()(key));
+
+	string dir = getDataDir() + "/open62541";
+	mkdir(dir.c_str(), 0755);
+	return dir + "/" + buf + ".cache";
+}
+
+/**
+ * Load the nodes to monitor from the node cache. The cache is only used if
+ * it was written for the same server URL, subscription roots, interpretation
+ * of the roots and namespace array as we currently have.
+ *
+ * @return	True if the nodes were loaded from the cache
+ */
+bool OPCUA::loadCache()
+{
+	string filename = cacheFile();
+	ifstream in(filename);
+	if (!in.is_open())
+	{
+		return false;
+	}
+
+	string line;
+	if (!getline(in, line) || line.compare(CACHE_VERSION) != 0)
+	{
+		Logger::getLogger()->warn("Ignoring node cache %s with unknown format", filename.c_str());
+		return false;
+	}
+
+	// The key of the cache must match our current configuration and server
+	vector<string> key;
+	key.push_back("url " + m_url);
+	key.push_back(string("byid ") + (m_subscribeById ? "true" : "false"));
+	for (auto& item : m_subscriptions)
+		key.push_back("root " + item);
+	key.push_back("filter " + filterKey());
+	key.push_back("mapping " + to_string(m_assetMapping) + " " + to_string(m_assetPathDepth));
+	for (auto& ns : m_namespaces)
+		key.push_back("ns " + ns);
+	for (auto& expected : key)
+	{
+		if (!getline(in, line) || line.compare(expected) != 0)
+		{
+			Logger::getLogger()->info("Node cache %s does not match the server, it will be rebuilt",
+					filename.c_str());
+			return false;
+		}
+	}
+
+	long count = 0;
+	if (!getline(in, line) || sscanf(line.c_str(), "nodes %ld", &count) != 1)
+	{
+		return false;
+	}
+	while (getline(in, line))
+	{
+		size_t tab1 = line.find('\t');
+		size_t tab2 = tab1 == string::npos ? string::npos : line.find('\t', tab1 + 1);
+		size_t tab3 = tab2 == string::npos ? string::npos : line.find('\t', tab2 + 1);
+		if (tab3 == string::npos)
+			break;
+		string id = unescapeField(line.substr(0, tab1));
+		string type = line.substr(tab1 + 1, tab2 - tab1 - 1);
+
+		MonitoredNode node;
+		UA_String str = UA_STRING((char *)id.c_str());
+		str.length = id.length();
+		if (UA_NodeId_parse(&node.nodeId, str) != UA_STATUSCODE_GOOD)
+			break;
+		str = UA_STRING((char *)type.c_str());
+		str.length = type.length();
+		if (UA_NodeId_parse(&node.dataType, str) != UA_STATUSCODE_GOOD)
+			UA_NodeId_init(&node.dataType);
+		node.datapoint = unescapeField(line.substr(tab2 + 1, tab3 - tab2 - 1));
+		node.asset = unescapeField(line.substr(tab3 + 1));
+		node.monitoredItemId = 0;
+		node.shard = 0;
+		m_nodes.push_back(node);
+	}
+	if (m_nodes.size() != (size_t)count)
+	{
+		Logger::getLogger()->warn("Node cache %s is truncated, it will be rebuilt", filename.c_str());
+		clearNodes();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Write the nodes we are monitoring to the node cache
+ */
+void OPCUA::saveCache()
+{
+	string filename = cacheFile();
+	string tmpname = filename + ".tmp";
+	ofstream out(tmpname, ios::trunc);
+	if (!out.is_open())
+	{
+		Logger::getLogger()->warn("Unable to write node cache %s", tmpname.c_str());
+		return;
+	}
+
+	out << CACHE_VERSION << "\n";
+	out << "url " << m_url << "\n";
+	out << "byid " << (m_subscribeById ? "true" : "false") << "\n";
+	for (auto& item : m_subscriptions)
+		out << "root " << item << "\n";
+	out << "filter " << filterKey() << "\n";
+	out << "mapping " << m_assetMapping << " " << m_assetPathDepth << "\n";
+	for (auto& ns : m_namespaces)
+		out << "ns " << ns << "\n";
+	out << "nodes " << m_nodes.size() << "\n";
+	for (auto& node : m_nodes)
+	{
+		out << escapeField(nodeIdToString(&node.nodeId)) << "\t"
+			<< nodeIdToString(&node.dataType) << "\t"
+			<< escapeField(node.datapoint) << "\t"
+			<< escapeField(node.asset) << "\n";
+	}
+	out.close();
+	if (out.fail() || rename(tmpname.c_str(), filename.c_str()) != 0)
+	{
+		Logger::getLogger()->warn("Unable to write node cache %s", filename.c_str());
+		unlink(tmpname.c_str());
+	}
+}
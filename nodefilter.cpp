@@ -0,0 +1,291 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <nodefilter.h>
+#include <logger.h>
+#include <rapidjson/document.h>
+#include <fnmatch.h>
+
+using namespace std;
+
+/**
+ * The names of the built in data types that may be given in a rule, the
+ * index in the array is the numeric node id of the type in namespace 0
+ */
+static const char *dataTypeNames[] = {
+	"", "Boolean", "SByte", "Byte", "Int16", "UInt16", "Int32", "UInt32",
+	"Int64", "UInt64", "Float", "Double", "String", "DateTime", "Guid",
+	"ByteString", "XmlElement", "NodeId", "ExpandedNodeId", "StatusCode",
+	"QualifiedName", "LocalizedText", "Structure", "DataValue", "BaseDataType",
+	"DiagnosticInfo", "Number", "Integer", "UInteger", "Enumeration"
+};
+
+/**
+ * Create an empty filter, that includes every node
+ */
+NodeFilter::NodeFilter() : m_dryRun(false), m_hasInclude(false),
+	m_usesBrowsePath(false), m_usesDataType(false)
+{
+}
+
+/**
+ * Destroy the filter
+ */
+NodeFilter::~NodeFilter()
+{
+	clear();
+}
+
+/**
+ * Remove all the rules from the filter
+ */
+void NodeFilter::clear()
+{
+	for (auto& rule : m_rules)
+		UA_NodeId_clear(&rule.dataType);
+	m_rules.clear();
+	m_dryRun = false;
+	m_hasInclude = false;
+	m_usesBrowsePath = false;
+	m_usesDataType = false;
+}
+
+/**
+ * Parse the filter configuration. This is an object with an array of rules
+ * and a dry run flag, each rule has an action of include or exclude and any
+ * of the conditions browsePath, regex, nodeClass, dataType and namespace.
+ * A rule that can not be parsed is ignored.
+ *
+ * @param json	The filter configuration
+ * @return	False if the configuration is not valid
+ */
+bool NodeFilter::parse(const string& json)
+{
+	clear();
+	rapidjson::Document doc;
+	doc.Parse(json.c_str());
+	if (doc.HasParseError() || !doc.IsObject())
+	{
+		Logger::getLogger()->error("Invalid filter configuration, all nodes will be included");
+		return false;
+	}
+	if (doc.HasMember("dryRun") && doc["dryRun"].IsBool())
+		m_dryRun = doc["dryRun"].GetBool();
+	if (!doc.HasMember("rules") || !doc["rules"].IsArray())
+		return true;
+
+	const rapidjson::Value& rules = doc["rules"];
+	for (rapidjson::SizeType i = 0; i < rules.Size(); i++)
+	{
+		const rapidjson::Value& value = rules[i];
+		if (!value.IsObject() || !value.HasMember("action") || !value["action"].IsString())
+		{
+			Logger::getLogger()->error("Filter rule %d has no action, it is ignored", i + 1);
+			continue;
+		}
+		Rule rule;
+		string action = value["action"].GetString();
+		if (action.compare("include") != 0 && action.compare("exclude") != 0)
+		{
+			Logger::getLogger()->error("Filter rule %d has an invalid action '%s', it is ignored",
+					i + 1, action.c_str());
+			continue;
+		}
+		rule.exclude = action.compare("exclude") == 0;
+		rule.description = action;
+		rule.nodeClass = UA_NODECLASS_UNSPECIFIED;
+		rule.hasRegex = false;
+		rule.hasDataType = false;
+		UA_NodeId_init(&rule.dataType);
+		rule.ns = -1;
+		rule.matched = 0;
+
+		bool valid = true;
+		if (value.HasMember("browsePath") && value["browsePath"].IsString())
+		{
+			rule.glob = value["browsePath"].GetString();
+			rule.description += " browsePath '" + rule.glob + "'";
+		}
+		if (value.HasMember("regex") && value["regex"].IsString())
+		{
+			try {
+				rule.regex = regex(value["regex"].GetString(), regex::extended | regex::optimize);
+				rule.hasRegex = true;
+				rule.description += string(" regex '") + value["regex"].GetString() + "'";
+			} catch (regex_error& e) {
+				Logger::getLogger()->error("Filter rule %d has an invalid regex: %s", i + 1, e.what());
+				valid = false;
+			}
+		}
+		if (value.HasMember("nodeClass") && value["nodeClass"].IsString())
+		{
+			string nodeClass = value["nodeClass"].GetString();
+			if (nodeClass.compare("Object") == 0)
+				rule.nodeClass = UA_NODECLASS_OBJECT;
+			else if (nodeClass.compare("Variable") == 0)
+				rule.nodeClass = UA_NODECLASS_VARIABLE;
+			else
+			{
+				Logger::getLogger()->error("Filter rule %d has an invalid node class '%s'",
+						i + 1, nodeClass.c_str());
+				valid = false;
+			}
+			rule.description += " nodeClass " + nodeClass;
+		}
+		if (value.HasMember("dataType") && value["dataType"].IsString())
+		{
+			string type = value["dataType"].GetString();
+			for (size_t t = 1; t < sizeof(dataTypeNames) / sizeof(dataTypeNames[0]); t++)
+			{
+				if (type.compare(dataTypeNames[t]) == 0)
+				{
+					rule.dataType = UA_NODEID_NUMERIC(0, t);
+					rule.hasDataType = true;
+				}
+			}
+			if (!rule.hasDataType)
+			{
+				// Not a built in type, it may be the node id of the type
+				UA_String str = UA_STRING((char *)type.c_str());
+				rule.hasDataType = UA_NodeId_parse(&rule.dataType, str) == UA_STATUSCODE_GOOD;
+			}
+			if (!rule.hasDataType)
+			{
+				Logger::getLogger()->error("Filter rule %d has an invalid data type '%s'",
+						i + 1, type.c_str());
+				valid = false;
+			}
+			rule.description += " dataType " + type;
+		}
+		if (value.HasMember("namespace"))
+		{
+			if (value["namespace"].IsUint())
+			{
+				rule.ns = value["namespace"].GetUint();
+				rule.description += " namespace " + to_string(rule.ns);
+			}
+			else if (value["namespace"].IsString())
+			{
+				rule.namespaceUri = value["namespace"].GetString();
+				rule.description += " namespace " + rule.namespaceUri;
+			}
+		}
+		if (!valid)
+		{
+			UA_NodeId_clear(&rule.dataType);
+			continue;
+		}
+		if (rule.nodeClass == UA_NODECLASS_OBJECT && rule.hasDataType)
+		{
+			Logger::getLogger()->warn("Filter rule %d matches objects by data type, it will never match", i + 1);
+		}
+		m_usesBrowsePath |= !rule.glob.empty() || rule.hasRegex;
+		m_usesDataType |= rule.hasDataType;
+		m_hasInclude |= !rule.exclude;
+		m_rules.push_back(rule);
+	}
+	return true;
+}
+
+/**
+ * Prepare the filter for a browse of the server. The counts of the nodes
+ * matched by each rule are reset and the rules that give a namespace URI
+ * are resolved to the index of that namespace in the server.
+ *
+ * @param namespaces	The namespace array of the server
+ */
+void NodeFilter::start(const vector<string>& namespaces)
+{
+	for (auto& rule : m_rules)
+	{
+		rule.matched = 0;
+		if (rule.namespaceUri.empty())
+			continue;
+		// A namespace the server does not have matches no nodes
+		rule.ns = -2;
+		for (size_t i = 0; i < namespaces.size(); i++)
+		{
+			if (namespaces[i].compare(rule.namespaceUri) == 0)
+				rule.ns = i;
+		}
+	}
+}
+
+/**
+ * Find the first rule that matches a node
+ *
+ * @param nodeClass	The class of the node
+ * @param path		The browse path of the node
+ * @param id		The node id of the node
+ * @param dataType	The data type of a variable, or NULL for an object
+ * @return		The rule that matched or NULL if no rule matched
+ */
+const NodeFilter::Rule *NodeFilter::match(UA_NodeClass nodeClass, const string& path,
+		const UA_NodeId *id, const UA_NodeId *dataType)
+{
+	for (auto& rule : m_rules)
+	{
+		if (rule.nodeClass != UA_NODECLASS_UNSPECIFIED && rule.nodeClass != nodeClass)
+			continue;
+		if (rule.ns != -1 && rule.ns != id->namespaceIndex)
+			continue;
+		if (rule.hasDataType && (!dataType || !UA_NodeId_equal(&rule.dataType, dataType)))
+			continue;
+		if (!rule.glob.empty() && fnmatch(rule.glob.c_str(), path.c_str(), 0) != 0)
+			continue;
+		if (rule.hasRegex && !regex_search(path, rule.regex))
+			continue;
+		rule.matched++;
+		return &rule;
+	}
+	return NULL;
+}
+
+/**
+ * Decide whether an object is excluded. The objects and variables below
+ * an object that is excluded are not browsed. An object is never excluded
+ * only because it fails to match an include rule, as the variables below
+ * it may match.
+ *
+ * @param path	The browse path of the object
+ * @param id	The node id of the object
+ * @return	True if the object is excluded
+ */
+bool NodeFilter::excludeObject(const string& path, const UA_NodeId *id)
+{
+	const Rule *rule = match(UA_NODECLASS_OBJECT, path, id, NULL);
+	return rule && rule->exclude;
+}
+
+/**
+ * Decide whether a variable is excluded. A variable that matches no rule
+ * is excluded if there are include rules, otherwise it is included.
+ *
+ * @param path		The browse path of the variable
+ * @param id		The node id of the variable
+ * @param dataType	The data type of the variable
+ * @return		True if the variable is excluded
+ */
+bool NodeFilter::excludeVariable(const string& path, const UA_NodeId *id, const UA_NodeId *dataType)
+{
+	const Rule *rule = match(UA_NODECLASS_VARIABLE, path, id, dataType);
+	return rule ? rule->exclude : m_hasInclude;
+}
+
+/**
+ * Log the number of nodes each rule matched during the last browse
+ */
+void NodeFilter::report() const
+{
+	for (size_t i = 0; i < m_rules.size(); i++)
+	{
+		Logger::getLogger()->info("Filter rule %d, %s: matched %lu nodes", (int)i + 1,
+				m_rules[i].description.c_str(), m_rules[i].matched);
+	}
+}
@@ -11,6 +11,10 @@
 #include <reading.h>
 #include <logger.h>
 #include <map>
+#include <fnmatch.h>
+#include <tuple>
+#include <stdio.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -28,25 +32,28 @@ using namespace std;
 void logWrapper(void *logContext, UA_LogLevel level, UA_LogCategory category,
                 const char *msg, va_list args)
 {
+	// Messages Fledge would discard are dropped before they are formatted
+	if (level < ((OPCUA *)logContext)->logLevel())
+		return;
 	char buf[200];
 	vsnprintf(buf, sizeof(buf), msg, args);
 	switch (level)
 	{
 		case UA_LOGLEVEL_FATAL:
-			Logger::getLogger()->fatal(buf);
+			Logger::getLogger()->fatal("%s", buf);
 			break;
 		case UA_LOGLEVEL_ERROR:
-			Logger::getLogger()->error(buf);
+			Logger::getLogger()->error("%s", buf);
 			break;
 		case UA_LOGLEVEL_WARNING:
-			Logger::getLogger()->warn(buf);
+			Logger::getLogger()->warn("%s", buf);
 			break;
 		case UA_LOGLEVEL_INFO:
-			Logger::getLogger()->info(buf);
+			Logger::getLogger()->info("%s", buf);
 			break;
 		case UA_LOGLEVEL_DEBUG:
 		case UA_LOGLEVEL_TRACE:
-			Logger::getLogger()->debug(buf);
+			Logger::getLogger()->debug("%s", buf);
 			break;
 	}
 }
@@ -65,8 +72,30 @@ void logClear(void *context)
  * Constructor for the opcua plugin
  */
 OPCUA::OPCUA(const string& url) : m_url(url), m_subscribeById(false),
-	m_connected(false), m_client(NULL)
+	m_connected(false), m_client(NULL), m_logLevel(UA_LOGLEVEL_WARNING),
+	m_traceInterval(1000), m_polled(false), m_pollInterval(1000), m_readPipeline(4),
+	m_readChunk(MAX_NODES_PER_READ), m_registerChunk(MAX_NODES_PER_READ),
+	m_assetMapping(MapVariable), m_assetPathDepth(1), m_lastKnownValues(false),
+	m_startupPipeline(4), m_pipeline(NULL), m_pipelineGeneration(0),
+	m_sessionCount(1), m_subscriptionsPerSession(1), m_cacheNodes(true), m_reconcile(false), m_reconcileDelay(0),
+	m_reportingInterval(1000), m_maxArrayLength(10000), m_aggregateWindow(0), m_backfill(false), m_backfillRate(1000),
+	m_historyChunk(0), m_threadStop(false), m_pausing(false), m_paused(0), m_connectThread(NULL), m_connectStop(false),
+	m_reconnectMinDelay(500), m_reconnectMaxDelay(30000),
+	m_maxItemsPerCall(MAX_ITEMS_PER_CALL), m_statisticsInterval(0),
+	m_statisticsLog(true), m_statisticsAsset(false),
+	m_timestampType(TimestampSource), m_batching(false),
+	m_maxBatchSize(1000), m_flushLatency(0),
+	m_ingestQueueSize(10000), m_overflowPolicy(OverflowBlock),
+	m_dispatcher(NULL), m_dispatcherStop(false), m_dispatcherIdle(false)
 {
+	m_metrics.readings = 0;
+	m_metrics.itemsCreated = 0;
+	m_metrics.itemFailures = 0;
+	m_metrics.browseTime = 0;
+	m_metrics.monitorTime = 0;
+	setMonitoring("{}");
+	setReportByException("{}");
+	updateLogLevel();
 	m_UAlogger.log = logWrapper;
 	m_UAlogger.context = this;
 	m_UAlogger.clear = logClear;
@@ -75,18 +104,29 @@ OPCUA::OPCUA(const string& url) : m_url(url), m_subscribeById(false),
 /**
  * Data changed callback for monitored items in the OPCUA server
  */
-static void dataChangeHandler(UA_Client *client, UA_UInt32 subId, void *subContext,
+void dataChangeHandler(UA_Client *client, UA_UInt32 subId, void *subContext,
                          UA_UInt32 monId, void *monContext, UA_DataValue *value)
 {
 	OPCUA *opcua = (OPCUA *)subContext;
-	const string *nameNode = (string *)monContext;
-	opcua->dataChanged(nameNode, value);
+	opcua->dataChanged((MonitoredItemContext *)monContext, value);
 }
 
 static void threadWrapper(void *data)
+{
+	Session *session = (Session *)data;
+	session->opcua->threadStart(session);
+}
+
+static void dispatcherWrapper(void *data)
+{
+	OPCUA *opcua = (OPCUA *)data;
+	opcua->dispatcher();
+}
+
+static void connectWrapper(void *data)
 {
 	OPCUA *opcua = (OPCUA *)data;
-	opcua->threadStart();
+	opcua->connectLoop();
 }
 
 /**
@@ -94,8 +134,9 @@ static void threadWrapper(void *data)
  */
 OPCUA::~OPCUA()
 {
-	if (m_client)
-		UA_Client_delete(m_client);
+	clearNodes();
+	closeSessions();
+	clearResolved();
 }
 
 /**
@@ -110,252 +151,2610 @@ OPCUA::setAssetName(const std::string& asset)
 }
 
 /**
- * Clear down the subscriptions ahead of reconfiguration
+ * Clear down the subscriptions ahead of reconfiguration
+ */
+void
+OPCUA::clearSubscription()
+{
+	lock_guard<mutex> guard(m_configMutex);
+	m_subscriptions.clear();
+}
+
+/**
+ * Add a subscription parent node to the list
+ */
+void
+OPCUA::addSubscription(const string& parent)
+{
+	lock_guard<mutex> guard(m_configMutex);
+	m_subscriptions.push_back(parent);
+}
+
+/**
+ * Restart the OPCUA connection
+ */
+void
+OPCUA::restart()
+{
+	stop();
+	start();
+}
+
+/**
+ * Derive the datapoint name to use for a variable from its node id
+ *
+ * @param id	The node id of the variable
+ * @return	The datapoint name
+ */
+static string datapointName(const UA_NodeId *id)
+{
+	string dpname = "Unknown";
+	if (id->identifierType == UA_NODEIDTYPE_NUMERIC)
+	{
+		char buf[80];
+		snprintf(buf, sizeof(buf), "%u", id->identifier.numeric);
+		dpname = buf;
+	}
+	else
+	{
+		dpname = string((char *)(id->identifier.byteString.data),
+				id->identifier.byteString.length);
+	}
+	// Strip " from datapoint name
+	size_t pos;
+	while ((pos = dpname.find_first_of("\"")) != std::string::npos)
+	{
+		dpname.erase(pos, 1);
+	}
+	return dpname;
+}
+
+/**
+ * Handle the references returned for one node by a Browse or BrowseNext
+ * request. Variables are added to the set of nodes to monitor and objects
+ * are queued to be browsed in turn. Any node that has already been visited
+ * is ignored, this prevents loops in address spaces that contain cycles.
+ * Objects the filter excludes are not queued, unless the filter is a dry
+ * run, so nothing below them is browsed.
+ *
+ * @param result	The browse result for the node
+ * @param parent	The node that was browsed
+ * @param visited	The set of nodes already visited
+ * @param queue		The queue of objects waiting to be browsed
+ * @param variables	The browse paths of the variables added
+ * @param pruned	Incremented for each object the filter excludes
+ * @return		The number of variables added
+ */
+int OPCUA::browseResult(const UA_BrowseResult *result, const BrowseNode& parent,
+		NodeIdSet& visited, deque<BrowseNode>& queue, vector<BrowseNode>& variables,
+		int& pruned)
+{
+	int n_variables = 0;
+	for (size_t j = 0; j < result->referencesSize; j++)
+	{
+		UA_ReferenceDescription *ref = &(result->references[j]);
+		if (ref->nodeId.serverIndex != 0)	// Node is in a remote server
+			continue;
+		if (visited.find(ref->nodeId.nodeId) != visited.end())
+			continue;
+		UA_NodeId id;
+		UA_NodeId_copy(&(ref->nodeId.nodeId), &id);
+		visited.insert(id);
+		BrowseNode node;
+		UA_NodeId_init(&node.nodeId);
+		node.excluded = parent.excluded;
+		string name((char *)ref->browseName.name.data, ref->browseName.name.length);
+		if (m_filter.usesBrowsePath())
+		{
+			node.path = to_string(ref->browseName.namespaceIndex) + ":" + name;
+			if (!parent.path.empty())
+				node.path = parent.path + "/" + node.path;
+		}
+		if (ref->nodeClass == UA_NODECLASS_VARIABLE)
+		{
+			// Monitored items are created in bulk once the browse is complete
+			MonitoredNode monNode;
+			UA_NodeId_copy(&id, &monNode.nodeId);
+			monNode.datapoint = datapointName(&id);
+			if (m_assetMapping == MapParentObject || (m_assetMapping == MapPathDepth && parent.group.empty()))
+				monNode.asset = parent.object;
+			else if (m_assetMapping == MapPathDepth)
+				monNode.asset = parent.group;
+			UA_NodeId_init(&monNode.dataType);
+			monNode.monitoredItemId = 0;
+			monNode.shard = 0;
+			m_nodes.push_back(monNode);
+			variables.push_back(node);
+			n_variables++;
+		}
+		else if (ref->nodeClass == UA_NODECLASS_OBJECT)
+		{
+			if (!node.excluded && !m_filter.empty() && m_filter.excludeObject(node.path, &id))
+			{
+				pruned++;
+				if (!m_filter.dryRun())
+					continue;
+				node.excluded = true;
+			}
+			if (grouped())
+			{
+				node.object = name;
+				node.depth = parent.depth + 1;
+				node.group = parent.group;
+				if (node.depth <= m_assetPathDepth)
+					node.group = parent.group.empty() ? name : parent.group + "/" + name;
+			}
+			UA_NodeId_copy(&id, &node.nodeId);
+			queue.push_back(node);
+		}
+	}
+	return n_variables;
+}
+
+/**
+ * Return the browse name of a subscription root, the asset of the variables
+ * directly below it when variables are grouped by object
+ *
+ * @param root	The node id of the root
+ * @return	The name of the root
+ */
+string OPCUA::rootName(const UA_NodeId *root)
+{
+	UA_QualifiedName name;
+	UA_QualifiedName_init(&name);
+	string rval;
+	if (UA_Client_readBrowseNameAttribute(m_client, *root, &name) == UA_STATUSCODE_GOOD)
+		rval = string((char *)name.name.data, name.name.length);
+	else
+		rval = datapointName(root);
+	UA_QualifiedName_clear(&name);
+	return rval;
+}
+
+/**
+ * Apply the filter to the variables found by a browse, removing those it
+ * excludes, and report the number of nodes each rule matched. A dry run
+ * only reports what would have been excluded. If the filter has rules on
+ * data types the data types of the variables are read first.
+ *
+ * @param first		The index in m_nodes of the first variable found
+ * @param variables	The browse paths of the variables found
+ * @param pruned	The number of objects the filter excluded
+ * @return		The number of variables that remain
+ */
+int OPCUA::filterNodes(size_t first, const vector<BrowseNode>& variables, int pruned)
+{
+	if (m_filter.usesDataType())
+		readDataTypes(first);
+	bool dryRun = m_filter.dryRun();
+	size_t found = m_nodes.size() - first;
+	size_t kept = first;
+	int excluded = 0;
+	for (size_t i = first; i < m_nodes.size(); i++)
+	{
+		MonitoredNode& node = m_nodes[i];
+		const BrowseNode& variable = variables[i - first];
+		if (variable.excluded || m_filter.excludeVariable(variable.path, &node.nodeId, &node.dataType))
+		{
+			excluded++;
+			if (!dryRun)
+			{
+				UA_NodeId_clear(&node.nodeId);
+				UA_NodeId_clear(&node.dataType);
+				continue;
+			}
+		}
+		if (kept != i)
+			m_nodes[kept] = node;
+		kept++;
+	}
+	m_nodes.resize(kept);
+	m_filter.report();
+	Logger::getLogger()->info("Filter %s %d of %d variables and %d objects, %d variables %s monitored",
+			dryRun ? "dry run would exclude" : "excluded", excluded, (int)found, pruned,
+			(int)found - excluded, dryRun ? "would be" : "are");
+	return m_nodes.size() - first;
+}
+
+/**
+ * Read one of the operation limits the server reports in its ServerCapabilities
+ *
+ * @param limitId	The numeric node id in namespace 0 of the operation limit
+ * @param defaultLimit	The value to use if the server does not report a limit
+ * @return		The operation limit
+ */
+UA_UInt32 OPCUA::operationLimit(UA_UInt32 limitId, UA_UInt32 defaultLimit)
+{
+	UA_UInt32 limit = defaultLimit;
+	UA_Variant value;
+	UA_Variant_init(&value);
+	UA_StatusCode rval = UA_Client_readValueAttribute(m_client, UA_NODEID_NUMERIC(0, limitId), &value);
+	if (rval == UA_STATUSCODE_GOOD && UA_Variant_hasScalarType(&value, &UA_TYPES[UA_TYPES_UINT32]))
+	{
+		UA_UInt32 serverLimit = *(UA_UInt32 *)value.data;
+		// A limit of 0 means the server imposes no limit
+		if (serverLimit > 0)
+			limit = serverLimit;
+	}
+	UA_Variant_clear(&value);
+	return limit;
+}
+
+/**
+ * Create the monitored items for the variables found by the browse.
+ * Each variable is assigned to a shard by the hash of its node id, so
+ * that a variable stays in the same shard when the server is browsed
+ * again, and the items of each shard are created in its subscription.
+ *
+ * @param first	The index of the first node in m_nodes to create an item for
+ */
+void OPCUA::createMonitoredItems(size_t first)
+{
+	UA_UInt32 chunkSize = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXMONITOREDITEMSPERCALL,
+			MAX_ITEMS_PER_CALL);
+	m_maxItemsPerCall = chunkSize;
+	vector<vector<size_t> > shards(m_shards.size());
+	for (size_t i = first; i < m_nodes.size(); i++)
+	{
+		m_nodes[i].shard = UA_NodeId_hash(&m_nodes[i].nodeId) % m_shards.size();
+		shards[m_nodes[i].shard].push_back(i);
+	}
+	for (size_t i = 0; i < m_shards.size(); i++)
+	{
+		if (!shards[i].empty())
+			createMonitoredItems(m_shards[i], shards[i], chunkSize);
+	}
+}
+
+/**
+ * Create the monitored items of one shard. The items are created in chunks,
+ * each chunk being a single CreateMonitoredItems request no larger than the
+ * MaxMonitoredItemsPerCall operation limit of the server.
+ *
+ * @param shard		The shard to create the items in
+ * @param nodes		The indexes in m_nodes of the variables to monitor
+ * @param chunkSize	The maximum number of items to create in one request
+ */
+void OPCUA::createMonitoredItems(Shard *shard, const vector<size_t>& nodes, UA_UInt32 chunkSize)
+{
+	// Sessions that are recovering may recreate their items concurrently
+	lock_guard<mutex> guard(m_contextMutex);
+	size_t created = 0, failed = 0, requests = 0;
+
+	for (size_t base = 0; base < nodes.size(); base += chunkSize)
+	{
+		size_t n = nodes.size() - base;
+		if (n > chunkSize)
+			n = chunkSize;
+
+		vector<UA_MonitoredItemCreateRequest> items;
+		vector<UA_DataChangeFilter> filters(n);
+		vector<void *> contexts;
+		vector<UA_Client_DataChangeNotificationCallback> callbacks(n, dataChangeHandler);
+		vector<UA_Client_DeleteMonitoredItemCallback> deleteCallbacks(n, (UA_Client_DeleteMonitoredItemCallback)NULL);
+		for (size_t i = 0; i < n; i++)
+		{
+			MonitoredNode& node = m_nodes[nodes[base + i]];
+			items.push_back(UA_MonitoredItemCreateRequest_default(node.nodeId));
+			monitoringParameters(node, &items[i].requestedParameters, &filters[i]);
+			contexts.push_back(createContext(node, shard));
+		}
+
+		UA_CreateMonitoredItemsRequest request;
+		UA_CreateMonitoredItemsRequest_init(&request);
+		request.subscriptionId = shard->subscriptionId;
+		request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+		request.itemsToCreate = items.data();
+		request.itemsToCreateSize = n;
+
+		UA_CreateMonitoredItemsResponse response =
+			UA_Client_MonitoredItems_createDataChanges(shard->session->client, request,
+					contexts.data(), callbacks.data(), deleteCallbacks.data());
+		requests++;
+		if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+		{
+			Logger::getLogger()->error("Failed to create %d monitored items: %s", (int)n,
+					UA_StatusCode_name(response.responseHeader.serviceResult));
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			MonitoredNode& node = m_nodes[nodes[base + i]];
+			UA_StatusCode status = response.responseHeader.serviceResult;
+			if (i < response.resultsSize)
+				status = response.results[i].statusCode;
+			if (status == UA_STATUSCODE_GOOD)
+			{
+				node.monitoredItemId = response.results[i].monitoredItemId;
+				((MonitoredItemContext *)contexts[i])->monitoredItemId = node.monitoredItemId;
+				created++;
+			}
+			else
+			{
+				if (response.responseHeader.serviceResult == UA_STATUSCODE_GOOD)
+					Logger::getLogger()->error("Failed to monitor node %s: %s",
+						node.datapoint.c_str(), UA_StatusCode_name(status));
+				releaseContext((MonitoredItemContext *)contexts[i]);
+				failed++;
+			}
+		}
+		UA_CreateMonitoredItemsResponse_clear(&response);
+	}
+	shard->items += created;
+	m_metrics.itemsCreated.fetch_add(created, memory_order_relaxed);
+	m_metrics.itemFailures.fetch_add(failed, memory_order_relaxed);
+	Logger::getLogger()->info("Created %d monitored items in shard %d in %d requests, %d failed",
+			(int)created, shard->index, (int)requests, (int)failed);
+}
+
+/**
+ * Return the interned copy of a name. Names are shared by all the monitored
+ * item contexts that use them and remain valid until the contexts are cleared.
+ *
+ * @param name	The name to intern
+ * @return	The interned name
+ */
+const string *OPCUA::intern(const string& name)
+{
+	return &(*m_names.insert(name).first);
+}
+
+/**
+ * Build the context for a new monitored item
+ *
+ * @param node	The variable being monitored
+ * @param shard	The shard the item is created in
+ * @return	The context to pass to the data change callback of the item
+ */
+MonitoredItemContext *OPCUA::createContext(const MonitoredNode& node, Shard *shard)
+{
+	MonitoredItemContext *context = m_contextPool.allocate();
+	context->opcua = this;
+	context->datapoint = intern(node.datapoint);
+	if (node.asset.empty())
+		context->asset = context->datapoint;
+	else
+		context->asset = intern(m_asset + node.asset);
+	context->decoder = selectDecoder(&node.dataType);
+	context->shard = shard;
+	context->trace = NULL;
+	context->monitoredItemId = 0;
+	if (m_backfill)
+		UA_NodeId_copy(&node.nodeId, &context->nodeId);
+	else
+		UA_NodeId_init(&context->nodeId);
+	context->lastSource = 0;
+	context->firstSource = 0;
+	context->heartbeat = HEARTBEAT_NONE;
+	updateTrace(context);
+	updateException(context);
+	context->aggregate = AGGREGATE_NONE;
+	updateAggregate(context);
+	context->batch = assetBatch(shard->session->pending, batchAsset(context));
+	return context;
+}
+
+/**
+ * Return the batch of an asset, creating it if the asset has none
+ *
+ * @param pending	The batches of the session
+ * @param asset		The name of the asset
+ * @return		The batch of the asset
+ */
+AssetBatch *OPCUA::assetBatch(map<string, AssetBatch>& pending, const string& asset)
+{
+	auto it = pending.find(asset);
+	if (it == pending.end())
+	{
+		it = pending.emplace(piecewise_construct, forward_as_tuple(asset),
+				forward_as_tuple()).first;
+		it->second.asset = &it->first;
+		it->second.hasTimestamp = false;
+		it->second.latest.store(NULL);
+		it->second.next = NULL;
+		it->second.flushes = 0;
+	}
+	return &it->second;
+}
+
+/**
+ * Apply a change of the asset name, or of batching, to the batches of the
+ * monitored items without reconnecting to the server. This is called while
+ * the threads of the sessions are stopped. The datapoints batched under the
+ * previous names are sent first, then each item whose variables are grouped
+ * into assets is given the new name of its asset and every item is given
+ * the batch it now sends its values to, which takes over the last known
+ * values of the previous batch.
+ *
+ * @param previous	The asset name the monitored items were created with
+ */
+void OPCUA::rebuildBatches(const string& previous)
+{
+	for (auto session : m_sessions)
+		flushPending(session);
+	// No reading may be left referring to a batch that is replaced
+	while (dispatch())
+		;
+
+	lock_guard<mutex> guard(m_contextMutex);
+	map<Session *, map<string, AssetBatch> > renamed;
+	m_contextPool.forEach([&](MonitoredItemContext *context) {
+		Session *session = context->shard->session;
+		AssetBatch *batch = context->batch;
+		// Items named after their variable have no prefix to change
+		if (context->asset != context->datapoint)
+			context->asset = intern(m_asset + context->asset->substr(previous.size()));
+		map<string, AssetBatch>& pending = renamed[session];
+		const string& name = batchAsset(context);
+		bool created = pending.find(name) == pending.end();
+		context->batch = assetBatch(pending, name);
+		if (created)
+		{
+			context->batch->flushes = batch->flushes;
+			context->batch->lastValues.swap(batch->lastValues);
+		}
+		if (context->aggregate != AGGREGATE_NONE)
+			session->aggregator.rename(context->aggregate, context->asset);
+	});
+	for (auto session : m_sessions)
+	{
+		session->pending.swap(renamed[session]);
+		for (auto& node : session->backfill.nodes)
+		{
+			if (node.asset != node.datapoint)
+				node.asset = intern(m_asset + node.asset->substr(previous.size()));
+		}
+	}
+	if (previous.compare(m_asset))
+		Logger::getLogger()->info("Renamed the assets from '%s' to '%s'", previous.c_str(), m_asset.c_str());
+}
+
+/**
+ * Return the contexts of monitored items that have been deleted to the pool
+ *
+ * @param shard	The shard the items were deleted from
+ * @param ids	The ids of the items deleted, or empty if every item was deleted
+ */
+void OPCUA::releaseContexts(Shard *shard, const vector<UA_UInt32>& ids)
+{
+	unordered_set<UA_UInt32> deleted(ids.begin(), ids.end());
+	lock_guard<mutex> guard(m_contextMutex);
+	vector<MonitoredItemContext *> released;
+	m_contextPool.forEach([&](MonitoredItemContext *context) {
+		if (context->shard == shard && context->monitoredItemId
+				&& (ids.empty() || deleted.count(context->monitoredItemId)))
+			released.push_back(context);
+	});
+	for (auto context : released)
+		releaseContext(context);
+}
+
+/**
+ * Return the context of a monitored item to the pool, along with its slot
+ * in the aggregator and its place in the heartbeat list of its session and
+ * its node id
+ *
+ * @param context	The context to release
+ */
+void OPCUA::releaseContext(MonitoredItemContext *context)
+{
+	if (context->aggregate != AGGREGATE_NONE)
+		context->shard->session->aggregator.release(context->aggregate);
+	if (context->heartbeat != HEARTBEAT_NONE)
+		removeHeartbeat(context);
+	UA_NodeId_clear(&context->nodeId);
+	m_contextPool.release(context);
+}
+
+/**
+ * Release the contexts of the monitored items, along with the batches and
+ * names they refer to. The contexts are released together, by emptying the
+ * pool. This must only be called once the client that holds the monitored
+ * items has been deleted.
+ */
+void OPCUA::clearContexts()
+{
+	m_contextPool.forEach([](MonitoredItemContext *context) { UA_NodeId_clear(&context->nodeId); });
+	m_contextPool.clear();
+	for (auto session : m_sessions)
+	{
+		for (auto& it : session->pending)
+		{
+			for (auto dp : it.second.points)
+				delete dp;
+			delete it.second.latest.exchange(NULL);
+		}
+		session->coalesced.store(NULL);
+		session->aggregator.clear();
+		session->pending.clear();
+		session->dirty.clear();
+		session->heartbeats.clear();
+		session->pendingCount = 0;
+	}
+	m_names.clear();
+}
+
+/**
+ * Fill in the monitoring parameters for a variable. The parameters are taken
+ * from the first override whose pattern matches the node id or datapoint name
+ * of the variable, or from the default monitoring settings if none match.
+ *
+ * @param node		The variable being monitored
+ * @param params	The monitoring parameters to fill in
+ * @param filter	Storage for the data change filter, which must outlive the request
+ */
+void OPCUA::monitoringParameters(const MonitoredNode& node, UA_MonitoringParameters *params,
+		UA_DataChangeFilter *filter)
+{
+	const MonitoringSettings *settings = &m_monitoring;
+	if (!m_monitoringOverrides.empty())
+	{
+		string id = nodeIdToString(&node.nodeId);
+		for (auto& override : m_monitoringOverrides)
+		{
+			if (fnmatch(override.first.c_str(), id.c_str(), 0) == 0
+				|| fnmatch(override.first.c_str(), node.datapoint.c_str(), 0) == 0)
+			{
+				settings = &override.second;
+				break;
+			}
+		}
+	}
+
+	params->samplingInterval = settings->samplingInterval;
+	params->queueSize = settings->queueSize;
+	params->discardOldest = settings->discardOldest;
+	UA_ExtensionObject_init(&params->filter);
+	if (settings->deadbandType != UA_DEADBANDTYPE_NONE)
+	{
+		UA_DataChangeFilter_init(filter);
+		filter->trigger = UA_DATACHANGETRIGGER_STATUSVALUE;
+		filter->deadbandType = settings->deadbandType;
+		filter->deadbandValue = settings->deadbandValue;
+		params->filter.encoding = UA_EXTENSIONOBJECT_DECODED_NODELETE;
+		params->filter.content.decoded.type = &UA_TYPES[UA_TYPES_DATACHANGEFILTER];
+		params->filter.content.decoded.data = filter;
+	}
+}
+
+/**
+ * Apply the current monitoring settings to the existing monitored items of
+ * each shard, in chunks no larger than the MaxMonitoredItemsPerCall operation
+ * limit of the server.
+ */
+void OPCUA::modifyMonitoredItems()
+{
+	UA_UInt32 chunkSize = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXMONITOREDITEMSPERCALL,
+			MAX_ITEMS_PER_CALL);
+	size_t modified = 0, failed = 0;
+	vector<vector<MonitoredNode *> > shards(m_shards.size());
+	for (auto& node : m_nodes)
+	{
+		if (node.monitoredItemId)
+			shards[node.shard].push_back(&node);
+	}
+
+	for (size_t shard = 0; shard < m_shards.size(); shard++)
+	{
+		vector<MonitoredNode *>& nodes = shards[shard];
+		for (size_t base = 0; base < nodes.size(); base += chunkSize)
+		{
+			size_t n = nodes.size() - base;
+			if (n > chunkSize)
+				n = chunkSize;
+
+			vector<UA_MonitoredItemModifyRequest> items(n);
+			vector<UA_DataChangeFilter> filters(n);
+			for (size_t i = 0; i < n; i++)
+			{
+				UA_MonitoredItemModifyRequest_init(&items[i]);
+				items[i].monitoredItemId = nodes[base + i]->monitoredItemId;
+				monitoringParameters(*nodes[base + i], &items[i].requestedParameters, &filters[i]);
+			}
+
+			UA_ModifyMonitoredItemsRequest request;
+			UA_ModifyMonitoredItemsRequest_init(&request);
+			request.subscriptionId = m_shards[shard]->subscriptionId;
+			request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+			request.itemsToModify = items.data();
+			request.itemsToModifySize = n;
+
+			UA_ModifyMonitoredItemsResponse response = UA_Client_MonitoredItems_modify(
+					m_shards[shard]->session->client, request);
+			if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+			{
+				Logger::getLogger()->error("Failed to modify %d monitored items: %s", (int)n,
+						UA_StatusCode_name(response.responseHeader.serviceResult));
+				failed += n;
+			}
+			for (size_t i = 0; i < response.resultsSize; i++)
+			{
+				if (response.results[i].statusCode == UA_STATUSCODE_GOOD)
+				{
+					modified++;
+				}
+				else
+				{
+					Logger::getLogger()->error("Failed to modify monitoring of %s: %s",
+						nodes[base + i]->datapoint.c_str(),
+						UA_StatusCode_name(response.results[i].statusCode));
+					failed++;
+				}
+			}
+			UA_ModifyMonitoredItemsResponse_clear(&response);
+		}
+	}
+	Logger::getLogger()->info("Modified %d monitored items, %d failed", (int)modified, (int)failed);
+}
+
+/**
+ * Set the publishing interval of every subscription to the reporting interval
+ */
+void OPCUA::modifySubscription()
+{
+	UA_CreateSubscriptionRequest defaults = UA_CreateSubscriptionRequest_default();
+	for (auto shard : m_shards)
+	{
+		UA_ModifySubscriptionRequest request;
+		UA_ModifySubscriptionRequest_init(&request);
+		request.subscriptionId = shard->subscriptionId;
+		request.requestedPublishingInterval = m_reportingInterval;
+		request.requestedLifetimeCount = defaults.requestedLifetimeCount;
+		request.requestedMaxKeepAliveCount = defaults.requestedMaxKeepAliveCount;
+		request.maxNotificationsPerPublish = defaults.maxNotificationsPerPublish;
+		request.priority = defaults.priority;
+		UA_ModifySubscriptionResponse response = UA_Client_Subscriptions_modify(
+				shard->session->client, request);
+		if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+		{
+			Logger::getLogger()->error("Failed to modify the publishing interval of shard %d: %s",
+					shard->index, UA_StatusCode_name(response.responseHeader.serviceResult));
+		}
+		else
+		{
+			Logger::getLogger()->info("Publishing interval of shard %d is now %.0lf ms",
+					shard->index, response.revisedPublishingInterval);
+		}
+		UA_ModifySubscriptionResponse_clear(&response);
+	}
+}
+
+/**
+ * Delete monitored items from the subscription of a shard, in chunks no
+ * larger than the MaxMonitoredItemsPerCall operation limit of the server.
+ *
+ * @param shard	The shard holding the monitored items
+ * @param ids	The monitored item ids to delete
+ */
+void OPCUA::deleteMonitoredItems(Shard *shard, vector<UA_UInt32>& ids)
+{
+	UA_UInt32 chunkSize = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXMONITOREDITEMSPERCALL,
+			MAX_ITEMS_PER_CALL);
+	size_t failed = 0;
+	vector<UA_UInt32> deleted;
+
+	for (size_t base = 0; base < ids.size(); base += chunkSize)
+	{
+		size_t n = ids.size() - base;
+		if (n > chunkSize)
+			n = chunkSize;
+
+		UA_DeleteMonitoredItemsRequest request;
+		UA_DeleteMonitoredItemsRequest_init(&request);
+		request.subscriptionId = shard->subscriptionId;
+		request.monitoredItemIds = &ids[base];
+		request.monitoredItemIdsSize = n;
+
+		UA_DeleteMonitoredItemsResponse response = UA_Client_MonitoredItems_delete(
+				shard->session->client, request);
+		if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+		{
+			Logger::getLogger()->error("Failed to delete %d monitored items: %s", (int)n,
+					UA_StatusCode_name(response.responseHeader.serviceResult));
+			failed += n;
+		}
+		for (size_t i = 0; i < response.resultsSize && i < n; i++)
+		{
+			if (response.results[i] != UA_STATUSCODE_GOOD)
+				failed++;
+			else
+				deleted.push_back(ids[base + i]);
+		}
+		UA_DeleteMonitoredItemsResponse_clear(&response);
+	}
+	// Items that failed to delete may still deliver data changes, keep their contexts
+	if (!deleted.empty())
+		releaseContexts(shard, deleted);
+	shard->items -= ids.size() - failed;
+	Logger::getLogger()->info("Deleted %d monitored items from shard %d, %d failed",
+			(int)ids.size(), shard->index, (int)failed);
+}
+
+/**
+ * Read the DataType attribute of the variables found by the browse, using
+ * Read requests no larger than the MaxNodesPerRead operation limit of the server.
+ * Variables whose data type is already known are not read again.
+ *
+ * @param first	The index of the first node in m_nodes to read the data type of
+ */
+void OPCUA::readDataTypes(size_t first)
+{
+	UA_UInt32 chunkSize = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERREAD,
+			MAX_NODES_PER_READ);
+
+	// The data types of some variables may already be known
+	vector<size_t> nodes;
+	for (size_t i = first; i < m_nodes.size(); i++)
+	{
+		if (UA_NodeId_isNull(&m_nodes[i].dataType))
+			nodes.push_back(i);
+	}
+
+	for (size_t base = 0; base < nodes.size(); base += chunkSize)
+	{
+		size_t n = nodes.size() - base;
+		if (n > chunkSize)
+			n = chunkSize;
+
+		vector<UA_ReadValueId> ids(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			UA_ReadValueId_init(&ids[i]);
+			ids[i].nodeId = m_nodes[nodes[base + i]].nodeId;
+			ids[i].attributeId = UA_ATTRIBUTEID_DATATYPE;
+		}
+		UA_ReadRequest request;
+		UA_ReadRequest_init(&request);
+		request.nodesToRead = ids.data();
+		request.nodesToReadSize = n;
+		request.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+
+		UA_ReadResponse response = UA_Client_Service_read(m_client, request);
+		if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+		{
+			Logger::getLogger()->error("Failed to read the data type of %d variables: %s", (int)n,
+					UA_StatusCode_name(response.responseHeader.serviceResult));
+		}
+		for (size_t i = 0; i < response.resultsSize && i < n; i++)
+		{
+			UA_DataValue *value = &response.results[i];
+			if (value->hasValue && UA_Variant_hasScalarType(&value->value, &UA_TYPES[UA_TYPES_NODEID]))
+			{
+				UA_NodeId_clear(&m_nodes[nodes[base + i]].dataType);
+				UA_NodeId_copy((UA_NodeId *)value->value.data, &m_nodes[nodes[base + i]].dataType);
+			}
+		}
+		UA_ReadResponse_clear(&response);
+	}
+}
+
+/**
+ * Read the namespace array of the server. The namespace indexes in the node
+ * ids we hold are only valid for as long as the namespace array is unchanged.
+ */
+void OPCUA::readNamespaces()
+{
+	m_namespaces.clear();
+	UA_Variant value;
+	UA_Variant_init(&value);
+	UA_StatusCode rval = UA_Client_readValueAttribute(m_client,
+			UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_NAMESPACEARRAY), &value);
+	if (rval == UA_STATUSCODE_GOOD && value.type == &UA_TYPES[UA_TYPES_STRING])
+	{
+		UA_String *uris = (UA_String *)value.data;
+		for (size_t i = 0; i < value.arrayLength; i++)
+		{
+			m_namespaces.push_back(string((char *)uris[i].data, uris[i].length));
+		}
+	}
+	else
+	{
+		Logger::getLogger()->warn("Unable to read the namespace array of the server");
+	}
+	UA_Variant_clear(&value);
+}
+
+/**
+ * Release the variables found by a previous browse of the server
+ */
+void OPCUA::clearNodes()
+{
+	for (auto& node : m_nodes)
+	{
+		UA_NodeId_clear(&node.nodeId);
+		UA_NodeId_clear(&node.dataType);
+	}
+	m_nodes.clear();
+}
+
+/**
+ * Return the node ids of the roots of the subscriptions. Subscriptions
+ * given as node ids are parsed, those given as browse paths are resolved
+ * by the server.
+ *
+ * @return	The node ids to browse from
+ */
+vector<UA_NodeId> OPCUA::subscriptionRoots()
+{
+	vector<UA_NodeId> roots;
+	vector<string> paths;
+	for (auto& item : m_subscriptions)
+	{
+		// A browse name never contains the '=' of a node id, so node ids
+		// are accepted whether or not we subscribe by id
+		if (!m_subscribeById && item.find('=') == string::npos)
+		{
+			paths.push_back(item);
+			continue;
+		}
+		UA_NodeId id;
+		UA_String str = UA_STRING((char *)item.c_str());
+		if (UA_NodeId_parse(&id, str) == UA_STATUSCODE_GOOD)
+		{
+			Logger::getLogger()->debug("Adding subscriptions for node '%s'", item.c_str());
+			roots.push_back(id);
+		}
+		else
+		{
+			Logger::getLogger()->error("Invalid node id %s in the subscriptions", item.c_str());
+		}
+	}
+	if (!paths.empty())
+	{
+		resolveBrowsePaths(paths, roots);
+	}
+	if (m_subscriptions.empty())
+	{
+		// No subscriptions given, subscribe to everything below the objects folder
+		roots.push_back(UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER));
+	}
+	return roots;
+}
+
+/**
+ * Browse the server again after monitored items have been created from the
+ * node cache, bringing the monitored items and the cache up to date with any
+ * changes made in the server since the cache was written. If the browse is
+ * cut short, by a lost connection or a failed request, the variables it did
+ * not reach would look as if they had been removed from the server, so the
+ * monitored items and the cache are left as they are. Cached variables whose
+ * monitored item could not be created are created again.
+ *
+ * @return	False if the browse was cut short and nothing was changed
+ */
+bool OPCUA::reconcile()
+{
+	auto start = chrono::steady_clock::now();
+	vector<MonitoredNode> cached = m_nodes;
+	m_nodes.clear();
+	vector<UA_NodeId> roots = subscriptionRoots();
+	bool complete = browse(roots);
+	for (auto& root : roots)
+		UA_NodeId_clear(&root);
+	if (!complete)
+	{
+		clearNodes();
+		m_nodes.swap(cached);
+		Logger::getLogger()->warn("The node cache was not reconciled as the browse of the server was incomplete");
+		return false;
+	}
+
+	unordered_map<UA_NodeId, size_t, NodeIdHash, NodeIdEqual> cachedIndex;
+	for (size_t i = 0; i < cached.size(); i++)
+	{
+		cachedIndex[cached[i].nodeId] = i;
+	}
+
+	vector<MonitoredNode> added;
+	size_t n_retried = 0;
+	vector<bool> found(cached.size(), false);
+	vector<MonitoredNode> browsed = m_nodes;
+	m_nodes.clear();
+	for (auto& node : browsed)
+	{
+		auto it = cachedIndex.find(node.nodeId);
+		if (it != cachedIndex.end() && !found[it->second] && !m_polled
+				&& cached[it->second].monitoredItemId == 0)
+		{
+			// The item could not be created from the cache, create it again
+			found[it->second] = true;
+			added.push_back(node);
+			n_retried++;
+		}
+		else if (it != cachedIndex.end() && !found[it->second])
+		{
+			// Already monitored, keep the existing item
+			found[it->second] = true;
+			node.monitoredItemId = cached[it->second].monitoredItemId;
+			node.shard = cached[it->second].shard;
+			UA_NodeId_clear(&node.dataType);
+			UA_NodeId_copy(&cached[it->second].dataType, &node.dataType);
+			m_nodes.push_back(node);
+		}
+		else
+		{
+			added.push_back(node);
+		}
+	}
+
+	vector<vector<UA_UInt32> > removed(m_shards.size());
+	size_t n_removed = 0;
+	for (size_t i = 0; i < cached.size(); i++)
+	{
+		if (!found[i])
+		{
+			if (cached[i].monitoredItemId)
+				removed[cached[i].shard].push_back(cached[i].monitoredItemId);
+			n_removed++;
+		}
+		UA_NodeId_clear(&cached[i].nodeId);
+		UA_NodeId_clear(&cached[i].dataType);
+	}
+
+	size_t first = m_nodes.size();
+	m_nodes.insert(m_nodes.end(), added.begin(), added.end());
+	if (!added.empty())
+	{
+		readDataTypes(first);
+		if (!m_polled)
+			createMonitoredItems(first);
+	}
+	if (m_polled)
+	{
+		// The polled variables are indexes into m_nodes, which has been rebuilt
+		buildPollLists();
+	}
+	for (size_t i = 0; i < m_shards.size(); i++)
+	{
+		if (!removed[i].empty())
+			deleteMonitoredItems(m_shards[i], removed[i]);
+	}
+	if (m_cacheNodes && (added.size() > n_retried || n_removed > 0))
+	{
+		saveCache();
+	}
+	Logger::getLogger()->info("Node cache reconciled in %ld ms, %d variables added, %d removed, %d monitored items created again",
+			(long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count(),
+			(int)(added.size() - n_retried), (int)n_removed, (int)n_retried);
+	return true;
+}
+
+
+/**
+ * Starts the plugin
+ *
+ * We register with the OPC UA server, retrieve all the objects under the parent
+ * to which we are subscribing and start the process to enable OPC UA to send us
+ * change notifications for those items. If the server can not be reached we
+ * carry on trying to connect in the background.
+ */
+void
+OPCUA::start()
+{
+	try {
+		openSessions();
+	} catch (runtime_error& e) {
+		Logger::getLogger()->error("Unable to connect to the OPC UA server %s, will retry", m_url.c_str());
+		m_connectStop = false;
+		m_connectThread = new thread(connectWrapper, this);
+		return;
+	}
+	startup();
+}
+
+/**
+ * Keep trying to connect to the OPC UA server, backing off exponentially
+ * between attempts, and complete the start of the plugin once connected
+ */
+void OPCUA::connectLoop()
+{
+	auto failed = chrono::steady_clock::now();
+	unsigned int delay = m_reconnectMinDelay;
+	int attempts = 1;
+	while (backoff(delay, m_connectStop))
+	{
+		attempts++;
+		try {
+			openSessions();
+		} catch (runtime_error& e) {
+			delay = delay * 2 > m_reconnectMaxDelay ? m_reconnectMaxDelay : delay * 2;
+			continue;
+		}
+		Logger::getLogger()->info("Connected to the OPC UA server after %d attempts in %ld ms", attempts,
+				(long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - failed).count());
+		startup();
+		return;
+	}
+}
+
+/**
+ * Wait before the next attempt to connect to the server
+ *
+ * @param delay	The time to wait in milliseconds
+ * @param stop	Flag that is set if we should give up waiting
+ * @return	False if we were asked to stop
+ */
+bool OPCUA::backoff(unsigned int delay, const atomic<bool>& stop)
+{
+	auto until = chrono::steady_clock::now() + chrono::milliseconds(delay);
+	while (!stop && chrono::steady_clock::now() < until)
+	{
+		this_thread::sleep_for(chrono::milliseconds(delay < 100 ? delay : 100));
+	}
+	return !stop;
+}
+
+/**
+ * Complete the start of the plugin once the sessions with the server are open.
+ * When subscribing, the server is browsed and the monitored items created
+ * by the startup pipeline, so data flows for the first variables found while
+ * the rest of the server is still being browsed.
+ */
+void OPCUA::startup()
+{
+	// Now resolve the variables to monitor, either from the node cache
+	// or by browsing the server from the subscription roots
+	auto browseStart = chrono::steady_clock::now();
+	clearNodes();
+	readNamespaces();
+	if (m_backfill)
+	{
+		m_historyChunk = operationLimit(
+				UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERHISTORYREADDATA,
+				MAX_NODES_PER_HISTORY_READ);
+	}
+	bool cached = m_cacheNodes && loadCache();
+	bool complete = true;
+	long firstItems = -1;
+	chrono::steady_clock::time_point browseEnd;
+	vector<UA_NodeId> roots;
+	if (!cached)
+		roots = subscriptionRoots();
+	if (m_polled)
+	{
+		if (!cached)
+		{
+			complete = browse(roots);
+			readDataTypes(0);
+		}
+		browseEnd = chrono::steady_clock::now();
+		buildPollLists();
+	}
+	else
+	{
+		// Data may arrive before every item has been created
+		startDispatcher();
+		StartupPipeline pipeline;
+		startPipeline(pipeline, roots, true, 0);
+		complete = runPipeline(pipeline);
+		finishPipeline(pipeline);
+		browseEnd = pipeline.browseEnd;
+		if (pipeline.monitoring)
+			firstItems = chrono::duration_cast<chrono::milliseconds>(pipeline.firstItems - browseStart).count();
+	}
+	for (auto& root : roots)
+		UA_NodeId_clear(&root);
+	auto monitorEnd = chrono::steady_clock::now();
+	m_metrics.browseTime = chrono::duration_cast<chrono::milliseconds>(browseEnd - browseStart).count();
+	m_metrics.monitorTime = chrono::duration_cast<chrono::milliseconds>(monitorEnd - browseEnd).count();
+	if (m_cacheNodes && !cached && complete)
+		saveCache();
+	// Check the cache against the server once the data is flowing, or
+	// complete a startup that was interrupted
+	m_reconcile = cached || !complete;
+	Logger::getLogger()->info("Startup found %d variables%s, browse took %ld ms, monitored item creation took a further %ld ms",
+			(int)m_nodes.size(), cached ? " in the node cache" : "",
+			(long)chrono::duration_cast<chrono::milliseconds>(browseEnd - browseStart).count(),
+			(long)chrono::duration_cast<chrono::milliseconds>(monitorEnd - browseEnd).count());
+	if (firstItems >= 0)
+		Logger::getLogger()->info("The first monitored items were created after %ld ms", firstItems);
+	memoryReport();
+
+	startThread();
+}
+
+/**
+ * Create a client and connect it to the OPC UA server
+ *
+ * @return	The connected client or NULL if the connection failed
+ */
+UA_Client *OPCUA::connectClient()
+{
+	UA_Client *client = UA_Client_new();
+	UA_ClientConfig *config = UA_Client_getConfig(client);
+	config->securityMode = m_secMode;
+	config->securityPolicyUri = UA_STRING_ALLOC((char *)m_secPolicy.c_str());
+	config->logger = m_UAlogger;
+	UA_ClientConfig_setDefault(config);
+	if (connect(client) != UA_STATUSCODE_GOOD)
+	{
+		UA_Client_delete(client);
+		return NULL;
+	}
+	return client;
+}
+
+/**
+ * Connect a client to the OPC UA server. If the client has previously had
+ * a session with the server the session is reactivated if the server still
+ * holds it.
+ *
+ * @param client	The client to connect
+ * @return		The status of the connection
+ */
+UA_StatusCode OPCUA::connect(UA_Client *client)
+{
+	UA_StatusCode rval;
+	if (m_authPolicy.compare("username") == 0)
+	{
+		// The password is never logged, this runs on every reconnect attempt
+		Logger::getLogger()->info("Connecting to %s with username %s and policy '%s'",
+				m_url.c_str(), m_username.c_str(), m_secPolicy.c_str());
+		rval = UA_Client_connectUsername(client, m_url.c_str(), m_username.c_str(), m_password.c_str());
+	}
+	else
+	{
+		rval = UA_Client_connect(client, m_url.c_str());
+	}
+	if (rval != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Unable to connect to server %s, %x", UA_StatusCode_name(rval), rval);
+	}
+	return rval;
+}
+
+/**
+ * Open the sessions with the OPC UA server and create the subscriptions
+ * within each session. Every subscription is a shard that holds a share of
+ * the monitored items, allowing us to stay within the limits the server
+ * places on the items per subscription and per session. Each session is
+ * serviced by its own thread. The first session is also used to browse
+ * and read from the server.
+ */
+void OPCUA::openSessions()
+{
+	for (unsigned int i = 0; i < m_sessionCount; i++)
+	{
+		UA_Client *client = connectClient();
+		if (!client)
+		{
+			closeSessions();
+			throw runtime_error("Failed to connect to OPCUA server");
+		}
+		Session *session = new Session();
+		session->opcua = this;
+		session->index = i;
+		session->client = client;
+		session->thread = NULL;
+		session->pendingCount = 0;
+		session->queue = m_ingestQueueSize ? new ReadingQueue(m_ingestQueueSize) : NULL;
+		session->coalesced.store(NULL);
+		session->dropped.store(0);
+		session->coalescedCount.store(0);
+		session->reconnects = 0;
+		session->lastRecovery = 0;
+		session->downtime = 0;
+		session->pollGeneration = 0;
+		session->pollNext = 0;
+		session->pollInFlight = 0;
+		session->polling = false;
+		session->pollCycles = 0;
+		session->pollOverruns = 0;
+		session->nextHeartbeat = chrono::steady_clock::now();
+		session->windowEnd = 0;
+		session->backfill.end = 0;
+		session->backfill.first = 0;
+		session->backfill.count = 0;
+		session->backfill.generation = 0;
+		session->backfill.inFlight = false;
+		m_sessions.push_back(session);
+		if (i == 0)
+		{
+			m_client = client;
+			m_connected = true;
+		}
+
+		for (unsigned int j = 0; j < m_subscriptionsPerSession; j++)
+		{
+			Shard *shard = new Shard();
+			shard->session = session;
+			shard->index = m_shards.size();
+			shard->subscriptionId = 0;
+			shard->items = 0;
+			shard->notifications = 0;
+			shard->reported = 0;
+			shard->suppressed = 0;
+			shard->reportedSuppressed = 0;
+			shard->heartbeats = 0;
+			shard->reportedHeartbeats = 0;
+			m_shards.push_back(shard);
+			if (!m_polled)
+				createSubscription(shard);
+		}
+	}
+	if (m_shards.size() > 1)
+	{
+		Logger::getLogger()->info("Monitored items are sharded across %d subscriptions in %d sessions",
+				(int)m_shards.size(), (int)m_sessions.size());
+	}
+}
+
+/**
+ * Create the subscription that holds the monitored items of a shard
+ *
+ * @param shard	The shard to create the subscription for
+ * @return	True if the subscription was created
+ */
+bool OPCUA::createSubscription(Shard *shard)
+{
+	UA_CreateSubscriptionRequest request = UA_CreateSubscriptionRequest_default();
+	request.requestedPublishingInterval = m_reportingInterval;
+	UA_CreateSubscriptionResponse response = UA_Client_Subscriptions_create(shard->session->client,
+			request, this, NULL, NULL);
+	if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Failed to create subscription for OPCUA server");
+		return false;
+	}
+	shard->subscriptionId = response.subscriptionId;
+	return true;
+}
+
+/**
+ * Disconnect the sessions with the OPC UA server and release the monitored
+ * item contexts, which can only be done once the clients are deleted
+ */
+void OPCUA::closeSessions()
+{
+	for (auto session : m_sessions)
+	{
+		UA_Client_disconnect(session->client);
+		UA_Client_delete(session->client);
+		session->client = NULL;
+	}
+	m_client = NULL;
+	m_connected = false;
+	clearPollLists();
+	clearContexts();
+	for (auto shard : m_shards)
+		delete shard;
+	m_shards.clear();
+	for (auto session : m_sessions)
+	{
+		delete session->queue;
+		delete session;
+	}
+	m_sessions.clear();
+}
+
+/**
+ * Log the number of monitored items and the number of data change
+ * notifications received for each shard
+ */
+void OPCUA::shardStatistics()
+{
+	for (auto shard : m_shards)
+	{
+		Logger::getLogger()->info("Shard %d, session %d subscription %u: %u monitored items, %lu notifications",
+				shard->index, shard->session->index, shard->subscriptionId,
+				shard->items, shard->notifications.load());
+		unsigned long notifications = shard->notifications.load();
+		unsigned long suppressed = shard->suppressed.load();
+		if (suppressed || shard->heartbeats.load())
+		{
+			Logger::getLogger()->info("Shard %d report by exception suppressed %lu of %lu values (%.1f%%), %lu heartbeats sent",
+					shard->index, suppressed, notifications,
+					notifications ? 100.0 * suppressed / notifications : 0.0,
+					shard->heartbeats.load());
+		}
+	}
+}
+
+/**
+ * Return the heap memory used by a string, beyond the string itself
+ *
+ * @param str	The string
+ * @return	The number of bytes allocated for the characters of the string
+ */
+static size_t stringBytes(const string& str)
+{
+	// Short strings are held within the string object
+	return str.capacity() > 15 ? str.capacity() + 1 : 0;
+}
+
+/**
+ * Log the memory used by the state held for the monitored items, in total
+ * and per item, along with the resident set size of the process. This is
+ * an estimate, it counts the memory requested rather than the overhead of
+ * the allocator, but it allows growth across reconfigurations to be seen.
+ */
+void OPCUA::memoryReport()
+{
+	size_t contexts, names = 0, nodes, batches = 0, items;
+	{
+		lock_guard<mutex> guard(m_contextMutex);
+		contexts = m_contextPool.bytes();
+		items = m_contextPool.inUse();
+		for (auto& name : m_names)
+			names += sizeof(string) + 2 * sizeof(void *) + stringBytes(name);
+		names += m_names.bucket_count() * sizeof(void *);
+	}
+	nodes = m_nodes.capacity() * sizeof(MonitoredNode);
+	for (auto& node : m_nodes)
+	{
+		nodes += stringBytes(node.datapoint) + stringBytes(node.asset);
+		if (node.nodeId.identifierType == UA_NODEIDTYPE_STRING
+				|| node.nodeId.identifierType == UA_NODEIDTYPE_BYTESTRING)
+			nodes += node.nodeId.identifier.string.length;
+	}
+	for (auto session : m_sessions)
+	{
+		batches += session->pending.size() * (sizeof(pair<const string, AssetBatch>) + 4 * sizeof(void *));
+		batches += session->pollIds.capacity() * sizeof(UA_NodeId)
+			+ session->pollNodes.capacity() * sizeof(size_t)
+			+ session->pollContexts.capacity() * sizeof(MonitoredItemContext *);
+		batches += session->aggregator.bytes();
+	}
+	size_t total = contexts + names + nodes + batches;
+
+	long rss = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp)
+	{
+		long size;
+		if (fscanf(fp, "%ld %ld", &size, &rss) != 2)
+			rss = 0;
+		fclose(fp);
+	}
+	Logger::getLogger()->info("Memory: %d monitored items use %lu bytes, %lu bytes per item (contexts %lu, variables %lu, names %lu, batches %lu), process RSS %ld kB",
+			(int)items, (unsigned long)total, (unsigned long)(items ? total / items : 0),
+			(unsigned long)contexts, (unsigned long)nodes, (unsigned long)names,
+			(unsigned long)batches, rss * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+/**
+ * Log the recovery statistics and the state of the ingest queue of each session
+ */
+void OPCUA::sessionStatistics()
+{
+	for (auto session : m_sessions)
+	{
+		if (session->reconnects)
+		{
+			Logger::getLogger()->info("Session %d recovered from %d connection failures, last recovery took %ld ms, %ld ms in total",
+					session->index, session->reconnects, session->lastRecovery, session->downtime);
+		}
+		if (m_polled)
+		{
+			Logger::getLogger()->info("Session %d polled %d variables in %lu cycles, %lu cycles missed by overrunning the poll interval",
+					session->index, (int)session->pollIds.size(), session->pollCycles,
+					session->pollOverruns);
+		}
+		if (!session->queue)
+			continue;
+		Logger::getLogger()->info("Session %d ingest queue: %d of %d readings queued, high water mark %d, %lu dropped, %lu coalesced",
+				session->index, (int)session->queue->depth(), (int)session->queue->capacity(),
+				(int)session->queue->highWater(), session->dropped.load(),
+				session->coalescedCount.load());
+	}
+}
+
+/**
+ * Report the performance of the plugin over the last statistics interval,
+ * to the log and/or as a reading of the statistics asset. This is called
+ * on the thread of the first session.
+ *
+ * @param session	The session whose thread is reporting
+ */
+void OPCUA::reportStatistics(Session *session)
+{
+	auto now = chrono::steady_clock::now();
+	double elapsed = chrono::duration_cast<chrono::milliseconds>(now - m_lastReport).count() / 1000.0;
+	m_lastReport = now;
+
+	unsigned long notifications = 0, suppressed = 0, heartbeats = 0;
+	long items = 0;
+	vector<unsigned long> shardNotifications;
+	for (auto shard : m_shards)
+	{
+		unsigned long total = shard->notifications.load(memory_order_relaxed);
+		shardNotifications.push_back(total - shard->reported);
+		notifications += total - shard->reported;
+		shard->reported = total;
+		items += shard->items;
+		total = shard->suppressed.load(memory_order_relaxed);
+		suppressed += total - shard->reportedSuppressed;
+		shard->reportedSuppressed = total;
+		total = shard->heartbeats.load(memory_order_relaxed);
+		heartbeats += total - shard->reportedHeartbeats;
+		shard->reportedHeartbeats = total;
+	}
+	unsigned long depth = 0, dropped = 0;
+	for (auto s : m_sessions)
+	{
+		if (s->queue)
+			depth += s->queue->depth();
+		dropped += s->dropped.load() + s->coalescedCount.load();
+	}
+	unsigned long readings = m_metrics.readings.exchange(0, memory_order_relaxed);
+	LatencyHistogram::Summary source = m_metrics.sourceLatency.collect();
+	LatencyHistogram::Summary ingest = m_metrics.ingestLatency.collect();
+
+	if (m_statisticsLog)
+	{
+		Logger::getLogger()->info("Statistics: %lu notifications (%.0f/sec), %lu readings ingested, %ld monitored items, %lu item failures, queue depth %lu, %lu readings discarded",
+				notifications, elapsed > 0 ? notifications / elapsed : 0.0, readings, items,
+				(unsigned long)m_metrics.itemFailures.load(), depth, dropped);
+		Logger::getLogger()->info("Statistics: source to receive latency p50 %.1f p90 %.1f p99 %.1f max %.1f ms, receive to ingest latency p50 %.1f p90 %.1f p99 %.1f max %.1f ms",
+				source.p50 / 1000.0, source.p90 / 1000.0, source.p99 / 1000.0, source.max / 1000.0,
+				ingest.p50 / 1000.0, ingest.p90 / 1000.0, ingest.p99 / 1000.0, ingest.max / 1000.0);
+		if (suppressed || heartbeats)
+		{
+			Logger::getLogger()->info("Statistics: report by exception suppressed %lu of %lu values (%.1f%%), %lu heartbeats sent",
+					suppressed, notifications,
+					notifications ? 100.0 * suppressed / notifications : 0.0, heartbeats);
+		}
+		if (m_shards.size() > 1)
+		{
+			for (size_t i = 0; i < m_shards.size(); i++)
+			{
+				Logger::getLogger()->info("Statistics: shard %d %lu notifications (%.0f/sec)", (int)i,
+						shardNotifications[i], elapsed > 0 ? shardNotifications[i] / elapsed : 0.0);
+			}
+		}
+	}
+	if (m_statisticsAsset)
+	{
+		vector<Datapoint *> points;
+		DatapointValue rate(elapsed > 0 ? notifications / elapsed : 0.0);
+		points.push_back(new Datapoint("notificationRate", rate));
+		DatapointValue received((long)notifications);
+		points.push_back(new Datapoint("notifications", received));
+		DatapointValue ingested((long)readings);
+		points.push_back(new Datapoint("readings", ingested));
+		DatapointValue suppressedValues((long)suppressed);
+		points.push_back(new Datapoint("suppressed", suppressedValues));
+		DatapointValue heartbeatValues((long)heartbeats);
+		points.push_back(new Datapoint("heartbeats", heartbeatValues));
+		DatapointValue monitored(items);
+		points.push_back(new Datapoint("monitoredItems", monitored));
+		DatapointValue failures((long)m_metrics.itemFailures.load());
+		points.push_back(new Datapoint("itemFailures", failures));
+		DatapointValue queueDepth((long)depth);
+		points.push_back(new Datapoint("queueDepth", queueDepth));
+		DatapointValue discarded((long)dropped);
+		points.push_back(new Datapoint("discarded", discarded));
+		DatapointValue browseTime((long)m_metrics.browseTime.load());
+		points.push_back(new Datapoint("browseTime", browseTime));
+		DatapointValue monitorTime((long)m_metrics.monitorTime.load());
+		points.push_back(new Datapoint("monitorTime", monitorTime));
+		DatapointValue sourceP50(source.p50 / 1000.0);
+		points.push_back(new Datapoint("sourceLatencyP50", sourceP50));
+		DatapointValue sourceP99(source.p99 / 1000.0);
+		points.push_back(new Datapoint("sourceLatencyP99", sourceP99));
+		DatapointValue sourceMax(source.max / 1000.0);
+		points.push_back(new Datapoint("sourceLatencyMax", sourceMax));
+		DatapointValue ingestP50(ingest.p50 / 1000.0);
+		points.push_back(new Datapoint("ingestLatencyP50", ingestP50));
+		DatapointValue ingestP99(ingest.p99 / 1000.0);
+		points.push_back(new Datapoint("ingestLatencyP99", ingestP99));
+		DatapointValue ingestMax(ingest.max / 1000.0);
+		points.push_back(new Datapoint("ingestLatencyMax", ingestMax));
+		for (size_t i = 0; m_shards.size() > 1 && i < m_shards.size(); i++)
+		{
+			char name[40];
+			snprintf(name, sizeof(name), "shard%dNotifications", (int)i);
+			DatapointValue shard((long)shardNotifications[i]);
+			points.push_back(new Datapoint(name, shard));
+		}
+		queueReading(session, NULL, new Reading(m_asset + "Statistics", points));
+	}
+}
+
+/**
+ * Set how the performance statistics of the plugin are reported
+ *
+ * @param interval	The interval in seconds between reports, 0 disables statistics
+ * @param output	Where to report the statistics, Log, Asset or Both
+ */
+void OPCUA::setStatistics(unsigned int interval, const string& output)
+{
+	m_statisticsInterval = interval;
+	m_statisticsLog = output.compare("Asset") != 0;
+	m_statisticsAsset = output.compare("Log") != 0;
+}
+
+/**
+ * Start the threads that service the sessions with the OPC UA server and
+ * the thread that ingests the readings they queue. If the monitored items
+ * must be reconciled with the server only the thread of the first session
+ * is started, it starts the others once the reconciliation is complete.
+ */
+void OPCUA::startThread()
+{
+	m_threadStop = false;
+	m_lastReport = chrono::steady_clock::now();
+	startDispatcher();
+	bool reconcile = m_reconcile;
+	for (auto session : m_sessions)
+	{
+		session->thread = new thread(threadWrapper, session);
+		if (reconcile)
+			break;
+	}
+}
+
+/**
+ * Start the thread that ingests the readings queued by the sessions, unless
+ * it is already running or the readings are ingested directly
+ */
+void OPCUA::startDispatcher()
+{
+	if (m_ingestQueueSize && !m_dispatcher)
+	{
+		m_dispatcherStop = false;
+		m_dispatcher = new thread(dispatcherWrapper, this);
+	}
+}
+
+/**
+ * Stop the threads that service the sessions and wait for them to exit.
+ * The first session is joined first as it may start the other threads.
+ * The ingest thread is stopped last, once it has ingested every reading
+ * the sessions have queued.
+ */
+void OPCUA::stopThread()
+{
+	if (m_connectThread)
+	{
+		m_connectStop = true;
+		m_connectThread->join();
+		delete m_connectThread;
+		m_connectThread = NULL;
+	}
+	m_threadStop = true;
+	{
+		lock_guard<mutex> guard(m_pauseMutex);
+		m_pauseCV.notify_all();
+	}
+	for (auto session : m_sessions)
+	{
+		if (session->thread)
+		{
+			session->thread->join();
+			delete session->thread;
+			session->thread = NULL;
+		}
+	}
+	if (m_dispatcher)
+	{
+		m_dispatcherStop = true;
+		{
+			lock_guard<mutex> guard(m_dispatcherMutex);
+			m_dispatcherCV.notify_one();
+		}
+		m_dispatcher->join();
+		delete m_dispatcher;
+		m_dispatcher = NULL;
+	}
+}
+
+/**
+ * The thread that ingests the readings queued by the sessions. Ingesting a
+ * reading may block, for example when the storage service applies back
+ * pressure, but the threads that service the sessions carry on handling
+ * publish responses and keep-alives while it does. The thread sleeps
+ * when every queue is empty and is woken by the next reading queued.
+ */
+void OPCUA::dispatcher()
+{
+	auto lastReport = chrono::steady_clock::now();
+	unsigned long reported = 0;
+	while (!m_dispatcherStop)
+	{
+		if (!dispatch())
+		{
+			unique_lock<mutex> lck(m_dispatcherMutex);
+			m_dispatcherIdle = true;
+			if (queuesEmpty() && !m_dispatcherStop)
+				m_dispatcherCV.wait_for(lck, chrono::milliseconds(100));
+			m_dispatcherIdle = false;
+		}
+
+		auto now = chrono::steady_clock::now();
+		if (now - lastReport >= chrono::minutes(1))
+		{
+			lastReport = now;
+			unsigned long lost = 0;
+			for (auto session : m_sessions)
+				lost += session->dropped.load() + session->coalescedCount.load();
+			if (lost != reported)
+			{
+				Logger::getLogger()->warn("The ingest queue has overflowed, %lu readings discarded in the last minute",
+						lost - reported);
+				reported = lost;
+			}
+		}
+	}
+	while (dispatch())
+		;
+}
+
+/**
+ * Ingest the readings queued by the sessions. At most a queue full of
+ * readings is taken from each session in turn, so that a busy session
+ * can not starve the others.
+ *
+ * @return	True if any readings were ingested
+ */
+bool OPCUA::dispatch()
+{
+	bool ingested = false;
+	for (auto session : m_sessions)
+	{
+		ReadingQueue *queue = session->queue;
+		if (!queue)
+			continue;
+		Reading *reading;
+		for (size_t n = queue->capacity(); n > 0 && (reading = queue->pop()) != NULL; n--)
+		{
+			ingestReading(reading);
+			ingested = true;
+		}
+		AssetBatch *batch = session->coalesced.exchange(NULL, memory_order_acquire);
+		while (batch)
+		{
+			// Once the latest reading is taken the session may pass the
+			// batch back to us, so the link must be read first
+			AssetBatch *next = batch->next;
+			reading = batch->latest.exchange(NULL, memory_order_acq_rel);
+			if (reading)
+			{
+				ingestReading(reading);
+				ingested = true;
+			}
+			batch = next;
+		}
+	}
+	return ingested;
+}
+
+/**
+ * Pass a reading to the south service, recording the time it took to get
+ * from the creation of the reading to ingest if statistics are enabled
+ *
+ * @param reading	The reading to ingest, which is deleted once ingested
+ */
+void OPCUA::ingestReading(Reading *reading)
+{
+	if (m_statisticsInterval)
+	{
+		struct timeval created, now;
+		reading->getTimestamp(&created);
+		gettimeofday(&now, NULL);
+		long latency = (now.tv_sec - created.tv_sec) * 1000000L + (now.tv_usec - created.tv_usec);
+		m_metrics.ingestLatency.record(latency > 0 ? latency : 0);
+		m_metrics.readings.fetch_add(1, memory_order_relaxed);
+	}
+	m_ingest(m_data, *reading);
+	delete reading;
+}
+
+/**
+ * Check if all the ingest queues are empty
+ *
+ * @return	True if there are no readings waiting to be ingested
+ */
+bool OPCUA::queuesEmpty()
+{
+	for (auto session : m_sessions)
+	{
+		if (session->queue && (session->queue->depth() > 0
+				|| session->coalesced.load(memory_order_acquire)))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Pass a reading to the ingest thread using the ingest queue of the session,
+ * applying the overflow policy if the queue is full. If there is no ingest
+ * queue the reading is ingested on the calling thread.
+ *
+ * @param session	The session that received the data change
+ * @param batch		The batch of the asset the reading is for, or NULL
+ * @param reading	The reading, ownership passes to the queue
+ */
+void OPCUA::queueReading(Session *session, AssetBatch *batch, Reading *reading)
+{
+	ReadingQueue *queue = session->queue;
+	if (!queue)
+	{
+		ingestReading(reading);
+		return;
+	}
+
+	if (m_overflowPolicy == OverflowCoalesce && batch && batch->latest.load(memory_order_acquire))
+	{
+		// The asset already has a coalesced reading waiting, replace it
+		// rather than queue this one so the readings stay in order
+		coalesce(session, batch, reading);
+	}
+	else if (!queue->push(reading))
+	{
+		switch (m_overflowPolicy)
+		{
+			case OverflowBlock:
+				while (!queue->push(reading))
+				{
+					this_thread::sleep_for(chrono::milliseconds(1));
+				}
+				break;
+			case OverflowCoalesce:
+				if (batch)
+				{
+					coalesce(session, batch, reading);
+					break;
+				}
+				// Readings that are not for an asset we batch can not be
+				// coalesced, make room for them instead
+			case OverflowDropOldest:
+			{
+				Reading *oldest = queue->dropOldest();
+				if (oldest)
+				{
+					delete oldest;
+					session->dropped.fetch_add(1, memory_order_relaxed);
+				}
+				// The queue can only have emptied further, so there is room
+				queue->push(reading);
+				break;
+			}
+		}
+	}
+
+	if (m_dispatcherIdle.load())
+	{
+		lock_guard<mutex> guard(m_dispatcherMutex);
+		m_dispatcherCV.notify_one();
+	}
+}
+
+/**
+ * Hold a reading as the latest reading of an asset, replacing any earlier
+ * reading of the asset that the ingest thread has not yet collected. The
+ * first time a reading is held the batch is added to the list of batches
+ * the ingest thread collects from.
+ *
+ * @param session	The session that received the data change
+ * @param batch		The batch of the asset the reading is for
+ * @param reading	The reading to hold
+ */
+void OPCUA::coalesce(Session *session, AssetBatch *batch, Reading *reading)
+{
+	Reading *previous = batch->latest.exchange(reading, memory_order_acq_rel);
+	if (previous)
+	{
+		delete previous;
+		session->coalescedCount.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+	AssetBatch *head = session->coalesced.load(memory_order_relaxed);
+	do {
+		batch->next = head;
+	} while (!session->coalesced.compare_exchange_weak(head, batch,
+				memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * The thread that services a session with the OPC UA server. Each call to
+ * run_iterate will process any publish responses that have arrived for the
+ * subscriptions of the session, calling dataChanged for every notification
+ * they contain. When batching is enabled the readings built from those
+ * notifications are flushed once the publish cycle completes, or once the
+ * flush latency has expired. When polling, the thread sends the read
+ * requests of each poll cycle and the responses are processed in the same way.
+ *
+ * @param session	The session to service
+ */
+void OPCUA::threadStart(Session *session)
+{
+	UA_UInt32 timeout = 1000;
+	if ((m_batching || grouped()) && m_flushLatency > 0 && m_flushLatency < timeout)
+		timeout = m_flushLatency;
+	if (session->index == 0)
+	{
+		m_reconcileDelay = 0;
+		if (m_reconcile)
+		{
+			// The other sessions are not serviced while we reconcile, so
+			// their clients may be used from this thread
+			m_reconcile = false;
+			if (!reconcile())
+			{
+				// Retry once the other sessions are running, so that
+				// their data is not held up by the retries
+				m_reconcileDelay = m_reconnectMinDelay;
+				m_nextReconcile = chrono::steady_clock::now() + chrono::milliseconds(m_reconcileDelay);
+				Logger::getLogger()->warn("Retrying the reconciliation of the node cache in %u ms", m_reconcileDelay);
+			}
+		}
+		shardStatistics();
+		memoryReport();
+		for (size_t i = 1; i < m_sessions.size(); i++)
+			m_sessions[i]->thread = new thread(threadWrapper, m_sessions[i]);
+	}
+	session->nextPoll = chrono::steady_clock::now();
+	session->windowEnd = 0;
+	while (! m_threadStop)
+	{
+		if (m_pausing.load(memory_order_acquire) && session->index != 0)
+		{
+			pauseSession();
+			continue;
+		}
+		if (session->index == 0 && m_reconcileDelay && chrono::steady_clock::now() >= m_nextReconcile)
+		{
+			retryReconcile();
+		}
+		UA_UInt32 wait = m_polled ? poll(session, timeout) : timeout;
+		if (m_aggregateWindow)
+			wait = aggregate(session, wait);
+		if (session->backfill.end)
+			wait = backfill(session, wait);
+		UA_StatusCode rval = UA_Client_run_iterate(session->client, wait);
+		if (rval != UA_STATUSCODE_GOOD)
+		{
+			Logger::getLogger()->warn("Session %d has lost the connection to the server: %s",
+					session->index, UA_StatusCode_name(rval));
+			recoverSession(session);
+			continue;
+		}
+		if (m_statisticsInterval && session->index == 0
+				&& chrono::steady_clock::now() - m_lastReport >= chrono::seconds(m_statisticsInterval))
+		{
+			reportStatistics(session);
+		}
+		heartbeat(session);
+		flushDue(session);
+	}
+	if (m_aggregateWindow && session->windowEnd)
+	{
+		// Send the statistics of the part of the window that has passed
+		emitAggregates(session, session->windowEnd - m_aggregateWindow);
+	}
+	flushPending(session);
+	clearBackfill(session);
+}
+
+/**
+ * Retry the reconciliation of the node cache from the thread of the first
+ * session. The other sessions are paused while the monitored items and the
+ * node list are brought up to date, as their clients are used from this
+ * thread. The delay between attempts doubles until it passes the maximum
+ * reconnect delay, after which the monitored items we have are kept and the
+ * reconciliation is tried again the next time the threads are started.
+ */
+void OPCUA::retryReconcile()
+{
+	if (!pauseSessions())
+	{
+		// A session is busy recovering, try again after the same delay
+		m_nextReconcile = chrono::steady_clock::now() + chrono::milliseconds(m_reconcileDelay);
+		return;
+	}
+	bool reconciled = reconcile();
+	if (reconciled)
+		shardStatistics();
+	resumeSessions();
+	if (reconciled)
+	{
+		m_reconcileDelay = 0;
+		return;
+	}
+	m_reconcileDelay *= 2;
+	if (m_reconcileDelay > m_reconnectMaxDelay)
+	{
+		Logger::getLogger()->error("Unable to reconcile the node cache with the server, it will be retried on the next restart");
+		m_reconcile = true;
+		m_reconcileDelay = 0;
+		return;
+	}
+	Logger::getLogger()->warn("Retrying the reconciliation of the node cache in %u ms", m_reconcileDelay);
+	m_nextReconcile = chrono::steady_clock::now() + chrono::milliseconds(m_reconcileDelay);
+}
+
+/**
+ * Ask the threads of the sessions other than the first to pause, and wait
+ * for them to do so. A thread pauses at the start of its next iteration, a
+ * session that is recovering its connection may not pause in time.
+ *
+ * @return	True if every other session has paused
+ */
+bool OPCUA::pauseSessions()
+{
+	unique_lock<mutex> lck(m_pauseMutex);
+	m_pausing = true;
+	bool paused = m_pauseCV.wait_for(lck, chrono::milliseconds(SESSION_PAUSE_TIMEOUT),
+			[this] { return m_paused == m_sessions.size() - 1 || m_threadStop; });
+	if (!paused || m_threadStop)
+	{
+		m_pausing = false;
+		m_pauseCV.notify_all();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Let the sessions paused by pauseSessions carry on
+ */
+void OPCUA::resumeSessions()
+{
+	lock_guard<mutex> guard(m_pauseMutex);
+	m_pausing = false;
+	m_pauseCV.notify_all();
+}
+
+/**
+ * Hold the thread of a session until the sessions are resumed
+ */
+void OPCUA::pauseSession()
+{
+	unique_lock<mutex> lck(m_pauseMutex);
+	m_paused++;
+	m_pauseCV.notify_all();
+	m_pauseCV.wait(lck, [this] { return !m_pausing || m_threadStop; });
+	m_paused--;
+}
+
+/**
+ * Send the batches of a session if the flush latency has expired, or at
+ * the end of every publish cycle if there is no flush latency
+ *
+ * @param session	The session whose batches are sent
+ */
+void OPCUA::flushDue(Session *session)
+{
+	if ((m_batching || grouped()) && session->pendingCount > 0)
+	{
+		if (m_flushLatency == 0)
+		{
+			flushPending(session);
+		}
+		else
+		{
+			auto age = chrono::duration_cast<chrono::milliseconds>(
+					chrono::steady_clock::now() - session->pendingSince);
+			if (age.count() >= m_flushLatency)
+				flushPending(session);
+		}
+	}
+}
+
+/**
+ * Reconnect a session that has lost its connection with the server, backing
+ * off exponentially between attempts, and then restore its subscriptions.
+ * When backfill is enabled the values missed while disconnected are then
+ * read from the history of the server. This runs on the thread of the
+ * session, which is the only thread to use the client of the session.
+ *
+ * @param session	The session to recover
+ */
+void OPCUA::recoverSession(Session *session)
+{
+	auto failed = chrono::steady_clock::now();
+	if (m_backfill)
+		collectGap(session);
+	unsigned int delay = m_reconnectMinDelay;
+	int attempts = 1;
+	while (connect(session->client) != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->warn("Reconnect attempt %d of session %d failed, retrying in %u ms",
+				attempts, session->index, delay);
+		if (!backoff(delay, m_threadStop))
+			return;
+		delay = delay * 2 > m_reconnectMaxDelay ? m_reconnectMaxDelay : delay * 2;
+		attempts++;
+	}
+
+	// The values from now on are received live, the first value of an
+	// item created again may come from earlier in the gap
+	UA_DateTime end = UA_DateTime_now();
+	long recovery;
+	if (m_polled)
+	{
+		// Registered nodes do not survive the session
+		registerPollNodes(session);
+		recovery = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - failed).count();
+		Logger::getLogger()->info("Session %d recovered in %ld ms after %d attempts",
+				session->index, recovery, attempts);
+	}
+	else
+	{
+		int reactivated = 0, transferred = 0, recreated = 0;
+		restoreSubscriptions(session, reactivated, transferred, recreated);
+		recovery = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - failed).count();
+		Logger::getLogger()->info("Session %d recovered in %ld ms after %d attempts, %d subscriptions reactivated, %d transferred and %d recreated",
+				session->index, recovery, attempts, reactivated, transferred, recreated);
+	}
+	session->reconnects++;
+	session->lastRecovery = recovery;
+	session->downtime += recovery;
+	if (m_backfill)
+		startBackfill(session, end);
+}
+
+/**
+ * Restore the subscriptions of a session once it has reconnected. If the
+ * server reactivated the session the subscriptions are intact. Otherwise
+ * the server may still hold the subscriptions, in which case they are
+ * transferred to the new session. Any that remain are created again, along
+ * with their monitored items, from the variables we already hold, so that
+ * there is no need to browse the server again.
+ *
+ * @param session	The session that has reconnected
+ * @param reactivated	The number of subscriptions that survived in the session
+ * @param transferred	The number of subscriptions transferred to the session
+ * @param recreated	The number of subscriptions created again
+ */
+void OPCUA::restoreSubscriptions(Session *session, int& reactivated, int& transferred, int& recreated)
+{
+	vector<Shard *> shards;
+	vector<UA_UInt32> ids;
+	for (auto shard : m_shards)
+	{
+		if (shard->session == session)
+		{
+			shards.push_back(shard);
+			ids.push_back(shard->subscriptionId);
+		}
+	}
+
+	// Enabling publishing fails for any subscription the session no longer has
+	vector<Shard *> lost;
+	UA_SetPublishingModeRequest modeRequest;
+	UA_SetPublishingModeRequest_init(&modeRequest);
+	modeRequest.publishingEnabled = true;
+	modeRequest.subscriptionIds = ids.data();
+	modeRequest.subscriptionIdsSize = ids.size();
+	UA_SetPublishingModeResponse modeResponse = UA_Client_Subscriptions_setPublishingMode(
+			session->client, modeRequest);
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		if (modeResponse.responseHeader.serviceResult == UA_STATUSCODE_GOOD
+				&& i < modeResponse.resultsSize
+				&& modeResponse.results[i] == UA_STATUSCODE_GOOD)
+			reactivated++;
+		else
+			lost.push_back(shards[i]);
+	}
+	UA_SetPublishingModeResponse_clear(&modeResponse);
+	if (lost.empty())
+		return;
+
+	ids.clear();
+	for (auto shard : lost)
+		ids.push_back(shard->subscriptionId);
+	UA_TransferSubscriptionsRequest transferRequest;
+	UA_TransferSubscriptionsRequest_init(&transferRequest);
+	transferRequest.subscriptionIds = ids.data();
+	transferRequest.subscriptionIdsSize = ids.size();
+	transferRequest.sendInitialValues = true;
+	UA_TransferSubscriptionsResponse transferResponse;
+	UA_TransferSubscriptionsResponse_init(&transferResponse);
+	__UA_Client_Service(session->client, &transferRequest,
+			&UA_TYPES[UA_TYPES_TRANSFERSUBSCRIPTIONSREQUEST], &transferResponse,
+			&UA_TYPES[UA_TYPES_TRANSFERSUBSCRIPTIONSRESPONSE]);
+	vector<Shard *> recreate;
+	for (size_t i = 0; i < lost.size(); i++)
+	{
+		if (transferResponse.responseHeader.serviceResult == UA_STATUSCODE_GOOD
+				&& i < transferResponse.resultsSize
+				&& transferResponse.results[i].statusCode == UA_STATUSCODE_GOOD)
+			transferred++;
+		else
+			recreate.push_back(lost[i]);
+	}
+	UA_TransferSubscriptionsResponse_clear(&transferResponse);
+
+	for (auto shard : recreate)
+	{
+		// Remove what the client holds of the old subscription before
+		// creating the new one
+		UA_Client_Subscriptions_deleteSingle(session->client, shard->subscriptionId);
+		releaseContexts(shard, vector<UA_UInt32>());
+		if (!createSubscription(shard))
+			continue;
+		vector<size_t> nodes;
+		for (size_t i = 0; i < m_nodes.size(); i++)
+		{
+			if (m_nodes[i].shard == shard->index)
+			{
+				m_nodes[i].monitoredItemId = 0;
+				nodes.push_back(i);
+			}
+		}
+		shard->items = 0;
+		createMonitoredItems(shard, nodes, m_maxItemsPerCall);
+		recreated++;
+	}
+}
+
+/**
+ * Stop all subscriptions and disconnect from the OPCUA server
+ */
+void
+OPCUA::stop()
+{
+	stopThread();
+	shardStatistics();
+	memoryReport();
+	sessionStatistics();
+	closeSessions();
+}
+
+/**
+ * Apply a new configuration to the plugin. The session with the server is
+ * only recreated if the URL or security settings have changed. Otherwise the
+ * new configuration is applied in place and, if the subscriptions have
+ * changed, the server is browsed again from the new roots and only the
+ * monitored items that differ are created or deleted.
+ *
+ * @param config	The new configuration category
+ */
+void
+OPCUA::reconfigure(ConfigCategory *config)
+{
+	string url = m_url;
+	UA_MessageSecurityMode secMode = m_secMode;
+	string secPolicy = m_secPolicy;
+	string authPolicy = m_authPolicy;
+	string username = m_username;
+	string password = m_password;
+	string certs = m_certAuth + m_serverPublic + m_clientPublic + m_clientPrivate + m_caCrl;
+	vector<string> subscriptions = m_subscriptions;
+	bool byId = m_subscribeById;
+	long reportingInterval = m_reportingInterval;
+	string monitoring = m_monitoringConfig;
+	string filter = m_filterConfig;
+	unsigned int sessions = m_sessionCount;
+	unsigned int subscriptionsPerSession = m_subscriptionsPerSession;
+	unsigned int ingestQueueSize = m_ingestQueueSize;
+	string tracePattern = m_tracePattern;
+	string exceptions = m_exceptionConfig;
+	unsigned int aggregateWindow = m_aggregateWindow;
+	string aggregatePattern = m_aggregatePattern;
+	bool backfill = m_backfill;
+	bool polled = m_polled;
+	string asset = m_asset;
+	bool batching = m_batching;
+	AssetMapping assetMapping = m_assetMapping;
+	unsigned int assetPathDepth = m_assetPathDepth;
+
+	if (config->itemExists("url"))
+	{
+		newURL(config->getValue("url"));
+	}
+	stopThread();
+	setConfiguration(config);
+
+	if (!m_connected || url.compare(m_url) || secMode != m_secMode
+			|| secPolicy.compare(m_secPolicy) || authPolicy.compare(m_authPolicy)
+			|| username.compare(m_username) || password.compare(m_password)
+			|| certs.compare(m_certAuth + m_serverPublic + m_clientPublic + m_clientPrivate + m_caCrl)
+			|| sessions != m_sessionCount || subscriptionsPerSession != m_subscriptionsPerSession
+			|| polled != m_polled || assetMapping != m_assetMapping || backfill != m_backfill
+			|| (m_assetMapping == MapPathDepth && assetPathDepth != m_assetPathDepth))
+	{
+		Logger::getLogger()->info("Connection settings changed, reconnecting to the OPC UA server");
+		if (url.compare(m_url))
+			clearResolved();
+		stop();
+		start();
+		return;
+	}
+
+	if ((asset.compare(m_asset) && (grouped() || m_batching)) || batching != m_batching)
+	{
+		rebuildBatches(asset);
+	}
+	if (tracePattern.compare(m_tracePattern))
+	{
+		m_contextPool.forEach([this](MonitoredItemContext *context) { updateTrace(context); });
+	}
+	if (exceptions.compare(m_exceptionConfig))
+	{
+		m_contextPool.forEach([this](MonitoredItemContext *context) { updateException(context); });
+	}
+	if (aggregateWindow != m_aggregateWindow || aggregatePattern.compare(m_aggregatePattern))
+	{
+		m_contextPool.forEach([this](MonitoredItemContext *context) { updateAggregate(context); });
+	}
+	if (ingestQueueSize != m_ingestQueueSize)
+	{
+		// The ingest thread has emptied the queues before it stopped
+		for (auto session : m_sessions)
+		{
+			delete session->queue;
+			session->queue = m_ingestQueueSize ? new ReadingQueue(m_ingestQueueSize) : NULL;
+		}
+	}
+	if (reportingInterval != m_reportingInterval && !m_polled)
+	{
+		modifySubscription();
+	}
+	if (monitoring.compare(m_monitoringConfig) && !m_polled)
+	{
+		modifyMonitoredItems();
+	}
+	if (subscriptions != m_subscriptions || byId != m_subscribeById
+			|| filter.compare(m_filterConfig))
+	{
+		// Browse the new roots and update the monitored items from the client thread
+		m_reconcile = true;
+	}
+	startThread();
+}
+
+/**
+ * Called when a data changed event is received. This calls back to the south service
+ * and adds the points to the readings queue to send.
+ *
+ * @param points	The points in the reading we must create
+ */
+void OPCUA::ingest(vector<Datapoint *>	points)
+{
+string asset = m_asset + points[0]->getName();
+
+	(*m_ingest)(m_data, Reading(asset, points));
+}
+
+
+/**
+ * Set the message security mode
+ *
+ * @param value    Security mode string
+ */
+void
+OPCUA::setSecMode(const std::string& secMode)
+{ 
+	if (secMode.compare("Any") == 0)
+		m_secMode = UA_MESSAGESECURITYMODE_INVALID;
+	else if (secMode.compare("None") == 0)
+		m_secMode = UA_MESSAGESECURITYMODE_NONE;
+	else if (secMode.compare("Sign") == 0)
+		m_secMode = UA_MESSAGESECURITYMODE_SIGN;
+	else if (secMode.compare("SignAndEncrypt") == 0)
+		m_secMode = UA_MESSAGESECURITYMODE_SIGNANDENCRYPT;
+	else 
+	{
+		m_secMode = UA_MESSAGESECURITYMODE_INVALID;
+		Logger::getLogger()->error("Invalid Security mode '%s'", secMode.c_str());
+	}
+}
+
+/**
+ * Set the security policy
+ *
+ * @param value    Security policy string
+ */
+void
+OPCUA::setSecPolicy(const std::string& secPolicy)
+{
+	if (!secPolicy.compare("Any"))
+		m_secPolicy = "";
+	else if (!secPolicy.compare("Basic256"))
+		m_secPolicy = "http://opcfoundation.org/UA/SecurityPolicy#Basic256";
+	else if (!secPolicy.compare("Basic256Sha256"))
+		m_secPolicy = "http://opcfoundation.org/UA/SecurityPolicy#Basic256Sha25";
+	else
+	{
+		m_secPolicy = "";
+		Logger::getLogger()->error("Invalid Security policy '%s'", secPolicy.c_str());
+	}
+}
+
+/**
+ * Match the level of the messages we pass on from open62541 to the minimum
+ * level of the Fledge logger. Trace messages are never passed on, they
+ * are only useful when debugging open62541 itself.
  */
 void
-OPCUA::clearSubscription()
+OPCUA::updateLogLevel()
 {
-	lock_guard<mutex> guard(m_configMutex);
-	m_subscriptions.clear();
+	string level = Logger::getLogger()->getMinLevel();
+	if (level.compare("debug") == 0)
+		m_logLevel = UA_LOGLEVEL_DEBUG;
+	else if (level.compare("info") == 0)
+		m_logLevel = UA_LOGLEVEL_INFO;
+	else if (level.compare("warning") == 0)
+		m_logLevel = UA_LOGLEVEL_WARNING;
+	else if (level.compare("error") == 0)
+		m_logLevel = UA_LOGLEVEL_ERROR;
+	else
+		m_logLevel = UA_LOGLEVEL_WARNING;
 }
 
 /**
- * Add a subscription parent node to the list
+ * Set the monitored items whose values are traced to the log
+ *
+ * @param pattern	A pattern matched against the datapoint name of each
+ *			variable, empty to trace nothing
+ * @param interval	The minimum time in milliseconds between traces of one variable
  */
 void
-OPCUA::addSubscription(const string& parent)
+OPCUA::setTrace(const string& pattern, unsigned int interval)
 {
-	lock_guard<mutex> guard(m_configMutex);
-	m_subscriptions.push_back(parent);
+	m_tracePattern = pattern;
+	m_traceInterval = interval;
 }
 
 /**
- * Restart the OPCUA connection
+ * Start or stop the tracing of a monitored item, depending on whether its
+ * datapoint name matches the trace pattern
+ *
+ * @param context	The context of the monitored item
  */
 void
-OPCUA::restart()
+OPCUA::updateTrace(MonitoredItemContext *context)
 {
-	stop();
-	start();
+	bool traced = !m_tracePattern.empty()
+		&& fnmatch(m_tracePattern.c_str(), context->datapoint->c_str(), 0) == 0;
+	if (traced && !context->trace)
+	{
+		context->trace = new TagTrace();
+		context->trace->logged = false;
+		context->trace->suppressed = 0;
+	}
+	else if (!traced && context->trace)
+	{
+		delete context->trace;
+		context->trace = NULL;
+	}
 }
 
 /**
- * Recurse the object tree and add subscriptions for all variables that are found.
- * The member variable m_subscriptions holds filters that wil be applied to the
- * subscription process. If this is non-empty then it contains a set of strings which
- * are matched against the name of the items in the object tree. Only variables that are in
- * a node that is a desendant of one of these named nodes is added to the subscription list.
+ * Log the value of a traced monitored item. At most one value is logged per
+ * trace interval for each item, the number of values not logged is included
+ * with the next value that is.
  *
- * @param	The node to recurse from
- * @active	Should subscriptions be added, i.e. have we satisfied any filtering requirements.
- * @return	The number of subscriptions added
+ * @param context	The context of the monitored item
+ * @param value		The value of the item
  */
-int OPCUA::addSubscribe(const UA_NodeId *node, bool active)
+void
+OPCUA::trace(const MonitoredItemContext *context, const DatapointValue& value)
 {
-	int n_subscriptions = 0;
-	UA_BrowseRequest bReq;
-	UA_BrowseRequest_init(&bReq);
-	bReq.requestedMaxReferencesPerNode = 0;
-	bReq.nodesToBrowse = UA_BrowseDescription_new();
-	bReq.nodesToBrowseSize = 1;
-	bReq.nodesToBrowse[0].nodeId = *node;
-	bReq.nodesToBrowse[0].resultMask = UA_BROWSERESULTMASK_ALL; /* return everything */
-	UA_BrowseResponse bResp = UA_Client_Service_browse(m_client, bReq);
-	if (bResp.resultsSize == 0)
-		Logger::getLogger()->debug("Browse results in 0 result size");
-	for (size_t i = 0; i < bResp.resultsSize; i++)
+	TagTrace *trace = context->trace;
+	auto now = chrono::steady_clock::now();
+	if (trace->suppressed > 0 || trace->logged)
 	{
-		for (size_t j = 0; j < bResp.results[i].referencesSize; j++)
+		if (now - trace->last < chrono::milliseconds(m_traceInterval))
 		{
-			UA_ReferenceDescription *ref = &(bResp.results[i].references[j]);
-			UA_String str = UA_STRING_NULL;
-			UA_NodeId_print(&(ref->nodeId.nodeId), &str);
-			if (ref->nodeClass == UA_NODECLASS_VARIABLE)
-			{
-				Logger::getLogger()->debug("Node %s is a variable", str.data);
-				UA_MonitoredItemCreateRequest monRequest =
-					UA_MonitoredItemCreateRequest_default(ref->nodeId.nodeId);
-				std::string dpname = "Unknown";;
-				try {
-					UA_NodeId *id = &(ref->nodeId.nodeId);
-					if (id->identifierType == UA_NODEIDTYPE_NUMERIC)
-					{
-						char buf[80];
-						snprintf(buf, sizeof(buf), "%d", id->identifier.numeric);
-						dpname = buf;
-					}
-					else
-					{
-						dpname = (char *)(id->identifier.byteString.data);
-					}
-				} catch (std::exception& e) {
-					Logger::getLogger()->error("No name for data change event: %s", e.what());
-				}
-				// Strip " from datapoint name
-				size_t pos;
-				while ((pos = dpname.find_first_of("\"")) != std::string::npos)
-				{
-					dpname.erase(pos, 1);
-				}
-				string *name = new string(dpname);
-
-				UA_MonitoredItemCreateResult monResponse =
-					UA_Client_MonitoredItems_createDataChange(m_client, m_subscriptionId,
-                                              UA_TIMESTAMPSTORETURN_BOTH,
-                                              monRequest, name, dataChangeHandler, NULL);
-				if(monResponse.statusCode != UA_STATUSCODE_GOOD)
-				{
-					Logger::getLogger()->error("Failed to monitor node %s", name->c_str());
-				}
-			}
-			else if (ref->nodeClass == UA_NODECLASS_OBJECT)
-			{
-				Logger::getLogger()->debug("Node %s is an object", str.data);
-				addSubscribe(&(ref->nodeId.nodeId), active);
-			}
+			trace->suppressed++;
+			return;
 		}
 	}
-	UA_BrowseRequest_clear(&bReq);
-	UA_BrowseResponse_clear(&bResp);
-	return 0;
+	Logger::getLogger()->info("Trace %s: %s, %lu values not logged", context->datapoint->c_str(),
+			value.toString().c_str(), trace->suppressed);
+	trace->last = now;
+	trace->logged = true;
+	trace->suppressed = 0;
 }
 
-
 /**
- * Starts the plugin
+ * Start or stop the aggregation of the values of a monitored item, depending
+ * on whether aggregation is enabled and its datapoint name matches the
+ * pattern of the variables to aggregate
  *
- * We register with the OPC UA server, retrieve all the objects under the parent
- * to which we are subscribing and start the process to enable OPC UA to send us
- * change notifications for those items.
+ * @param context	The context of the monitored item
  */
 void
-OPCUA::start()
+OPCUA::updateAggregate(MonitoredItemContext *context)
 {
-int n_subscriptions = 0;
-
-	m_client = UA_Client_new();
-	UA_ClientConfig *config = UA_Client_getConfig(m_client);
-	config->securityMode = m_secMode;
-	config->securityPolicyUri = UA_STRING_ALLOC((char *)m_secPolicy.c_str());
-	config->logger = m_UAlogger;
-	UA_ClientConfig_setDefault(config);
-	UA_StatusCode rval;
-	if (m_authPolicy.compare("username") == 0)
+	bool aggregated = m_aggregateWindow > 0
+		&& fnmatch(m_aggregatePattern.c_str(), context->datapoint->c_str(), 0) == 0;
+	Aggregator& aggregator = context->shard->session->aggregator;
+	if (aggregated && context->aggregate == AGGREGATE_NONE)
 	{
-		rval = UA_Client_connectUsername(m_client, m_url.c_str(), m_username.c_str(), m_password.c_str());
-		Logger::getLogger()->info("Connecting to %s with username %s/%s and policy '%s'", m_url.c_str(), m_username.c_str(), m_password.c_str(), m_secPolicy.c_str());
+		context->aggregate = aggregator.allocate(context->asset, context->datapoint);
 	}
-	else
+	else if (!aggregated && context->aggregate != AGGREGATE_NONE)
 	{
-		rval = UA_Client_connect(m_client, m_url.c_str());
+		aggregator.release(context->aggregate);
+		context->aggregate = AGGREGATE_NONE;
 	}
-	if (rval != UA_STATUSCODE_GOOD)
+}
+
+/**
+ * Send the statistics of the aggregated variables of a session when the
+ * current window ends. Windows are aligned to multiples of the window length
+ * since the epoch, so every session, and every instance of the plugin, uses
+ * the same window boundaries. A window in which no values were received
+ * creates no readings.
+ *
+ * @param session	The session whose variables are aggregated
+ * @param timeout	The longest time the caller wishes to wait for the server
+ * @return		The time in milliseconds to wait for the server
+ */
+UA_UInt32
+OPCUA::aggregate(Session *session, UA_UInt32 timeout)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	long now = (long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	long window = m_aggregateWindow;
+	if (session->windowEnd == 0)
 	{
-		Logger::getLogger()->fatal("Unable to connect to server %s, %x", UA_StatusCode_name(rval), rval);
-		UA_Client_delete(m_client);
-		m_client = NULL;
-		throw runtime_error("Failed to connect to OPCUA server");
+		session->windowEnd = (now / window + 1) * window;
 	}
-	m_connected = true;
-
-	UA_CreateSubscriptionRequest request = UA_CreateSubscriptionRequest_default();
-	UA_CreateSubscriptionResponse response = UA_Client_Subscriptions_create(m_client, request, this, NULL, NULL);
-	if (response.responseHeader.serviceResult == UA_STATUSCODE_GOOD)
-		m_subscriptionId = response.subscriptionId;
-	else
-		Logger::getLogger()->error("Failed to create subscription for OPCUA server");
-
-	// Now parse and add the subscriptions
-	for (auto item : m_subscriptions)
+	else if (now >= session->windowEnd)
 	{
-		Logger::getLogger()->debug("Adding subscriptions for node '%s'", item.c_str());
-		UA_NodeId id;
-		UA_String str = UA_STRING_ALLOC((char *)item.c_str());
-		UA_NodeId_parse(&id, str);
-		addSubscribe(&id, true);
+		emitAggregates(session, session->windowEnd - window);
+		session->windowEnd = (now / window + 1) * window;
 	}
+	long wait = session->windowEnd - now;
+	return wait < (long)timeout ? wait : timeout;
+}
 
-	m_threadStop = false;
-	m_thread = new thread(threadWrapper, this);
+/**
+ * Queue the readings holding the statistics of the aggregated variables of
+ * a session for the window that has ended
+ *
+ * @param session	The session whose variables are aggregated
+ * @param windowStart	The start of the window in milliseconds since the epoch
+ */
+void
+OPCUA::emitAggregates(Session *session, long windowStart)
+{
+	struct timeval start;
+	start.tv_sec = windowStart / 1000;
+	start.tv_usec = (windowStart % 1000) * 1000;
+	vector<Reading *> readings;
+	session->aggregator.flush(start, readings);
+	for (auto reading : readings)
+		queueReading(session, NULL, reading);
 }
 
-void OPCUA::threadStart()
+/**
+ * Set the action taken when the ingest queue of a session is full
+ *
+ * @param policy	The overflow policy, Block, Drop Oldest or Coalesce
+ */
+void
+OPCUA::setOverflowPolicy(const string& policy)
 {
-	while (! m_threadStop)
+	if (policy.compare("Block") == 0)
+		m_overflowPolicy = OverflowBlock;
+	else if (policy.compare("Drop Oldest") == 0)
+		m_overflowPolicy = OverflowDropOldest;
+	else if (policy.compare("Coalesce") == 0)
+		m_overflowPolicy = OverflowCoalesce;
+	else
 	{
-		UA_Client_run_iterate(m_client, 1000);
+		m_overflowPolicy = OverflowBlock;
+		Logger::getLogger()->error("Invalid overflow policy '%s'", policy.c_str());
 	}
 }
 
 /**
- * Stop all subscriptions and disconnect from the OPCUA server
+ * Set how the variables are mapped to assets
+ *
+ * @param mapping	The asset mapping, Variable, Parent Object or Browse Path Depth
  */
 void
-OPCUA::stop()
+OPCUA::setAssetMapping(const string& mapping)
 {
-	m_threadStop = true;
-	if (m_connected)
+	if (mapping.compare("Variable") == 0)
+		m_assetMapping = MapVariable;
+	else if (mapping.compare("Parent Object") == 0)
+		m_assetMapping = MapParentObject;
+	else if (mapping.compare("Browse Path Depth") == 0)
+		m_assetMapping = MapPathDepth;
+	else
 	{
-		m_subscriptions.clear();
-		UA_Client_disconnect(m_client);
+		m_assetMapping = MapVariable;
+		Logger::getLogger()->error("Invalid asset mapping '%s'", mapping.c_str());
 	}
 }
 
 /**
- * Called when a data changed event is received. This calls back to the south service
- * and adds the points to the readings queue to send.
+ * Set the source of the user timestamp of readings
  *
- * @param points	The points in the reading we must create
+ * @param type	The timestamp type, Source, Server or Receive
  */
-void OPCUA::ingest(vector<Datapoint *>	points)
+void
+OPCUA::setTimestampType(const string& type)
 {
-string asset = m_asset + points[0]->getName();
-
-	(*m_ingest)(m_data, Reading(asset, points));
+	if (type.compare("Source") == 0)
+		m_timestampType = TimestampSource;
+	else if (type.compare("Server") == 0)
+		m_timestampType = TimestampServer;
+	else if (type.compare("Receive") == 0)
+		m_timestampType = TimestampReceive;
+	else
+	{
+		m_timestampType = TimestampSource;
+		Logger::getLogger()->error("Invalid timestamp type '%s'", type.c_str());
+	}
 }
 
-
 /**
- * Set the message security mode
+ * Parse one set of monitoring settings. Any setting not given is taken from
+ * the defaults passed in.
  *
- * @param value    Security mode string
+ * @param value		The JSON object holding the settings
+ * @param settings	The settings to update
  */
-void
-OPCUA::setSecMode(const std::string& secMode)
-{ 
-	if (secMode.compare("Any") == 0)
-		m_secMode = UA_MESSAGESECURITYMODE_INVALID;
-	else if (secMode.compare("None") == 0)
-		m_secMode = UA_MESSAGESECURITYMODE_NONE;
-	else if (secMode.compare("Sign") == 0)
-		m_secMode = UA_MESSAGESECURITYMODE_SIGN;
-	else if (secMode.compare("SignAndEncrypt") == 0)
-		m_secMode = UA_MESSAGESECURITYMODE_SIGNANDENCRYPT;
-	else 
+static void parseMonitoring(const rapidjson::Value& value, MonitoringSettings& settings)
+{
+	if (value.HasMember("samplingInterval") && value["samplingInterval"].IsNumber())
+		settings.samplingInterval = value["samplingInterval"].GetDouble();
+	if (value.HasMember("queueSize") && value["queueSize"].IsUint())
+		settings.queueSize = value["queueSize"].GetUint();
+	if (value.HasMember("discardOldest") && value["discardOldest"].IsBool())
+		settings.discardOldest = value["discardOldest"].GetBool();
+	if (value.HasMember("deadbandValue") && value["deadbandValue"].IsNumber())
+		settings.deadbandValue = value["deadbandValue"].GetDouble();
+	if (value.HasMember("deadbandType") && value["deadbandType"].IsString())
 	{
-		m_secMode = UA_MESSAGESECURITYMODE_INVALID;
-		Logger::getLogger()->error("Invalid Security mode '%s'", secMode.c_str());
+		string type = value["deadbandType"].GetString();
+		if (type.compare("None") == 0)
+			settings.deadbandType = UA_DEADBANDTYPE_NONE;
+		else if (type.compare("Absolute") == 0)
+			settings.deadbandType = UA_DEADBANDTYPE_ABSOLUTE;
+		else if (type.compare("Percent") == 0)
+			settings.deadbandType = UA_DEADBANDTYPE_PERCENT;
+		else
+			Logger::getLogger()->error("Invalid deadband type '%s'", type.c_str());
 	}
 }
 
 /**
- * Set the security policy
+ * Set the monitoring settings used when creating monitored items
  *
- * @param value    Security policy string
+ * @param json	The monitoring configuration, a default and a set of overrides
  */
 void
-OPCUA::setSecPolicy(const std::string& secPolicy)
+OPCUA::setMonitoring(const string& json)
 {
-	if (!secPolicy.compare("Any"))
-		m_secPolicy = "";
-	else if (!secPolicy.compare("Basic256"))
-		m_secPolicy = "http://opcfoundation.org/UA/SecurityPolicy#Basic256";
-	else if (!secPolicy.compare("Basic256Sha256"))
-		m_secPolicy = "http://opcfoundation.org/UA/SecurityPolicy#Basic256Sha25";
-	else
+	m_monitoringConfig = json;
+	m_monitoring.samplingInterval = 250.0;
+	m_monitoring.queueSize = 1;
+	m_monitoring.discardOldest = true;
+	m_monitoring.deadbandType = UA_DEADBANDTYPE_NONE;
+	m_monitoring.deadbandValue = 0.0;
+	m_monitoringOverrides.clear();
+
+	rapidjson::Document doc;
+	doc.Parse(json.c_str());
+	if (doc.HasParseError() || !doc.IsObject())
 	{
-		m_secPolicy = "";
-		Logger::getLogger()->error("Invalid Security policy '%s'", secPolicy.c_str());
+		Logger::getLogger()->error("Invalid monitoring configuration, using the default settings");
+		return;
+	}
+	if (doc.HasMember("default") && doc["default"].IsObject())
+	{
+		parseMonitoring(doc["default"], m_monitoring);
+	}
+	if (doc.HasMember("overrides") && doc["overrides"].IsArray())
+	{
+		const rapidjson::Value& overrides = doc["overrides"];
+		for (rapidjson::SizeType i = 0; i < overrides.Size(); i++)
+		{
+			if (!overrides[i].IsObject() || !overrides[i].HasMember("pattern")
+					|| !overrides[i]["pattern"].IsString())
+			{
+				Logger::getLogger()->error("Monitoring override is missing a pattern");
+				continue;
+			}
+			MonitoringSettings settings = m_monitoring;
+			parseMonitoring(overrides[i], settings);
+			m_monitoringOverrides.push_back(make_pair(string(overrides[i]["pattern"].GetString()), settings));
+		}
 	}
 }
 
@@ -367,6 +2766,8 @@ OPCUA::setSecPolicy(const std::string& secPolicy)
 void
 OPCUA::setConfiguration(ConfigCategory *config)
 {
+	updateLogLevel();
+
 	if (config->itemExists("asset"))
 	{
 		setAssetName(config->getValue("asset"));
@@ -392,6 +2793,7 @@ OPCUA::setConfiguration(ConfigCategory *config)
 	// Now add the subscription data
 	if (config->itemExists("subscription"))
 	{
+		clearSubscription();
 		string map = config->getValue("subscription");
 		rapidjson::Document doc;
 		doc.Parse(map.c_str());
@@ -439,6 +2841,159 @@ OPCUA::setConfiguration(ConfigCategory *config)
 	{
 		setPassword(config->getValue("password"));
 	}
+	if (config->itemExists("reportingInterval"))
+	{
+		long interval = strtol(config->getValue("reportingInterval").c_str(), NULL, 10);
+		setReportingInterval(interval > 0 ? interval : 0);
+	}
+
+	if (config->itemExists("monitoring"))
+	{
+		setMonitoring(config->getValue("monitoring"));
+	}
+
+	if (config->itemExists("reportByException"))
+	{
+		setReportByException(config->getValue("reportByException"));
+	}
+
+	if (config->itemExists("timestamp"))
+	{
+		setTimestampType(config->getValue("timestamp"));
+	}
+
+	if (config->itemExists("maxArrayLength"))
+	{
+		long length = strtol(config->getValue("maxArrayLength").c_str(), NULL, 10);
+		setMaxArrayLength(length > 0 ? length : 0);
+	}
+
+	if (config->itemExists("cacheNodes"))
+	{
+		setCacheNodes(config->getValue("cacheNodes").compare("true") == 0);
+	}
+
+	if (config->itemExists("batching"))
+	{
+		setBatching(config->getValue("batching").compare("true") == 0);
+	}
+
+	if (config->itemExists("maxBatchSize"))
+	{
+		long size = strtol(config->getValue("maxBatchSize").c_str(), NULL, 10);
+		setMaxBatchSize(size > 0 ? size : 1);
+	}
+
+	if (config->itemExists("flushLatency"))
+	{
+		long latency = strtol(config->getValue("flushLatency").c_str(), NULL, 10);
+		setFlushLatency(latency > 0 ? latency : 0);
+	}
+
+	if (config->itemExists("sessions"))
+	{
+		long sessions = strtol(config->getValue("sessions").c_str(), NULL, 10);
+		setSessions(sessions > 0 ? sessions : 1);
+	}
+
+	if (config->itemExists("reconnectMinDelay") && config->itemExists("reconnectMaxDelay"))
+	{
+		long min = strtol(config->getValue("reconnectMinDelay").c_str(), NULL, 10);
+		long max = strtol(config->getValue("reconnectMaxDelay").c_str(), NULL, 10);
+		setReconnectDelay(min > 0 ? min : 1, max > 0 ? max : 1);
+	}
+
+	if (config->itemExists("traceTags"))
+	{
+		long interval = 1000;
+		if (config->itemExists("traceInterval"))
+			interval = strtol(config->getValue("traceInterval").c_str(), NULL, 10);
+		setTrace(config->getValue("traceTags"), interval > 0 ? interval : 0);
+	}
+
+	if (config->itemExists("aggregateWindow"))
+	{
+		long window = strtol(config->getValue("aggregateWindow").c_str(), NULL, 10);
+		string pattern = config->itemExists("aggregateTags") ? config->getValue("aggregateTags") : "*";
+		setAggregation(window > 0 ? window : 0, pattern);
+	}
+
+	if (config->itemExists("statisticsInterval"))
+	{
+		long interval = strtol(config->getValue("statisticsInterval").c_str(), NULL, 10);
+		string output = config->itemExists("statisticsOutput") ? config->getValue("statisticsOutput") : "Log";
+		setStatistics(interval > 0 ? interval : 0, output);
+	}
+
+	if (config->itemExists("ingestQueueSize"))
+	{
+		long size = strtol(config->getValue("ingestQueueSize").c_str(), NULL, 10);
+		setIngestQueueSize(size > 0 ? size : 0);
+	}
+
+	if (config->itemExists("overflowPolicy"))
+	{
+		setOverflowPolicy(config->getValue("overflowPolicy"));
+	}
+
+	if (config->itemExists("subscriptionsPerSession"))
+	{
+		long subscriptions = strtol(config->getValue("subscriptionsPerSession").c_str(), NULL, 10);
+		setSubscriptionsPerSession(subscriptions > 0 ? subscriptions : 1);
+	}
+
+	if (config->itemExists("filter"))
+	{
+		setFilter(config->getValue("filter"));
+	}
+
+	if (config->itemExists("assetMapping"))
+	{
+		setAssetMapping(config->getValue("assetMapping"));
+	}
+
+	if (config->itemExists("assetPathDepth"))
+	{
+		long depth = strtol(config->getValue("assetPathDepth").c_str(), NULL, 10);
+		setAssetPathDepth(depth > 0 ? depth : 0);
+	}
+
+	if (config->itemExists("lastKnownValues"))
+	{
+		setLastKnownValues(config->getValue("lastKnownValues").compare("true") == 0);
+	}
+
+	if (config->itemExists("acquisition"))
+	{
+		setPolled(config->getValue("acquisition").compare("Polled") == 0);
+	}
+
+	if (config->itemExists("pollInterval"))
+	{
+		long interval = strtol(config->getValue("pollInterval").c_str(), NULL, 10);
+		setPollInterval(interval > 0 ? interval : 1);
+	}
+
+	if (config->itemExists("readPipeline"))
+	{
+		long depth = strtol(config->getValue("readPipeline").c_str(), NULL, 10);
+		setReadPipeline(depth > 0 ? depth : 1);
+	}
+
+	if (config->itemExists("startupPipeline"))
+	{
+		long depth = strtol(config->getValue("startupPipeline").c_str(), NULL, 10);
+		setStartupPipeline(depth > 0 ? depth : 1);
+	}
+
+	if (config->itemExists("historyBackfill"))
+	{
+		long rate = 1000;
+		if (config->itemExists("backfillRate"))
+			rate = strtol(config->getValue("backfillRate").c_str(), NULL, 10);
+		setBackfill(config->getValue("historyBackfill").compare("true") == 0, rate > 0 ? rate : 1);
+	}
+
 #if CERTIFICATES
 	if (config->itemExists("caCert"))
 	{
@@ -468,55 +3023,182 @@ OPCUA::setConfiguration(ConfigCategory *config)
 }
 
 /**
- * Data chenaged callback
+ * Data changed callback. The context of the monitored item holds everything
+ * needed to build the reading, so the only work done here is decoding the
+ * value and creating the datapoint.
+ *
+ * @param context	The context of the monitored item
+ * @param value		The new value of the monitored item
  */
-void OPCUA::dataChanged(const string *name, UA_DataValue *value)
+void OPCUA::dataChanged(MonitoredItemContext *context, UA_DataValue *value)
 {
-	Logger::getLogger()->debug("Value changed for %s", name->c_str());
+	// Only the thread of the session writes the count, so no atomic increment is needed
+	atomic<unsigned long>& notifications = context->shard->notifications;
+	notifications.store(notifications.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	// Where a gap in the data would begin if the connection were lost
+	if (value->hasSourceTimestamp)
+		context->lastSource = value->sourceTimestamp;
+	else if (value->hasServerTimestamp)
+		context->lastSource = value->serverTimestamp;
+	// Where the values read from the history of a gap end
+	if (context->firstSource == 0)
+		context->firstSource = context->lastSource;
+	if (m_statisticsInterval && value->hasSourceTimestamp)
+	{
+		UA_DateTime latency = UA_DateTime_now() - value->sourceTimestamp;
+		m_metrics.sourceLatency.record(latency > 0 ? latency / UA_DATETIME_USEC : 0);
+	}
 	DatapointValue dpv(0L);
-	UA_Variant *variant = &(value->value);
-	if (UA_Variant_isScalar(variant))
+	context->decoder(&(value->value), dpv, m_maxArrayLength);
+	if (context->trace)
+		trace(context, dpv);
+	if (context->aggregate != AGGREGATE_NONE)
 	{
-		if  (variant->type == &UA_TYPES[UA_TYPES_BOOLEAN])
+		DatapointValue::dataTagType type = dpv.getType();
+		if (type == DatapointValue::T_INTEGER)
 		{
-			dpv = DatapointValue((long)*(UA_Boolean *)variant->data);
+			context->shard->session->aggregator.record(context->aggregate, dpv.toInt());
+			return;
 		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_INT64])
+		if (type == DatapointValue::T_FLOAT)
 		{
-            		dpv = DatapointValue((long)*(UA_Int64*)variant->data);
+			context->shard->session->aggregator.record(context->aggregate, dpv.toDouble());
+			return;
 		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_INT32])
-		{
-            		dpv = DatapointValue((long)*(UA_Int32*)variant->data);
-		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_INT16])
-		{
-            		dpv = DatapointValue((long)*(UA_Int16*)variant->data);
-		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_UINT64])
-		{
-            		dpv = DatapointValue((long)*(UA_UInt64*)variant->data);
-		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_UINT32])
-		{
-            		dpv = DatapointValue((long)*(UA_UInt32*)variant->data);
-		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_UINT16])
+	}
+	if (context->exception && !reportByException(context, dpv))
+		return;
+	struct timeval tv = { 0, 0 };
+	bool hasTimestamp = valueTimestamp(value, &tv);
+	sendValue(context, dpv, hasTimestamp, tv);
+}
+
+/**
+ * Send a value of a monitored item, as a reading of its own or by adding it
+ * to the batch of its asset
+ *
+ * @param context	The context of the monitored item
+ * @param dpv		The value
+ * @param hasTimestamp	False if the reading takes the time it is created
+ * @param tv		The timestamp of the value
+ */
+void OPCUA::sendValue(const MonitoredItemContext *context, DatapointValue& dpv, bool hasTimestamp,
+		const struct timeval& tv)
+{
+	Session *session = context->shard->session;
+	AssetBatch *batch = context->batch;
+	if (!m_batching && !grouped())
+	{
+		Reading *reading = new Reading(*context->asset, new Datapoint(*context->datapoint, dpv));
+		if (hasTimestamp)
+			reading->setUserTimestamp(tv);
+		queueReading(session, batch, reading);
+		return;
+	}
+
+	for (auto dp : batch->points)
+	{
+		// A second value for a datapoint already in the batch, send
+		// what we have so that no value is overwritten and the values
+		// queued by the server are ingested in order
+		if (dp->getName().compare(*context->datapoint) == 0)
 		{
-            		dpv = DatapointValue((long)*(UA_UInt16*)variant->data);
+			flushAsset(session, batch);
+			break;
 		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_FLOAT])
+	}
+	if (session->pendingCount == 0)
+		session->pendingSince = chrono::steady_clock::now();
+	if (batch->points.empty())
+	{
+		session->dirty.push_back(batch);
+		batch->hasTimestamp = hasTimestamp;
+		batch->timestamp = tv;
+	}
+	else if (hasTimestamp && (!batch->hasTimestamp || timercmp(&tv, &batch->timestamp, >)))
+	{
+		// A batched reading carries the newest timestamp of its datapoints
+		batch->hasTimestamp = true;
+		batch->timestamp = tv;
+	}
+	batch->points.push_back(new Datapoint(*context->datapoint, dpv));
+	if (++session->pendingCount >= m_maxBatchSize)
+		flushPending(session);
+}
+
+/**
+ * Send the batched datapoints for a single asset as one reading
+ *
+ * @param session	The session the batch belongs to
+ * @param batch		The batch of pending datapoints to send
+ */
+void OPCUA::flushAsset(Session *session, AssetBatch *batch)
+{
+	if (batch->points.empty())
+		return;
+	session->pendingCount -= batch->points.size();
+	if (m_lastKnownValues && grouped())
+	{
+		// Fill in the datapoints that have not changed with their last value
+		unsigned long flush = ++batch->flushes;
+		for (auto dp : batch->points)
 		{
-            		dpv = DatapointValue((double)*(UA_Float*)variant->data);
+			auto it = batch->lastValues.find(dp->getName());
+			if (it == batch->lastValues.end())
+				batch->lastValues.insert(make_pair(dp->getName(), make_pair(dp->getData(), flush)));
+			else
+				it->second = make_pair(dp->getData(), flush);
 		}
-		else if (variant->type == &UA_TYPES[UA_TYPES_DOUBLE])
+		for (auto& last : batch->lastValues)
 		{
-            		dpv = DatapointValue((double)*(UA_Double*)variant->data);
+			if (last.second.second != flush)
+				batch->points.push_back(new Datapoint(last.first, last.second.first));
 		}
 	}
-	
-	vector<Datapoint *> points;
-	points.push_back(new Datapoint(*name, dpv));
-	Reading reading(*name, points);
-	m_ingest(m_data, reading);
+	Reading *reading = new Reading(*batch->asset, batch->points);
+	if (batch->hasTimestamp)
+		reading->setUserTimestamp(batch->timestamp);
+	batch->points.clear();
+	// The batch of variables that are not grouped holds unrelated
+	// variables, one of its readings must not replace another
+	queueReading(session, grouped() ? batch : NULL, reading);
+}
+
+/**
+ * Return the timestamp of a data change to use as the user timestamp of the
+ * reading. The source timestamp is used if configured and the server sent
+ * one, falling back to the server timestamp.
+ *
+ * @param value	The data change
+ * @param tv	The timestamp to set
+ * @return	False if the time the data change was received should be used
+ */
+bool OPCUA::valueTimestamp(const UA_DataValue *value, struct timeval *tv)
+{
+	UA_DateTime dt;
+	if (m_timestampType == TimestampSource && value->hasSourceTimestamp)
+		dt = value->sourceTimestamp;
+	else if (m_timestampType != TimestampReceive && value->hasServerTimestamp)
+		dt = value->serverTimestamp;
+	else
+		return false;
+	dt -= UA_DATETIME_UNIX_EPOCH;
+	tv->tv_sec = dt / UA_DATETIME_SEC;
+	tv->tv_usec = (dt % UA_DATETIME_SEC) / UA_DATETIME_USEC;
+	return true;
+}
+
+/**
+ * Send all the batched datapoints of a session, one reading per asset. Only
+ * the batches that have had datapoints added since the last flush are visited.
+ *
+ * @param session	The session to flush
+ */
+void OPCUA::flushPending(Session *session)
+{
+	for (auto batch : session->dirty)
+	{
+		flushAsset(session, batch);
+	}
+	session->dirty.clear();
 }
@@ -0,0 +1,695 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <logger.h>
+
+using namespace std;
+
+/**
+ * Callback for the responses to the Browse requests of the startup pipeline
+ */
+static void browseCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+			UA_BrowseResponse *response)
+{
+	PipelineRequest *request = (PipelineRequest *)userdata;
+	request->opcua->pipelineResponse(request, response);
+}
+
+/**
+ * Callback for the responses to the Read requests of the startup pipeline
+ */
+static void readCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+			UA_ReadResponse *response)
+{
+	PipelineRequest *request = (PipelineRequest *)userdata;
+	request->opcua->pipelineResponse(request, response);
+}
+
+/**
+ * Callback for the responses to the other requests of the startup pipeline
+ */
+static void serviceCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+			void *response)
+{
+	PipelineRequest *request = (PipelineRequest *)userdata;
+	request->opcua->pipelineResponse(request, response);
+}
+
+/**
+ * Browse the object tree breadth first from the given roots and collect all
+ * the variables that are found. Each Browse request carries at most as many
+ * nodes as the MaxNodesPerBrowse operation limit of the server allows and
+ * only asks for forward hierarchical references to objects and variables.
+ * The requests are sent asynchronously, with up to the startup pipeline
+ * depth in flight. Results that are truncated by the server are completed
+ * using BrowseNext.
+ *
+ * @param roots	The nodes to browse from
+ * @return	False if the browse was cut short, in which case only part of
+ *		the variables below the roots have been found
+ */
+bool OPCUA::browse(const vector<UA_NodeId>& roots)
+{
+	StartupPipeline pipeline;
+	startPipeline(pipeline, roots, false, m_nodes.size());
+	bool complete = runPipeline(pipeline);
+	int n_variables = m_nodes.size() - pipeline.found;
+	Logger::getLogger()->info("Browsed %d nodes in %d requests, found %d variables",
+			(int)pipeline.visited.size(), pipeline.requests, n_variables);
+	finishPipeline(pipeline);
+	if (!m_filter.empty())
+	{
+		n_variables = filterNodes(pipeline.found, pipeline.variables, pipeline.pruned);
+	}
+	if (!complete)
+		Logger::getLogger()->warn("The browse was cut short after finding %d variables", n_variables);
+	return complete;
+}
+
+/**
+ * Prepare the startup pipeline. The pipeline browses the server from the
+ * given roots and, if asked to, creates monitored items for the variables
+ * as they are found, so that data starts to flow for the first variables
+ * while the rest of the address space is still being browsed. The browse
+ * and the creation of monitored items each keep up to the startup pipeline
+ * depth of requests in flight.
+ *
+ * @param pipeline	The pipeline to prepare
+ * @param roots		The nodes to browse from, which may be empty
+ * @param monitor	True if monitored items are to be created
+ * @param first		The index in m_nodes of the first variable to monitor
+ */
+void OPCUA::startPipeline(StartupPipeline& pipeline, const vector<UA_NodeId>& roots,
+		bool monitor, size_t first)
+{
+	pipeline.monitor = monitor;
+	pipeline.generation = ++m_pipelineGeneration;
+	pipeline.first = first;
+	pipeline.found = m_nodes.size();
+	pipeline.next = first;
+	pipeline.browsing = 0;
+	pipeline.working = 0;
+	pipeline.requests = 0;
+	pipeline.createRequests = 0;
+	pipeline.pruned = 0;
+	pipeline.excluded = 0;
+	pipeline.created = 0;
+	pipeline.failed = 0;
+	pipeline.aborted = false;
+	pipeline.browsed = false;
+	pipeline.monitoring = false;
+	pipeline.start = chrono::steady_clock::now();
+	pipeline.browseEnd = pipeline.start;
+	pipeline.firstItems = pipeline.start;
+	pipeline.resultMask = UA_BROWSERESULTMASK_NODECLASS;
+	if (m_filter.usesBrowsePath() || grouped())
+		pipeline.resultMask |= UA_BROWSERESULTMASK_BROWSENAME;
+	pipeline.browseChunk = MAX_NODES_PER_BROWSE;
+	if (!roots.empty())
+	{
+		pipeline.browseChunk = operationLimit(
+				UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERBROWSE,
+				MAX_NODES_PER_BROWSE);
+	}
+	pipeline.readChunk = MAX_NODES_PER_READ;
+	pipeline.itemChunk = MAX_ITEMS_PER_CALL;
+	if (monitor)
+	{
+		pipeline.readChunk = operationLimit(
+				UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERREAD,
+				MAX_NODES_PER_READ);
+		pipeline.itemChunk = operationLimit(
+				UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXMONITOREDITEMSPERCALL,
+				MAX_ITEMS_PER_CALL);
+		m_maxItemsPerCall = pipeline.itemChunk;
+	}
+	m_filter.start(m_namespaces);
+
+	for (auto& root : roots)
+	{
+		if (pipeline.visited.find(root) != pipeline.visited.end())
+			continue;
+		UA_NodeId id;
+		UA_NodeId_copy(&root, &id);
+		pipeline.visited.insert(id);
+		BrowseNode node;
+		UA_NodeId_copy(&root, &node.nodeId);
+		node.excluded = false;
+		node.depth = 0;
+		if (grouped())
+			node.object = rootName(&root);
+		pipeline.queue.push_back(node);
+	}
+	m_pipeline = &pipeline;
+}
+
+/**
+ * Run the startup pipeline until the browse is complete and, if monitored
+ * items are being created, every variable found has a monitored item. The
+ * clients of all the sessions are serviced, as the items of each shard are
+ * created by the client of its session, and the data changes of the items
+ * already created are handled as they arrive. The threads of the sessions
+ * must not be running.
+ *
+ * The data types of the variables found are read in batches no larger than
+ * the MaxNodesPerRead operation limit of the server. A smaller batch is sent
+ * when no other batch is in flight, so the first items are created without
+ * waiting for a full batch of variables to be found.
+ *
+ * @param pipeline	The pipeline to run
+ * @return		False if the pipeline was abandoned because a session failed
+ */
+bool OPCUA::runPipeline(StartupPipeline& pipeline)
+{
+	UA_UInt32 wait = m_sessions.size() > 1 ? 10 : 100;
+	while (!pipeline.aborted)
+	{
+		while (!pipeline.aborted && pipeline.browsing < m_startupPipeline && !pipeline.queue.empty())
+			sendBrowse(pipeline);
+		if (!pipeline.browsed && pipeline.queue.empty() && pipeline.browsing == 0)
+		{
+			pipeline.browsed = true;
+			pipeline.browseEnd = chrono::steady_clock::now();
+		}
+		if (pipeline.monitor)
+		{
+			while (!pipeline.aborted && pipeline.working < m_startupPipeline
+					&& pipeline.next < m_nodes.size()
+					&& (pipeline.browsed || pipeline.working == 0
+						|| m_nodes.size() - pipeline.next >= pipeline.readChunk))
+				sendTypeRead(pipeline);
+		}
+		if (pipeline.browsed && pipeline.working == 0
+				&& (!pipeline.monitor || pipeline.next >= m_nodes.size()))
+			break;
+
+		for (auto session : m_sessions)
+		{
+			UA_StatusCode rval = UA_Client_run_iterate(session->client, session->index == 0 ? wait : 0);
+			if (rval != UA_STATUSCODE_GOOD)
+			{
+				Logger::getLogger()->error("Session %d lost the connection to the server during startup: %s",
+						session->index, UA_StatusCode_name(rval));
+				pipeline.aborted = true;
+				break;
+			}
+			flushDue(session);
+		}
+	}
+	// Any responses still to arrive are for a pipeline that no longer exists
+	m_pipeline = NULL;
+	return !pipeline.aborted;
+}
+
+/**
+ * Release the state of the startup pipeline once it has run. If monitored
+ * items were created the variables the filter excluded are removed and the
+ * outcome of the filter and of the creation of the items is reported.
+ *
+ * @param pipeline	The pipeline that has run
+ */
+void OPCUA::finishPipeline(StartupPipeline& pipeline)
+{
+	for (auto& id : pipeline.visited)
+	{
+		UA_NodeId_clear(const_cast<UA_NodeId *>(&id));
+	}
+	pipeline.visited.clear();
+	for (auto& node : pipeline.queue)
+		UA_NodeId_clear(&node.nodeId);
+	pipeline.queue.clear();
+	if (!pipeline.monitor)
+		return;
+
+	if (pipeline.aborted && pipeline.next < m_nodes.size())
+	{
+		// The variables not yet reached are found again when the
+		// monitored items are reconciled with the server
+		Logger::getLogger()->warn("Startup was interrupted, %d variables are not yet monitored",
+				(int)(m_nodes.size() - pipeline.next));
+		for (size_t i = pipeline.next; i < m_nodes.size(); i++)
+		{
+			UA_NodeId_clear(&m_nodes[i].nodeId);
+			UA_NodeId_clear(&m_nodes[i].dataType);
+		}
+		m_nodes.resize(pipeline.next);
+	}
+	if (!m_filter.empty())
+	{
+		bool dryRun = m_filter.dryRun();
+		size_t found = m_nodes.size() - pipeline.found;
+		size_t kept = pipeline.found;
+		for (size_t i = pipeline.found; i < m_nodes.size(); i++)
+		{
+			MonitoredNode& node = m_nodes[i];
+			if (pipeline.variables[i - pipeline.found].excluded)
+			{
+				UA_NodeId_clear(&node.nodeId);
+				UA_NodeId_clear(&node.dataType);
+				continue;
+			}
+			if (kept != i)
+				m_nodes[kept] = node;
+			kept++;
+		}
+		m_nodes.resize(kept);
+		m_filter.report();
+		Logger::getLogger()->info("Filter %s %d of %d variables and %d objects, %d variables %s monitored",
+				dryRun ? "dry run would exclude" : "excluded", pipeline.excluded, (int)found,
+				pipeline.pruned, (int)found - pipeline.excluded, dryRun ? "would be" : "are");
+	}
+	m_metrics.itemsCreated.fetch_add(pipeline.created, memory_order_relaxed);
+	m_metrics.itemFailures.fetch_add(pipeline.failed, memory_order_relaxed);
+	for (auto shard : m_shards)
+	{
+		Logger::getLogger()->debug("Shard %d has %d monitored items", shard->index, shard->items);
+	}
+	Logger::getLogger()->info("Created %d monitored items in %d requests, %d failed",
+			(int)pipeline.created, pipeline.createRequests, (int)pipeline.failed);
+}
+
+/**
+ * Allocate a request of the startup pipeline
+ *
+ * @param pipeline	The pipeline sending the request
+ * @param stage		The stage of the pipeline the request belongs to
+ * @return		The request, which is deleted once its response is handled
+ */
+PipelineRequest *OPCUA::pipelineRequest(StartupPipeline& pipeline, PipelineStage stage)
+{
+	PipelineRequest *request = new PipelineRequest;
+	request->opcua = this;
+	request->generation = pipeline.generation;
+	request->stage = stage;
+	request->first = 0;
+	request->count = 0;
+	request->shard = NULL;
+	return request;
+}
+
+/**
+ * Send a Browse request for the nodes at the front of the browse queue. The
+ * queued nodes are spread over the requests the pipeline may still send, so
+ * that sibling subtrees are browsed concurrently even when few nodes are
+ * queued.
+ *
+ * @param pipeline	The pipeline sending the request
+ */
+void OPCUA::sendBrowse(StartupPipeline& pipeline)
+{
+	size_t slots = m_startupPipeline - pipeline.browsing;
+	size_t n = (pipeline.queue.size() + slots - 1) / slots;
+	if (n > pipeline.browseChunk)
+		n = pipeline.browseChunk;
+
+	UA_BrowseRequest bReq;
+	UA_BrowseRequest_init(&bReq);
+	bReq.requestedMaxReferencesPerNode = 0;
+	bReq.nodesToBrowse = (UA_BrowseDescription *)UA_Array_new(n, &UA_TYPES[UA_TYPES_BROWSEDESCRIPTION]);
+	bReq.nodesToBrowseSize = n;
+	PipelineRequest *request = pipelineRequest(pipeline, PipelineBrowse);
+	for (size_t i = 0; i < n; i++)
+	{
+		UA_BrowseDescription *desc = &bReq.nodesToBrowse[i];
+		desc->nodeId = pipeline.queue.front().nodeId;	// The request now owns the node id
+		request->parents.push_back(pipeline.queue.front());
+		pipeline.queue.pop_front();
+		desc->browseDirection = UA_BROWSEDIRECTION_FORWARD;
+		desc->referenceTypeId = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+		desc->includeSubtypes = true;
+		desc->nodeClassMask = UA_NODECLASS_OBJECT | UA_NODECLASS_VARIABLE;
+		desc->resultMask = pipeline.resultMask;
+	}
+	UA_UInt32 requestId;
+	UA_StatusCode rval = UA_Client_sendAsyncBrowseRequest(m_client, &bReq, browseCallback,
+			request, &requestId);
+	UA_BrowseRequest_clear(&bReq);
+	if (rval != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Failed to send a browse request for %d nodes: %s", (int)n,
+				UA_StatusCode_name(rval));
+		delete request;
+		pipeline.aborted = true;
+		return;
+	}
+	pipeline.browsing++;
+	pipeline.requests++;
+}
+
+/**
+ * Send a BrowseNext request to continue the browse of nodes whose results
+ * the server truncated
+ *
+ * @param pipeline	The pipeline sending the request
+ * @param continuations	The continuation points, which the request takes ownership of
+ * @param parents	The nodes being browsed, which are moved to the request
+ */
+void OPCUA::sendBrowseNext(StartupPipeline& pipeline, vector<UA_ByteString>& continuations,
+		vector<BrowseNode>& parents)
+{
+	UA_BrowseNextRequest nReq;
+	UA_BrowseNextRequest_init(&nReq);
+	nReq.releaseContinuationPoints = false;
+	nReq.continuationPoints = (UA_ByteString *)UA_Array_new(continuations.size(),
+					&UA_TYPES[UA_TYPES_BYTESTRING]);
+	nReq.continuationPointsSize = continuations.size();
+	for (size_t i = 0; i < continuations.size(); i++)
+		nReq.continuationPoints[i] = continuations[i];
+	continuations.clear();
+	PipelineRequest *request = pipelineRequest(pipeline, PipelineBrowseNext);
+	request->parents.swap(parents);
+
+	UA_UInt32 requestId;
+	UA_StatusCode rval = __UA_Client_AsyncService(m_client, &nReq,
+			&UA_TYPES[UA_TYPES_BROWSENEXTREQUEST], serviceCallback,
+			&UA_TYPES[UA_TYPES_BROWSENEXTRESPONSE], request, &requestId);
+	UA_BrowseNextRequest_clear(&nReq);
+	if (rval != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Failed to send a BrowseNext request: %s", UA_StatusCode_name(rval));
+		delete request;
+		pipeline.aborted = true;
+		return;
+	}
+	pipeline.browsing++;
+	pipeline.requests++;
+}
+
+/**
+ * Handle the results of a Browse or BrowseNext request, following any
+ * continuation points the server returned
+ *
+ * @param pipeline	The pipeline that sent the request
+ * @param request	The request
+ * @param status	The service result of the response
+ * @param results	The browse results, one per node browsed
+ * @param count		The number of results
+ */
+void OPCUA::browseResults(StartupPipeline& pipeline, PipelineRequest *request, UA_StatusCode status,
+		const UA_BrowseResult *results, size_t count)
+{
+	pipeline.browsing--;
+	if (status != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("%s of %d nodes failed: %s",
+				request->stage == PipelineBrowse ? "Browse" : "BrowseNext",
+				(int)request->parents.size(), UA_StatusCode_name(status));
+		// The nodes below these parents are missing from the browse
+		pipeline.aborted = true;
+	}
+
+	vector<UA_ByteString> continuations;
+	vector<BrowseNode> continued;
+	for (size_t i = 0; i < count && i < request->parents.size(); i++)
+	{
+		browseResult(&results[i], request->parents[i], pipeline.visited, pipeline.queue,
+				pipeline.variables, pipeline.pruned);
+		if (results[i].continuationPoint.length > 0)
+		{
+			UA_ByteString cp;
+			UA_ByteString_copy(&results[i].continuationPoint, &cp);
+			continuations.push_back(cp);
+			continued.push_back(request->parents[i]);
+		}
+	}
+	if (!continuations.empty())
+		sendBrowseNext(pipeline, continuations, continued);
+}
+
+/**
+ * Send a Read request for the data types of the next batch of variables
+ * to monitor. If the data types of the batch are already known, as they
+ * are when the variables come from the node cache, the monitored items
+ * are created straight away.
+ *
+ * @param pipeline	The pipeline sending the request
+ */
+void OPCUA::sendTypeRead(StartupPipeline& pipeline)
+{
+	size_t n = m_nodes.size() - pipeline.next;
+	if (n > pipeline.readChunk)
+		n = pipeline.readChunk;
+	size_t first = pipeline.next;
+	pipeline.next += n;
+
+	vector<UA_ReadValueId> ids;
+	vector<size_t> nodes;
+	for (size_t i = first; i < first + n; i++)
+	{
+		if (!UA_NodeId_isNull(&m_nodes[i].dataType))
+			continue;
+		UA_ReadValueId id;
+		UA_ReadValueId_init(&id);
+		id.nodeId = m_nodes[i].nodeId;
+		id.attributeId = UA_ATTRIBUTEID_DATATYPE;
+		ids.push_back(id);
+		nodes.push_back(i);
+	}
+	if (ids.empty())
+	{
+		monitorNodes(pipeline, first, n);
+		return;
+	}
+
+	UA_ReadRequest rReq;
+	UA_ReadRequest_init(&rReq);
+	rReq.nodesToRead = ids.data();
+	rReq.nodesToReadSize = ids.size();
+	rReq.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+	PipelineRequest *request = pipelineRequest(pipeline, PipelineRead);
+	request->first = first;
+	request->count = n;
+	request->nodes.swap(nodes);
+	UA_UInt32 requestId;
+	UA_StatusCode rval = UA_Client_sendAsyncReadRequest(m_client, &rReq, readCallback,
+			request, &requestId);
+	if (rval != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Failed to send a read of the data type of %d variables: %s",
+				(int)ids.size(), UA_StatusCode_name(rval));
+		delete request;
+		pipeline.aborted = true;
+		return;
+	}
+	pipeline.working++;
+}
+
+/**
+ * Create the monitored items for a batch of variables whose data types are
+ * known. Variables the filter excludes are skipped, and marked so that they
+ * are removed once the pipeline has run. Each remaining variable is assigned
+ * to a shard by the hash of its node id, so that a variable stays in the same
+ * shard when the server is browsed again, and the items of each shard are
+ * created in chunks no larger than the MaxMonitoredItemsPerCall operation
+ * limit of the server.
+ *
+ * @param pipeline	The pipeline creating the items
+ * @param first		The index in m_nodes of the first variable of the batch
+ * @param count		The number of variables in the batch
+ */
+void OPCUA::monitorNodes(StartupPipeline& pipeline, size_t first, size_t count)
+{
+	bool dryRun = m_filter.dryRun();
+	vector<vector<size_t> > shards(m_shards.size());
+	for (size_t i = first; i < first + count; i++)
+	{
+		MonitoredNode& node = m_nodes[i];
+		if (!m_filter.empty() && i >= pipeline.found)
+		{
+			BrowseNode& variable = pipeline.variables[i - pipeline.found];
+			bool excluded = variable.excluded
+				|| m_filter.excludeVariable(variable.path, &node.nodeId, &node.dataType);
+			variable.excluded = excluded && !dryRun;
+			if (excluded)
+			{
+				pipeline.excluded++;
+				if (!dryRun)
+					continue;
+			}
+		}
+		node.shard = UA_NodeId_hash(&node.nodeId) % m_shards.size();
+		shards[node.shard].push_back(i);
+	}
+	for (size_t s = 0; s < shards.size(); s++)
+	{
+		for (size_t base = 0; base < shards[s].size(); base += pipeline.itemChunk)
+		{
+			size_t n = shards[s].size() - base;
+			if (n > pipeline.itemChunk)
+				n = pipeline.itemChunk;
+			vector<size_t> nodes(shards[s].begin() + base, shards[s].begin() + base + n);
+			sendCreate(pipeline, m_shards[s], nodes);
+		}
+	}
+}
+
+/**
+ * Send a CreateMonitoredItems request for variables of one shard, using the
+ * client of the session that holds the shard
+ *
+ * @param pipeline	The pipeline creating the items
+ * @param shard		The shard to create the items in
+ * @param nodes		The indexes in m_nodes of the variables to monitor
+ */
+void OPCUA::sendCreate(StartupPipeline& pipeline, Shard *shard, const vector<size_t>& nodes)
+{
+	lock_guard<mutex> guard(m_contextMutex);
+	size_t n = nodes.size();
+	vector<UA_MonitoredItemCreateRequest> items;
+	vector<UA_DataChangeFilter> filters(n);
+	vector<UA_Client_DataChangeNotificationCallback> callbacks(n, dataChangeHandler);
+	vector<UA_Client_DeleteMonitoredItemCallback> deleteCallbacks(n, (UA_Client_DeleteMonitoredItemCallback)NULL);
+	PipelineRequest *request = pipelineRequest(pipeline, PipelineCreate);
+	request->shard = shard;
+	request->nodes = nodes;
+	for (size_t i = 0; i < n; i++)
+	{
+		MonitoredNode& node = m_nodes[nodes[i]];
+		items.push_back(UA_MonitoredItemCreateRequest_default(node.nodeId));
+		monitoringParameters(node, &items[i].requestedParameters, &filters[i]);
+		request->contexts.push_back(createContext(node, shard));
+	}
+
+	UA_CreateMonitoredItemsRequest cReq;
+	UA_CreateMonitoredItemsRequest_init(&cReq);
+	cReq.subscriptionId = shard->subscriptionId;
+	cReq.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+	cReq.itemsToCreate = items.data();
+	cReq.itemsToCreateSize = n;
+	UA_UInt32 requestId;
+	UA_StatusCode rval = UA_Client_MonitoredItems_createDataChanges_async(shard->session->client,
+			cReq, request->contexts.data(), callbacks.data(), deleteCallbacks.data(),
+			serviceCallback, request, &requestId);
+	if (rval != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Failed to send a request to create %d monitored items: %s",
+				(int)n, UA_StatusCode_name(rval));
+		for (auto context : request->contexts)
+			releaseContext((MonitoredItemContext *)context);
+		pipeline.failed += n;
+		delete request;
+		pipeline.aborted = true;
+		return;
+	}
+	pipeline.working++;
+	pipeline.createRequests++;
+}
+
+/**
+ * Handle the results of a CreateMonitoredItems request. The contexts of
+ * items that could not be created are returned to the pool.
+ *
+ * @param pipeline	The pipeline that sent the request
+ * @param request	The request
+ * @param response	The response from the server
+ */
+void OPCUA::createResults(StartupPipeline& pipeline, PipelineRequest *request,
+		const UA_CreateMonitoredItemsResponse *response)
+{
+	lock_guard<mutex> guard(m_contextMutex);
+	pipeline.working--;
+	size_t n = request->nodes.size();
+	if (response->responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Failed to create %d monitored items: %s", (int)n,
+				UA_StatusCode_name(response->responseHeader.serviceResult));
+	}
+	size_t created = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		MonitoredNode& node = m_nodes[request->nodes[i]];
+		UA_StatusCode status = response->responseHeader.serviceResult;
+		if (i < response->resultsSize)
+			status = response->results[i].statusCode;
+		if (status == UA_STATUSCODE_GOOD)
+		{
+			node.monitoredItemId = response->results[i].monitoredItemId;
+			((MonitoredItemContext *)request->contexts[i])->monitoredItemId = node.monitoredItemId;
+			created++;
+		}
+		else
+		{
+			if (response->responseHeader.serviceResult == UA_STATUSCODE_GOOD)
+				Logger::getLogger()->error("Failed to monitor node %s: %s",
+					node.datapoint.c_str(), UA_StatusCode_name(status));
+			releaseContext((MonitoredItemContext *)request->contexts[i]);
+			pipeline.failed++;
+		}
+	}
+	request->shard->items += created;
+	pipeline.created += created;
+	if (created && !pipeline.monitoring)
+	{
+		pipeline.monitoring = true;
+		pipeline.firstItems = chrono::steady_clock::now();
+	}
+}
+
+/**
+ * Handle the response to a request sent by the startup pipeline
+ *
+ * @param request	The request, which is deleted
+ * @param response	The response from the server
+ */
+void OPCUA::pipelineResponse(PipelineRequest *request, void *response)
+{
+	StartupPipeline *pipeline = m_pipeline;
+	if (!pipeline || request->generation != pipeline->generation)
+	{
+		// The pipeline was abandoned. The contexts of any items the
+		// client created are in use and stay allocated.
+		delete request;
+		return;
+	}
+	switch (request->stage)
+	{
+		case PipelineBrowse:
+		{
+			UA_BrowseResponse *bResp = (UA_BrowseResponse *)response;
+			browseResults(*pipeline, request, bResp->responseHeader.serviceResult,
+					bResp->results, bResp->resultsSize);
+			break;
+		}
+		case PipelineBrowseNext:
+		{
+			UA_BrowseNextResponse *nResp = (UA_BrowseNextResponse *)response;
+			browseResults(*pipeline, request, nResp->responseHeader.serviceResult,
+					nResp->results, nResp->resultsSize);
+			break;
+		}
+		case PipelineRead:
+		{
+			UA_ReadResponse *rResp = (UA_ReadResponse *)response;
+			pipeline->working--;
+			if (rResp->responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+			{
+				Logger::getLogger()->error("Failed to read the data type of %d variables: %s",
+						(int)request->nodes.size(),
+						UA_StatusCode_name(rResp->responseHeader.serviceResult));
+			}
+			for (size_t i = 0; i < rResp->resultsSize && i < request->nodes.size(); i++)
+			{
+				UA_DataValue *value = &rResp->results[i];
+				if (value->hasValue && UA_Variant_hasScalarType(&value->value, &UA_TYPES[UA_TYPES_NODEID]))
+				{
+					MonitoredNode& node = m_nodes[request->nodes[i]];
+					UA_NodeId_clear(&node.dataType);
+					UA_NodeId_copy((UA_NodeId *)value->value.data, &node.dataType);
+				}
+			}
+			monitorNodes(*pipeline, request->first, request->count);
+			break;
+		}
+		case PipelineCreate:
+			createResults(*pipeline, request, (UA_CreateMonitoredItemsResponse *)response);
+			break;
+	}
+	delete request;
+}
@@ -55,6 +55,13 @@ static const char *default_config = QUOTE({
 		"displayName" : "OPCUA Object Subscriptions",
 	       	"order" : "3"
        		},
+	"subscribeById" : {
+		"description" : "The subscriptions are node ids rather than browse paths" ,
+		"type" : "boolean",
+		"default" : "true",
+		"displayName" : "Subscribe By ID",
+		"order" : "36"
+		},
 	"reportingInterval" : {
 		"description" : "The minimum reporting interval for data change notifications" ,
 		"type" : "integer",
@@ -62,6 +69,232 @@ static const char *default_config = QUOTE({
 		"displayName" : "Min Reporting Interval (millisec)",
 		"order" : "5"
 		},
+	"monitoring" : {
+		"description" : "The sampling interval, queue size and deadband filter to request for monitored items, with overrides for variables whose node id or name matches a pattern" ,
+		"type" : "JSON",
+		"default" : "{ \"default\" : { \"samplingInterval\" : 250, \"queueSize\" : 1, \"discardOldest\" : true, \"deadbandType\" : \"None\", \"deadbandValue\" : 0 }, \"overrides\" : [ ] }",
+		"displayName" : "Monitoring Parameters",
+		"order" : "20"
+		},
+	"reportByException" : {
+		"description" : "A deadband applied by the plugin to numeric values and a maximum age after which an unchanged value is sent again, with overrides for variables whose name matches a pattern" ,
+		"type" : "JSON",
+		"default" : "{ \"default\" : { \"deadbandType\" : \"None\", \"deadbandValue\" : 0, \"maxAge\" : 0 }, \"overrides\" : [ ] }",
+		"displayName" : "Report By Exception",
+		"order" : "42"
+		},
+	"aggregateWindow" : {
+		"description" : "The length in milliseconds of the windows over which the values of aggregated variables are summarised, 0 sends every value" ,
+		"type" : "integer",
+		"default" : "0",
+		"displayName" : "Aggregation Window",
+		"order" : "43"
+		},
+	"aggregateTags" : {
+		"description" : "A pattern matched against the datapoint names of the variables to aggregate" ,
+		"type" : "string",
+		"default" : "*",
+		"displayName" : "Aggregate Variables",
+		"order" : "44",
+		"validity": " aggregateWindow != \"0\" "
+		},
+	"historyBackfill" : {
+		"description" : "After a lost connection is recovered, read the values missed while disconnected from the history of the server" ,
+		"type" : "boolean",
+		"default" : "false",
+		"displayName" : "History Backfill",
+		"order" : "45"
+		},
+	"backfillRate" : {
+		"description" : "The maximum number of values read from the history of the server to send per second" ,
+		"type" : "integer",
+		"default" : "1000",
+		"displayName" : "Backfill Rate (values/sec)",
+		"order" : "46",
+		"validity": " historyBackfill == \"true\" "
+		},
+	"filter" : {
+		"description" : "Rules that include or exclude the nodes found by browsing the server, by browse path, node class, data type or namespace" ,
+		"type" : "JSON",
+		"default" : "{ \"rules\" : [ ], \"dryRun\" : false }",
+		"displayName" : "Browse Filter",
+		"order" : "37"
+		},
+	"assetMapping" : {
+		"description" : "Create an asset for each variable, or group the variables into an asset for each object" ,
+		"type" : "enumeration",
+		"options":["Variable", "Parent Object", "Browse Path Depth"],
+		"default" : "Variable",
+		"displayName" : "Asset Mapping",
+		"order" : "38"
+		},
+	"assetPathDepth" : {
+		"description" : "The depth below the subscription of the objects that variables are grouped by" ,
+		"type" : "integer",
+		"default" : "1",
+		"displayName" : "Asset Path Depth",
+		"order" : "39",
+		"validity": " assetMapping == \"Browse Path Depth\" "
+		},
+	"lastKnownValues" : {
+		"description" : "Include the last known value of the datapoints that have not changed in each reading of an object" ,
+		"type" : "boolean",
+		"default" : "false",
+		"displayName" : "Last Known Values",
+		"order" : "40",
+		"validity": " assetMapping != \"Variable\" "
+		},
+	"timestamp" : {
+		"description" : "The timestamp to give readings, the source timestamp of the value, the server timestamp or the time it was received" ,
+		"type" : "enumeration",
+		"options":["Source", "Server", "Receive"],
+		"default" : "Source",
+		"displayName" : "Timestamp",
+		"order" : "22"
+		},
+	"maxArrayLength" : {
+		"description" : "The maximum number of elements of an array value to include in a reading, further elements are discarded" ,
+		"type" : "integer",
+		"default" : "10000",
+		"displayName" : "Max Array Length",
+		"order" : "21"
+		},
+	"cacheNodes" : {
+		"description" : "Cache the variables found in the server so that later starts do not need to wait for the server to be browsed" ,
+		"type" : "boolean",
+		"default" : "true",
+		"displayName" : "Cache Variables",
+		"order" : "19"
+		},
+	"batching" : {
+		"description" : "Combine the data changes received in a publish cycle into one reading of the asset name, rather than one reading per variable" ,
+		"type" : "boolean",
+		"default" : "false",
+		"displayName" : "Batch Data Changes",
+		"order" : "16",
+		"validity": " assetMapping == \"Variable\" "
+		},
+	"maxBatchSize" : {
+		"description" : "The maximum number of data changes to hold before the batch is sent" ,
+		"type" : "integer",
+		"default" : "1000",
+		"displayName" : "Max Batch Size",
+		"order" : "17",
+		"validity": " batching == \"true\" || assetMapping != \"Variable\" "
+		},
+	"flushLatency" : {
+		"description" : "The maximum time to hold a batch of data changes, 0 sends the batch at the end of each publish cycle" ,
+		"type" : "integer",
+		"default" : "0",
+		"displayName" : "Batch Flush Latency (millisec)",
+		"order" : "18",
+		"validity": " batching == \"true\" || assetMapping != \"Variable\" "
+		},
+	"sessions" : {
+		"description" : "The number of sessions to open with the server, each session is serviced by its own thread" ,
+		"type" : "integer",
+		"default" : "1",
+		"displayName" : "Sessions",
+		"order" : "23"
+		},
+	"subscriptionsPerSession" : {
+		"description" : "The number of subscriptions to create in each session, the monitored items are divided between all the subscriptions" ,
+		"type" : "integer",
+		"default" : "1",
+		"displayName" : "Subscriptions Per Session",
+		"order" : "24"
+		},
+	"ingestQueueSize" : {
+		"description" : "The number of readings that may wait to be ingested, 0 ingests readings on the thread that receives the data changes" ,
+		"type" : "integer",
+		"default" : "10000",
+		"displayName" : "Ingest Queue Size",
+		"order" : "25"
+		},
+	"overflowPolicy" : {
+		"description" : "The action to take when the ingest queue is full" ,
+		"type" : "enumeration",
+		"options":["Block", "Drop Oldest", "Coalesce"],
+		"default" : "Block",
+		"displayName" : "Ingest Queue Overflow",
+		"order" : "26",
+		"validity": " ingestQueueSize != \"0\" "
+		},
+	"reconnectMinDelay" : {
+		"description" : "The time to wait before the first attempt to reconnect to the server, the wait doubles after each failed attempt" ,
+		"type" : "integer",
+		"default" : "500",
+		"displayName" : "Min Reconnect Delay (millisec)",
+		"order" : "27"
+		},
+	"reconnectMaxDelay" : {
+		"description" : "The longest time to wait between attempts to reconnect to the server" ,
+		"type" : "integer",
+		"default" : "30000",
+		"displayName" : "Max Reconnect Delay (millisec)",
+		"order" : "28"
+		},
+	"statisticsInterval" : {
+		"description" : "The interval in seconds at which performance statistics are reported, 0 disables the statistics" ,
+		"type" : "integer",
+		"default" : "0",
+		"displayName" : "Statistics Interval (sec)",
+		"order" : "29"
+		},
+	"statisticsOutput" : {
+		"description" : "Report the performance statistics to the log, as a statistics asset or both" ,
+		"type" : "enumeration",
+		"options":["Log", "Asset", "Both"],
+		"default" : "Log",
+		"displayName" : "Statistics Output",
+		"order" : "30",
+		"validity": " statisticsInterval != \"0\" "
+		},
+	"traceTags" : {
+		"description" : "A pattern matched against the datapoint names of variables whose values should be logged, leave empty to log no values" ,
+		"type" : "string",
+		"default" : "",
+		"displayName" : "Trace Variables",
+		"order" : "31"
+		},
+	"traceInterval" : {
+		"description" : "The minimum time between logging the values of a traced variable" ,
+		"type" : "integer",
+		"default" : "1000",
+		"displayName" : "Trace Interval (millisec)",
+		"order" : "32"
+		},
+	"acquisition" : {
+		"description" : "Receive data changes through subscriptions or read the variables cyclically, for servers with poor subscription support" ,
+		"type" : "enumeration",
+		"options":["Subscription", "Polled"],
+		"default" : "Subscription",
+		"displayName" : "Acquisition",
+		"order" : "33"
+		},
+	"pollInterval" : {
+		"description" : "The interval at which the variables are read when polling" ,
+		"type" : "integer",
+		"default" : "1000",
+		"displayName" : "Poll Interval (millisec)",
+		"order" : "34",
+		"validity": " acquisition == \"Polled\" "
+		},
+	"readPipeline" : {
+		"description" : "The number of read requests each session keeps in flight when polling" ,
+		"type" : "integer",
+		"default" : "4",
+		"displayName" : "Read Pipeline",
+		"order" : "35",
+		"validity": " acquisition == \"Polled\" "
+		},
+	"startupPipeline" : {
+		"description" : "The number of browse requests, and of requests to create monitored items, kept in flight while starting" ,
+		"type" : "integer",
+		"default" : "4",
+		"displayName" : "Startup Pipeline",
+		"order" : "41"
+		},
 	"securityMode" : {
 		"description" : "Security mode to use while connecting to OPCUA server" ,
 		"type" : "enumeration",
@@ -241,17 +474,8 @@ void plugin_reconfigure(PLUGIN_HANDLE *handle, string& newConfig)
 ConfigCategory	config("new", newConfig);
 OPCUA		*opcua = (OPCUA *)*handle;
 
-	opcua->stop();
-	if (config.itemExists("url"))
-	{
-		string url = config.getValue("url");
-		opcua->newURL(url);
-	}
-
-	opcua->setConfiguration(&config);
-
-	opcua->start();
-	Logger::getLogger()->info("UPC UA plugin restart after reconfigure");
+	opcua->reconfigure(&config);
+	Logger::getLogger()->info("UPC UA plugin reconfigured");
 }
 
 /**
@@ -0,0 +1,264 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <opcua.h>
+#include <logger.h>
+
+using namespace std;
+
+/**
+ * The number of nodes to register in a single request if the server does
+ * not report a MaxNodesPerRegisterNodes operation limit
+ */
+#define MAX_NODES_PER_REGISTER	1000
+
+/**
+ * The number of nodes to read in a single poll request if the server does
+ * not report a MaxNodesPerRead operation limit
+ */
+#define MAX_NODES_PER_POLL	1000
+
+/**
+ * Callback for the responses to the read requests sent when polling
+ */
+static void pollCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+			UA_ReadResponse *response)
+{
+	PollRequest *request = (PollRequest *)userdata;
+	request->session->opcua->pollResponse(request, response);
+}
+
+/**
+ * Build the lists of variables each session polls. The variables are shared
+ * between the sessions by the hash of their node id, as they are when the
+ * variables are monitored, and each session registers its variables with
+ * the server so that the server can prepare them for repeated reads.
+ */
+void OPCUA::buildPollLists()
+{
+	m_readChunk = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERREAD,
+			MAX_NODES_PER_POLL);
+	m_registerChunk = operationLimit(
+			UA_NS0ID_SERVER_SERVERCAPABILITIES_OPERATIONLIMITS_MAXNODESPERREGISTERNODES,
+			MAX_NODES_PER_REGISTER);
+	clearPollLists();
+	for (auto shard : m_shards)
+		shard->items = 0;
+	for (size_t i = 0; i < m_nodes.size(); i++)
+	{
+		MonitoredNode& node = m_nodes[i];
+		node.shard = UA_NodeId_hash(&node.nodeId) % m_shards.size();
+		Shard *shard = m_shards[node.shard];
+		shard->session->pollNodes.push_back(i);
+		shard->session->pollContexts.push_back(createContext(node, shard));
+		shard->items++;
+	}
+	for (auto session : m_sessions)
+		registerPollNodes(session);
+	Logger::getLogger()->info("Polling %d variables every %u ms in reads of up to %u nodes, %u reads in flight per session",
+			(int)m_nodes.size(), m_pollInterval, m_readChunk, m_readPipeline);
+}
+
+/**
+ * Release the lists of variables polled by the sessions and their contexts
+ */
+void OPCUA::clearPollLists()
+{
+	for (auto session : m_sessions)
+	{
+		for (auto& id : session->pollIds)
+			UA_NodeId_clear(&id);
+		session->pollIds.clear();
+		for (auto context : session->pollContexts)
+			releaseContext(context);
+		session->pollContexts.clear();
+		session->pollNodes.clear();
+		// Any responses still to arrive refer to the old lists
+		session->pollGeneration++;
+		session->pollInFlight = 0;
+		session->polling = false;
+	}
+}
+
+/**
+ * Register the variables a session polls with the server. The node ids the
+ * server returns are used in the read requests in place of the node ids of
+ * the variables. A variable the server will not register is read by its
+ * own node id. Registrations are lost with the session, so this is also
+ * called once a session has reconnected.
+ *
+ * @param session	The session whose variables are registered
+ */
+void OPCUA::registerPollNodes(Session *session)
+{
+	for (auto& id : session->pollIds)
+		UA_NodeId_clear(&id);
+	session->pollIds.clear();
+	session->pollGeneration++;
+	session->pollInFlight = 0;
+	session->polling = false;
+
+	size_t registered = 0;
+	const vector<size_t>& nodes = session->pollNodes;
+	for (size_t base = 0; base < nodes.size(); base += m_registerChunk)
+	{
+		size_t n = nodes.size() - base;
+		if (n > m_registerChunk)
+			n = m_registerChunk;
+
+		vector<UA_NodeId> ids;
+		for (size_t i = 0; i < n; i++)
+			ids.push_back(m_nodes[nodes[base + i]].nodeId);
+
+		UA_RegisterNodesRequest request;
+		UA_RegisterNodesRequest_init(&request);
+		request.nodesToRegister = ids.data();
+		request.nodesToRegisterSize = n;
+		UA_RegisterNodesResponse response = UA_Client_Service_registerNodes(session->client, request);
+		bool ok = response.responseHeader.serviceResult == UA_STATUSCODE_GOOD
+			&& response.registeredNodeIdsSize == n;
+		if (!ok)
+		{
+			Logger::getLogger()->warn("Session %d failed to register %d nodes, they will be read by node id: %s",
+					session->index, (int)n,
+					UA_StatusCode_name(response.responseHeader.serviceResult));
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			UA_NodeId id;
+			UA_NodeId_copy(ok ? &response.registeredNodeIds[i] : &ids[i], &id);
+			session->pollIds.push_back(id);
+		}
+		if (ok)
+			registered += n;
+		UA_RegisterNodesResponse_clear(&response);
+	}
+	Logger::getLogger()->debug("Session %d registered %d of %d polled variables", session->index,
+			(int)registered, (int)nodes.size());
+}
+
+/**
+ * Poll the variables of a session. A poll cycle reads every variable of the
+ * session, split into requests no larger than the MaxNodesPerRead operation
+ * limit of the server. Requests are sent asynchronously with up to the read
+ * pipeline depth in flight, so the round trips to the server overlap. Cycles
+ * are scheduled at a fixed rate from the time the first cycle started, so
+ * the time taken to send the requests does not cause the poll interval to
+ * drift. If a cycle runs past the start of the next the cycles that were
+ * missed are skipped, rather than run back to back, and counted as overruns.
+ *
+ * @param session	The session to poll
+ * @param timeout	The longest time the caller wishes to wait for the server
+ * @return		The time in milliseconds to wait for the server before polling again
+ */
+UA_UInt32 OPCUA::poll(Session *session, UA_UInt32 timeout)
+{
+	auto now = chrono::steady_clock::now();
+	chrono::milliseconds interval(m_pollInterval);
+	if (!session->polling && now >= session->nextPoll)
+	{
+		session->polling = true;
+		session->pollNext = 0;
+		session->nextPoll += interval;
+		if (session->nextPoll <= now)
+		{
+			long missed = (now - session->nextPoll) / interval + 1;
+			session->pollOverruns += missed;
+			session->nextPoll += missed * interval;
+		}
+	}
+
+	while (session->polling && session->pollInFlight < m_readPipeline
+			&& session->pollNext < session->pollIds.size())
+	{
+		size_t n = session->pollIds.size() - session->pollNext;
+		if (n > m_readChunk)
+			n = m_readChunk;
+
+		vector<UA_ReadValueId> ids(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			UA_ReadValueId_init(&ids[i]);
+			ids[i].nodeId = session->pollIds[session->pollNext + i];
+			ids[i].attributeId = UA_ATTRIBUTEID_VALUE;
+		}
+		UA_ReadRequest request;
+		UA_ReadRequest_init(&request);
+		request.nodesToRead = ids.data();
+		request.nodesToReadSize = n;
+		request.timestampsToReturn = UA_TIMESTAMPSTORETURN_BOTH;
+
+		PollRequest *pollRequest = new PollRequest;
+		pollRequest->session = session;
+		pollRequest->generation = session->pollGeneration;
+		pollRequest->first = session->pollNext;
+		pollRequest->count = n;
+		UA_UInt32 requestId;
+		UA_StatusCode rval = UA_Client_sendAsyncReadRequest(session->client, &request,
+				pollCallback, pollRequest, &requestId);
+		if (rval != UA_STATUSCODE_GOOD)
+		{
+			// Abandon the cycle, a lost connection is seen by the session thread
+			Logger::getLogger()->error("Session %d failed to send a poll request: %s",
+					session->index, UA_StatusCode_name(rval));
+			delete pollRequest;
+			session->polling = false;
+			break;
+		}
+		session->pollInFlight++;
+		session->pollNext += n;
+	}
+
+	if (session->polling && session->pollNext >= session->pollIds.size() && session->pollInFlight == 0)
+	{
+		session->polling = false;
+		session->pollCycles++;
+	}
+	if (session->polling)
+		return timeout;
+
+	auto wait = chrono::duration_cast<chrono::milliseconds>(session->nextPoll - chrono::steady_clock::now());
+	if (wait.count() <= 0)
+		return 0;
+	return wait.count() < timeout ? wait.count() : timeout;
+}
+
+/**
+ * Handle the response to a poll request. Each value read is passed on as
+ * if it were a data change notification of a monitored item, so polled
+ * values are batched and ingested in the same way.
+ *
+ * @param request	The poll request, which is deleted
+ * @param response	The response from the server
+ */
+void OPCUA::pollResponse(PollRequest *request, UA_ReadResponse *response)
+{
+	Session *session = request->session;
+	if (request->generation != session->pollGeneration)
+	{
+		// The poll lists have been rebuilt since the request was sent
+		delete request;
+		return;
+	}
+	if (session->pollInFlight > 0)
+		session->pollInFlight--;
+	if (response->responseHeader.serviceResult != UA_STATUSCODE_GOOD)
+	{
+		Logger::getLogger()->error("Session %d failed to read %d polled variables: %s",
+				session->index, (int)request->count,
+				UA_StatusCode_name(response->responseHeader.serviceResult));
+	}
+	for (size_t i = 0; i < response->resultsSize && i < request->count; i++)
+	{
+		if (response->results[i].hasValue)
+			dataChanged(session->pollContexts[request->first + i], &response->results[i]);
+	}
+	delete request;
+}
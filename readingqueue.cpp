@@ -0,0 +1,98 @@
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ *
+ * Author: Mark Riddoch
+ */
+#include <readingqueue.h>
+
+using namespace std;
+
+/**
+ * Create a reading queue. The capacity is rounded up to a power of two so
+ * that the slot of a position in the queue is found with a mask.
+ *
+ * @param capacity	The minimum number of readings the queue can hold
+ */
+ReadingQueue::ReadingQueue(size_t capacity) : m_head(0), m_tail(0), m_highWater(0)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	m_mask = size - 1;
+	m_slots = new atomic<Reading *>[size];
+	for (size_t i = 0; i < size; i++)
+		m_slots[i].store(NULL, memory_order_relaxed);
+}
+
+/**
+ * Destroy the queue and any readings still held in it
+ */
+ReadingQueue::~ReadingQueue()
+{
+	Reading *reading;
+	while ((reading = pop()) != NULL)
+		delete reading;
+	delete[] m_slots;
+}
+
+/**
+ * Add a reading to the tail of the queue. Called by the producer only.
+ *
+ * @param reading	The reading to add, the queue takes ownership if it is added
+ * @return		False if the queue is full
+ */
+bool ReadingQueue::push(Reading *reading)
+{
+	uint64_t tail = m_tail.load(memory_order_relaxed);
+	uint64_t head = m_head.load(memory_order_acquire);
+	if (tail - head > m_mask)
+		return false;
+	m_slots[tail & m_mask].store(reading, memory_order_relaxed);
+	m_tail.store(tail + 1, memory_order_release);
+	size_t depth = tail + 1 - head;
+	if (depth > m_highWater.load(memory_order_relaxed))
+		m_highWater.store(depth, memory_order_relaxed);
+	return true;
+}
+
+/**
+ * Remove the reading at the head of the queue. Called by the consumer only.
+ *
+ * @return	The reading or NULL if the queue is empty
+ */
+Reading *ReadingQueue::pop()
+{
+	uint64_t head = m_head.load(memory_order_acquire);
+	while (head != m_tail.load(memory_order_acquire))
+	{
+		Reading *reading = m_slots[head & m_mask].load(memory_order_relaxed);
+		// The producer may have dropped this reading, in which case the
+		// head has moved on and we try again from the new head
+		if (m_head.compare_exchange_weak(head, head + 1, memory_order_acq_rel))
+			return reading;
+	}
+	return NULL;
+}
+
+/**
+ * Remove the oldest reading in the queue to make room for a new one.
+ * Called by the producer only.
+ *
+ * @return	The reading removed, or NULL if the consumer emptied the queue
+ */
+Reading *ReadingQueue::dropOldest()
+{
+	uint64_t tail = m_tail.load(memory_order_relaxed);
+	uint64_t head = m_head.load(memory_order_acquire);
+	while (head != tail)
+	{
+		Reading *reading = m_slots[head & m_mask].load(memory_order_relaxed);
+		if (m_head.compare_exchange_weak(head, head + 1, memory_order_acq_rel))
+			return reading;
+	}
+	return NULL;
+}
@@ -0,0 +1,286 @@
+/*
+ * Fledge south service plugin
+ *
+ * Benchmark of the plugin against an embedded OPC UA server. The plugin
+ * ingests into a mock ingest callback that counts the readings and records
+ * their latency. The benchmark reports the time taken to start, the rate of
+ * notifications, the CPU time used per notification, the memory used and
+ * the percentiles of the ingest latency.
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <opcua.h>
+#include <metrics.h>
+#include <testserver.h>
+#include <testconfig.h>
+#include <config_category.h>
+#include <reading.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unordered_set>
+#include <chrono>
+
+using namespace std;
+
+/**
+ * The mock ingest callback of the south service
+ */
+class Ingest
+{
+	public:
+		Ingest(unsigned int variables) : m_variables(variables), m_readings(0),
+			m_datapoints(0), m_complete(false)
+		{
+		};
+		void		ingest(Reading& reading);
+		bool		waitAll(chrono::steady_clock::time_point until);
+		void		reset()
+				{
+					m_readings = 0;
+					m_datapoints = 0;
+					m_latency.collect();
+				};
+		uint64_t	readings() const { return m_readings.load(); };
+		uint64_t	datapoints() const { return m_datapoints.load(); };
+		LatencyHistogram::Summary
+				latency() { return m_latency.collect(); };
+		chrono::steady_clock::time_point
+				first() const { return m_first; };
+		chrono::steady_clock::time_point
+				all() const { return m_all; };
+	private:
+		unsigned int		m_variables;
+		atomic<uint64_t>	m_readings;
+		atomic<uint64_t>	m_datapoints;
+		LatencyHistogram	m_latency;
+		mutex			m_mutex;
+		condition_variable	m_cv;
+		atomic<bool>		m_complete;
+		unordered_set<string>	m_seen;
+		chrono::steady_clock::time_point
+					m_first;
+		chrono::steady_clock::time_point
+					m_all;
+};
+
+/**
+ * Count a reading and record its latency. Until every variable has been
+ * seen the names of the datapoints are recorded.
+ *
+ * @param reading	The reading the plugin has ingested
+ */
+void Ingest::ingest(Reading& reading)
+{
+	struct timeval ts, now;
+	reading.getUserTimestamp(&ts);
+	gettimeofday(&now, NULL);
+	long latency = (now.tv_sec - ts.tv_sec) * 1000000L + (now.tv_usec - ts.tv_usec);
+	m_latency.record(latency > 0 ? latency : 0);
+	m_readings.fetch_add(1, memory_order_relaxed);
+	m_datapoints.fetch_add(reading.getDatapointCount(), memory_order_relaxed);
+
+	if (m_complete.load(memory_order_acquire))
+		return;
+	lock_guard<mutex> guard(m_mutex);
+	if (m_seen.empty())
+		m_first = chrono::steady_clock::now();
+	for (auto dp : reading.getReadingData())
+		m_seen.insert(reading.getAssetName() + "/" + dp->getName());
+	if (m_seen.size() >= m_variables)
+	{
+		m_all = chrono::steady_clock::now();
+		m_complete = true;
+		m_cv.notify_all();
+	}
+}
+
+/**
+ * Wait for every variable of the server to have been ingested
+ *
+ * @param until	The time to give up waiting
+ * @return	True if every variable has been ingested
+ */
+bool Ingest::waitAll(chrono::steady_clock::time_point until)
+{
+	unique_lock<mutex> lck(m_mutex);
+	return m_cv.wait_until(lck, until, [this] { return m_complete.load(); });
+}
+
+/**
+ * The ingest callback registered with the plugin
+ */
+static void ingestCallback(void *data, Reading reading)
+{
+	((Ingest *)data)->ingest(reading);
+}
+
+/**
+ * Return the CPU time used by the process
+ *
+ * @return	The user and system time in nanoseconds
+ */
+static uint64_t processCpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL
+		+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "  --objects N       Number of objects in the address space (default 10)\n");
+	fprintf(stderr, "  --variables M     Number of variables of each object (default 100)\n");
+	fprintf(stderr, "  --rate R          Changes a second of each variable (default 1)\n");
+	fprintf(stderr, "  --types T,...     Data types of the variables, used in turn (default Double)\n");
+	fprintf(stderr, "  --duration S      Seconds to measure for once every variable has reported (default 30)\n");
+	fprintf(stderr, "  --port P          Port of the embedded server (default 4841)\n");
+	fprintf(stderr, "  --set item=value  Set an item of the plugin configuration\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int objects = 10;
+	unsigned int variables = 100;
+	double rate = 1;
+	string typeNames = "Double";
+	unsigned int duration = 30;
+	unsigned short port = 4841;
+	vector<string> settings;
+
+	static struct option options[] = {
+		{ "objects",	required_argument, NULL, 'o' },
+		{ "variables",	required_argument, NULL, 'v' },
+		{ "rate",	required_argument, NULL, 'r' },
+		{ "types",	required_argument, NULL, 't' },
+		{ "duration",	required_argument, NULL, 'd' },
+		{ "port",	required_argument, NULL, 'p' },
+		{ "set",	required_argument, NULL, 's' },
+		{ "help",	no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "o:v:r:t:d:p:s:h", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'o':
+				objects = strtoul(optarg, NULL, 10);
+				break;
+			case 'v':
+				variables = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				rate = strtod(optarg, NULL);
+				break;
+			case 't':
+				typeNames = optarg;
+				break;
+			case 'd':
+				duration = strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				port = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				settings.push_back(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	vector<const UA_DataType *> types;
+	size_t start = 0;
+	while (start <= typeNames.size())
+	{
+		size_t end = typeNames.find(',', start);
+		if (end == string::npos)
+			end = typeNames.size();
+		string name = typeNames.substr(start, end - start);
+		const UA_DataType *type = TestServer::parseType(name);
+		if (!type)
+		{
+			fprintf(stderr, "Unsupported data type '%s'\n", name.c_str());
+			return 1;
+		}
+		types.push_back(type);
+		start = end + 1;
+	}
+
+	TestServer server(port, objects, variables, types, rate);
+	if (!server.start())
+		return 1;
+
+	// Sample at twice the rate of change so that no change is missed
+	TestConfig config(server.url(), server.root());
+	long interval = rate > 0 ? (long)(500 / rate) : 1000;
+	config.set("reportingInterval", to_string(interval > 0 ? interval : 1));
+	for (auto& setting : settings)
+	{
+		if (!config.set(setting))
+		{
+			fprintf(stderr, "Invalid setting '%s', expected item=value\n", setting.c_str());
+			return 1;
+		}
+	}
+	ConfigCategory category("opcua", config.toJSON());
+
+	Ingest ingest(server.variables());
+	uint64_t rssBefore = residentSize();
+	auto begin = chrono::steady_clock::now();
+	OPCUA *opcua = new OPCUA(server.url());
+	opcua->setConfiguration(&category);
+	opcua->registerIngest(&ingest, ingestCallback);
+	opcua->start();
+	bool all = ingest.waitAll(begin + chrono::seconds(60 + server.variables() / 100));
+	auto started = chrono::steady_clock::now();
+
+	ingest.reset();
+	uint64_t cpu = processCpuTime() - server.cpuTime();
+	uint64_t changes = server.changes();
+	this_thread::sleep_for(chrono::seconds(duration));
+	uint64_t datapoints = ingest.datapoints();
+	uint64_t readings = ingest.readings();
+	LatencyHistogram::Summary latency = ingest.latency();
+	cpu = processCpuTime() - server.cpuTime() - cpu;
+	changes = server.changes() - changes;
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+	uint64_t rss = residentSize();
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	opcua->stop();
+	delete opcua;
+	server.stop();
+
+	printf("Address space          %u objects of %u variables (%s), %g changes/s\n",
+			objects, variables, typeNames.c_str(), rate);
+	if (ingest.first() != chrono::steady_clock::time_point())
+		printf("First reading          %ld ms\n", (long)chrono::duration_cast<chrono::milliseconds>(
+				ingest.first() - begin).count());
+	if (all)
+		printf("All variables reported %ld ms\n", (long)chrono::duration_cast<chrono::milliseconds>(
+				ingest.all() - begin).count());
+	else
+		printf("All variables reported not within the timeout\n");
+	printf("Server changes         %.0f/s\n", changes / elapsed);
+	printf("Notifications          %.0f/s\n", datapoints / elapsed);
+	printf("Readings               %.0f/s\n", readings / elapsed);
+	if (datapoints)
+		printf("CPU per notification   %.2f us\n", cpu / 1000.0 / datapoints);
+	printf("Ingest latency         p50 %lu us, p90 %lu us, p99 %lu us, max %lu us\n",
+			(unsigned long)latency.p50, (unsigned long)latency.p90,
+			(unsigned long)latency.p99, (unsigned long)latency.max);
+	printf("Resident memory        %.1f MB, %.1f MB for the plugin, peak %.1f MB\n",
+			rss / 1048576.0, ((double)rss - rssBefore) / 1048576.0, usage.ru_maxrss / 1024.0);
+	return all ? 0 : 2;
+}
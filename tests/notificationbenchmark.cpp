@@ -0,0 +1,228 @@
+/*
+ * Fledge south service plugin
+ *
+ * Microbenchmark of the handling of data change notifications. The
+ * notifications are passed straight to OPCUA::dataChanged for the contexts
+ * of a set of monitored items, without a server or client, and the readings
+ * are ingested into a mock ingest callback on the calling thread. The time
+ * taken is reported in nanoseconds per notification.
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <opcua.h>
+#include <testconfig.h>
+#include <config_category.h>
+#include <reading.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+using namespace std;
+
+/**
+ * The number of readings ingested by the mock ingest callback
+ */
+static unsigned long ingested = 0;
+
+static void ingestCallback(void *, Reading)
+{
+	ingested++;
+}
+
+/**
+ * The session, shard and monitored item contexts a client thread would
+ * have built for a set of variables of one asset
+ */
+class Items
+{
+	public:
+		Items(OPCUA *opcua, unsigned int count, const UA_DataType *type,
+				const ExceptionSettings *exception);
+		~Items();
+		MonitoredItemContext	*context(size_t i) { return &m_contexts[i % m_contexts.size()]; };
+		size_t			size() const { return m_contexts.size(); };
+	private:
+		Session				m_session;
+		Shard				m_shard;
+		AssetBatch			m_batch;
+		string				m_asset;
+		vector<string>			m_names;
+		vector<MonitoredItemContext>	m_contexts;
+};
+
+/**
+ * Build the contexts of the monitored items
+ *
+ * @param opcua		The plugin instance
+ * @param count		The number of variables
+ * @param type		The data type of the variables
+ * @param exception	The report by exception settings, or NULL
+ */
+Items::Items(OPCUA *opcua, unsigned int count, const UA_DataType *type,
+		const ExceptionSettings *exception) : m_asset("benchmark"), m_contexts(count)
+{
+	m_session.opcua = opcua;
+	m_session.index = 0;
+	m_session.client = NULL;
+	m_session.thread = NULL;
+	m_session.pendingCount = 0;
+	m_session.queue = NULL;		// Ingest on the calling thread
+	m_session.coalesced = NULL;
+	m_session.dropped = 0;
+	m_session.coalescedCount = 0;
+
+	m_shard.session = &m_session;
+	m_shard.index = 0;
+	m_shard.subscriptionId = 1;
+	m_shard.items = count;
+	m_shard.notifications = 0;
+	m_shard.suppressed = 0;
+	m_shard.heartbeats = 0;
+
+	m_batch.asset = &m_asset;
+	m_batch.hasTimestamp = false;
+	m_batch.latest = NULL;
+	m_batch.next = NULL;
+	m_batch.flushes = 0;
+
+	UA_NodeId dataType = type->typeId;
+	m_names.reserve(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		m_names.push_back("Variable" + to_string(i));
+		MonitoredItemContext& context = m_contexts[i];
+		context.opcua = opcua;
+		context.asset = &m_asset;
+		context.datapoint = &m_names[i];
+		context.decoder = selectDecoder(&dataType);
+		context.shard = &m_shard;
+		context.batch = &m_batch;
+		context.trace = NULL;
+		context.monitoredItemId = i + 1;
+		context.exception = exception;
+		context.hasLast = false;
+		context.aggregate = AGGREGATE_NONE;
+		context.heartbeat = HEARTBEAT_NONE;
+		UA_NodeId_init(&context.nodeId);
+		context.lastSource = 0;
+		context.firstSource = 0;
+	}
+}
+
+/**
+ * Discard any datapoints left in the batch
+ */
+Items::~Items()
+{
+	for (auto dp : m_batch.points)
+		delete dp;
+}
+
+/**
+ * Send notifications to the contexts of the items in turn. Every item has a
+ * new value in each round, all the values of a round sharing a timestamp.
+ *
+ * @param opcua		The plugin instance
+ * @param items		The monitored items
+ * @param type		The data type of the values
+ * @param count		The number of notifications to send
+ * @return		The time taken per notification in nanoseconds
+ */
+static double notify(OPCUA *opcua, Items& items, const UA_DataType *type, unsigned long count)
+{
+	UA_DataValue value;
+	UA_DataValue_init(&value);
+	value.hasValue = true;
+	value.hasSourceTimestamp = true;
+	value.hasServerTimestamp = true;
+	UA_Double d;
+	UA_Int32 i32;
+	string str;
+	UA_String s;
+	UA_DateTime base = UA_DateTime_now();
+
+	auto start = chrono::steady_clock::now();
+	for (unsigned long n = 0; n < count; n++)
+	{
+		switch (type->typeKind)
+		{
+			case UA_DATATYPEKIND_INT32:
+				i32 = (UA_Int32)n;
+				UA_Variant_setScalar(&value.value, &i32, type);
+				break;
+			case UA_DATATYPEKIND_STRING:
+				str = "Value " + to_string(n);
+				s = UA_STRING((char *)str.c_str());
+				UA_Variant_setScalar(&value.value, &s, type);
+				break;
+			default:
+				d = n * 0.25;
+				UA_Variant_setScalar(&value.value, &d, type);
+				break;
+		}
+		value.sourceTimestamp = base + (n / items.size()) * UA_DATETIME_MSEC;
+		value.serverTimestamp = value.sourceTimestamp;
+		opcua->dataChanged(items.context(n), &value);
+	}
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, nano>(end - start).count() / count;
+}
+
+/**
+ * Run one case of the benchmark and report the result
+ *
+ * @param name		The name of the case
+ * @param config	The configuration of the plugin
+ * @param variables	The number of variables
+ * @param type		The data type of the variables
+ * @param exception	The report by exception settings, or NULL
+ * @param count		The number of notifications to send
+ */
+static void run(const char *name, const TestConfig& config, unsigned int variables,
+		const UA_DataType *type, const ExceptionSettings *exception, unsigned long count)
+{
+	ConfigCategory category("opcua", config.toJSON());
+	OPCUA opcua("opc.tcp://localhost:4840");
+	opcua.setConfiguration(&category);
+	opcua.registerIngest(NULL, ingestCallback);
+	Items items(&opcua, variables, type, exception);
+
+	// Warm up the allocator and caches before timing
+	notify(&opcua, items, type, count / 10 + 1);
+	ingested = 0;
+	double ns = notify(&opcua, items, type, count);
+	printf("%-44s %8.1f ns/notification, %.3f readings/notification\n",
+			name, ns, (double)ingested / count);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long count = 1000000;
+	if (argc > 1)
+		count = strtoul(argv[1], NULL, 10);
+	if (count == 0)
+	{
+		fprintf(stderr, "Usage: %s [notifications]\n", argv[0]);
+		return 1;
+	}
+
+	const UA_DataType *dbl = &UA_TYPES[UA_TYPES_DOUBLE];
+	TestConfig config("opc.tcp://localhost:4840", "ns=1;s=Root");
+	run("Reading per value, Double", config, 1000, dbl, NULL, count);
+	run("Reading per value, Int32", config, 1000, &UA_TYPES[UA_TYPES_INT32], NULL, count);
+	run("Reading per value, String", config, 1000, &UA_TYPES[UA_TYPES_STRING], NULL, count);
+
+	ExceptionSettings suppress = { DeadbandAbsolute, 1e12, 0 };
+	run("Report by exception, all suppressed", config, 1000, dbl, &suppress, count);
+	ExceptionSettings pass = { DeadbandAbsolute, 0.1, 0 };
+	run("Report by exception, all sent", config, 1000, dbl, &pass, count);
+
+	TestConfig batched = config;
+	batched.set("batching", "true");
+	batched.set("maxBatchSize", "100000");
+	run("Batched, 100 datapoints per reading", batched, 100, dbl, NULL, count);
+	run("Batched, 1000 datapoints per reading", batched, 1000, dbl, NULL, count);
+	return 0;
+}
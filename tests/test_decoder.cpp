@@ -0,0 +1,491 @@
+/*
+ * Fledge south service plugin
+ *
+ * Unit tests of the decoding of OPC UA variants into datapoint values
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <gtest/gtest.h>
+#include <opcua.h>
+#include <limits.h>
+#include <stdint.h>
+
+using namespace std;
+
+#define MAX_ARRAY	10000
+
+/**
+ * Decode a variant with the general decoder. If the variant holds one of
+ * the built in types it is also decoded with the decoder selected for a
+ * variable declared with that type, the two must agree.
+ *
+ * @param variant		The variant to decode
+ * @param maxArrayLength	The maximum number of array elements to decode
+ * @return			The decoded value, the integer 0 if the decoder
+ *				left the value unchanged
+ */
+static DatapointValue decode(const UA_Variant *variant, size_t maxArrayLength = MAX_ARRAY)
+{
+	DatapointValue value(0L);
+	decodeVariant(variant, value, maxArrayLength);
+	if (variant->type && variant->type->typeKind <= UA_DATATYPEKIND_DIAGNOSTICINFO)
+	{
+		UA_NodeId dataType = UA_NODEID_NUMERIC(0, variant->type->typeKind + 1);
+		DatapointValue declared(0L);
+		selectDecoder(&dataType)(variant, declared, maxArrayLength);
+		EXPECT_EQ(value.getType(), declared.getType());
+		EXPECT_EQ(value.toString(), declared.toString());
+	}
+	return value;
+}
+
+/**
+ * Decode a scalar of the given type
+ */
+static DatapointValue decodeScalar(void *data, const UA_DataType *type)
+{
+	UA_Variant variant;
+	UA_Variant_setScalar(&variant, data, type);
+	return decode(&variant);
+}
+
+static void expectInteger(const DatapointValue& value, long expected)
+{
+	ASSERT_EQ(value.getType(), DatapointValue::T_INTEGER);
+	ASSERT_EQ(value.toInt(), expected);
+}
+
+static void expectDouble(const DatapointValue& value, double expected)
+{
+	ASSERT_EQ(value.getType(), DatapointValue::T_FLOAT);
+	ASSERT_DOUBLE_EQ(value.toDouble(), expected);
+}
+
+static void expectString(const DatapointValue& value, const string& expected)
+{
+	ASSERT_EQ(value.getType(), DatapointValue::T_STRING);
+	ASSERT_EQ(value.toStringValue(), expected);
+}
+
+/**
+ * A data type of one of the kinds that have no entry in UA_TYPES
+ */
+static UA_DataType typeOfKind(UA_UInt32 kind, const char *name)
+{
+	UA_DataType type = UA_TYPES[UA_TYPES_READVALUEID];
+	type.typeKind = kind;
+	type.typeName = name;
+	return type;
+}
+
+TEST(Decoder, Boolean)
+{
+	UA_Boolean b = true;
+	expectInteger(decodeScalar(&b, &UA_TYPES[UA_TYPES_BOOLEAN]), 1);
+	b = false;
+	expectInteger(decodeScalar(&b, &UA_TYPES[UA_TYPES_BOOLEAN]), 0);
+}
+
+TEST(Decoder, Integers)
+{
+	UA_SByte sb = -5;
+	expectInteger(decodeScalar(&sb, &UA_TYPES[UA_TYPES_SBYTE]), -5);
+	UA_Byte b = 200;
+	expectInteger(decodeScalar(&b, &UA_TYPES[UA_TYPES_BYTE]), 200);
+	UA_Int16 i16 = -30000;
+	expectInteger(decodeScalar(&i16, &UA_TYPES[UA_TYPES_INT16]), -30000);
+	UA_UInt16 u16 = 60000;
+	expectInteger(decodeScalar(&u16, &UA_TYPES[UA_TYPES_UINT16]), 60000);
+	UA_Int32 i32 = -2000000000;
+	expectInteger(decodeScalar(&i32, &UA_TYPES[UA_TYPES_INT32]), -2000000000L);
+	UA_UInt32 u32 = 4000000000U;
+	expectInteger(decodeScalar(&u32, &UA_TYPES[UA_TYPES_UINT32]), 4000000000L);
+	UA_Int64 i64 = -(1LL << 40);
+	expectInteger(decodeScalar(&i64, &UA_TYPES[UA_TYPES_INT64]), -(1L << 40));
+	UA_UInt64 u64 = 1ULL << 50;
+	expectInteger(decodeScalar(&u64, &UA_TYPES[UA_TYPES_UINT64]), 1L << 50);
+	u64 = LONG_MAX;
+	expectInteger(decodeScalar(&u64, &UA_TYPES[UA_TYPES_UINT64]), LONG_MAX);
+}
+
+TEST(Decoder, IntegerOutOfRange)
+{
+	UA_UInt64 u64 = UINT64_MAX;
+	expectDouble(decodeScalar(&u64, &UA_TYPES[UA_TYPES_UINT64]), (double)UINT64_MAX);
+	u64 = (UA_UInt64)LONG_MAX + 1;
+	expectDouble(decodeScalar(&u64, &UA_TYPES[UA_TYPES_UINT64]), (double)u64);
+	UA_Int64 i64 = INT64_MIN;
+	DatapointValue value = decodeScalar(&i64, &UA_TYPES[UA_TYPES_INT64]);
+	if (sizeof(long) < sizeof(UA_Int64))
+		expectDouble(value, (double)INT64_MIN);
+	else
+		expectInteger(value, LONG_MIN);
+}
+
+TEST(Decoder, Float)
+{
+	UA_Float f = 1.5;
+	expectDouble(decodeScalar(&f, &UA_TYPES[UA_TYPES_FLOAT]), 1.5);
+	UA_Double d = -2.25;
+	expectDouble(decodeScalar(&d, &UA_TYPES[UA_TYPES_DOUBLE]), -2.25);
+}
+
+TEST(Decoder, String)
+{
+	UA_String str = UA_STRING((char *)"hello");
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_STRING]), "hello");
+	str = UA_STRING((char *)"");
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_STRING]), "");
+	str = UA_STRING_NULL;
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_STRING]), "");
+}
+
+TEST(Decoder, XmlElement)
+{
+	UA_XmlElement xml = UA_STRING((char *)"<a>1</a>");
+	expectString(decodeScalar(&xml, &UA_TYPES[UA_TYPES_XMLELEMENT]), "<a>1</a>");
+	xml = UA_STRING_NULL;
+	expectString(decodeScalar(&xml, &UA_TYPES[UA_TYPES_XMLELEMENT]), "");
+}
+
+TEST(Decoder, DateTime)
+{
+	// 2021-03-04T05:06:07Z is 1614834367 seconds after the Unix epoch
+	UA_DateTime dt = UA_DATETIME_UNIX_EPOCH + 1614834367LL * UA_DATETIME_SEC + 123456 * UA_DATETIME_USEC;
+	expectString(decodeScalar(&dt, &UA_TYPES[UA_TYPES_DATETIME]), "2021-03-04T05:06:07.123456Z");
+	dt = UA_DATETIME_UNIX_EPOCH;
+	expectString(decodeScalar(&dt, &UA_TYPES[UA_TYPES_DATETIME]), "1970-01-01T00:00:00.000000Z");
+}
+
+TEST(Decoder, DateTimeBeforeEpoch)
+{
+	UA_DateTime dt = UA_DATETIME_UNIX_EPOCH - 500 * UA_DATETIME_MSEC;
+	expectString(decodeScalar(&dt, &UA_TYPES[UA_TYPES_DATETIME]), "1969-12-31T23:59:59.500000Z");
+}
+
+TEST(Decoder, Guid)
+{
+	UA_Guid guid = { 0x12345678, 0x9abc, 0xdef0, { 1, 2, 3, 4, 5, 6, 7, 0xff } };
+	expectString(decodeScalar(&guid, &UA_TYPES[UA_TYPES_GUID]), "12345678-9abc-def0-0102-0304050607ff");
+	guid = UA_GUID_NULL;
+	expectString(decodeScalar(&guid, &UA_TYPES[UA_TYPES_GUID]), "00000000-0000-0000-0000-000000000000");
+}
+
+TEST(Decoder, ByteString)
+{
+	UA_ByteString str = UA_BYTESTRING((char *)"Man");
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_BYTESTRING]), "TWFu");
+	str = UA_BYTESTRING((char *)"Ma");
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_BYTESTRING]), "TWE=");
+	str = UA_BYTESTRING((char *)"M");
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_BYTESTRING]), "TQ==");
+	str = UA_BYTESTRING((char *)"Many");
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_BYTESTRING]), "TWFueQ==");
+	UA_Byte binary[] = { 0x00, 0xfb, 0xff };
+	str.data = binary;
+	str.length = sizeof(binary);
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_BYTESTRING]), "APv/");
+	str = UA_BYTESTRING_NULL;
+	expectString(decodeScalar(&str, &UA_TYPES[UA_TYPES_BYTESTRING]), "");
+}
+
+TEST(Decoder, NodeId)
+{
+	UA_NodeId id = UA_NODEID_NUMERIC(2, 42);
+	expectString(decodeScalar(&id, &UA_TYPES[UA_TYPES_NODEID]), "ns=2;i=42");
+	id = UA_NODEID_STRING(3, (char *)"Boiler.Temperature");
+	expectString(decodeScalar(&id, &UA_TYPES[UA_TYPES_NODEID]), "ns=3;s=Boiler.Temperature");
+	id = UA_NODEID_NULL;
+	expectString(decodeScalar(&id, &UA_TYPES[UA_TYPES_NODEID]), "i=0");
+}
+
+TEST(Decoder, ExpandedNodeId)
+{
+	UA_ExpandedNodeId id = UA_EXPANDEDNODEID_NUMERIC(2, 42);
+	expectString(decodeScalar(&id, &UA_TYPES[UA_TYPES_EXPANDEDNODEID]), "ns=2;i=42");
+	id = UA_EXPANDEDNODEID_NULL;
+	expectString(decodeScalar(&id, &UA_TYPES[UA_TYPES_EXPANDEDNODEID]), "i=0");
+}
+
+TEST(Decoder, StatusCode)
+{
+	UA_StatusCode status = UA_STATUSCODE_BADNODEIDUNKNOWN;
+	expectInteger(decodeScalar(&status, &UA_TYPES[UA_TYPES_STATUSCODE]), 0x80340000L);
+	status = UA_STATUSCODE_GOOD;
+	expectInteger(decodeScalar(&status, &UA_TYPES[UA_TYPES_STATUSCODE]), 0);
+}
+
+TEST(Decoder, QualifiedName)
+{
+	UA_QualifiedName name = UA_QUALIFIEDNAME(3, (char *)"Temperature");
+	expectString(decodeScalar(&name, &UA_TYPES[UA_TYPES_QUALIFIEDNAME]), "3:Temperature");
+	UA_QualifiedName_init(&name);
+	expectString(decodeScalar(&name, &UA_TYPES[UA_TYPES_QUALIFIEDNAME]), "0:");
+}
+
+TEST(Decoder, LocalizedText)
+{
+	UA_LocalizedText text = UA_LOCALIZEDTEXT((char *)"en-GB", (char *)"Colour");
+	expectString(decodeScalar(&text, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]), "Colour");
+	UA_LocalizedText_init(&text);
+	expectString(decodeScalar(&text, &UA_TYPES[UA_TYPES_LOCALIZEDTEXT]), "");
+}
+
+TEST(Decoder, ExtensionObjectDecoded)
+{
+	UA_Double d = 3.5;
+	UA_ExtensionObject eo;
+	UA_ExtensionObject_setValue(&eo, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+	expectDouble(decodeScalar(&eo, &UA_TYPES[UA_TYPES_EXTENSIONOBJECT]), 3.5);
+}
+
+TEST(Decoder, ExtensionObjectEncoded)
+{
+	UA_ExtensionObject eo;
+	UA_ExtensionObject_init(&eo);
+	eo.encoding = UA_EXTENSIONOBJECT_ENCODED_BYTESTRING;
+	eo.content.encoded.body = UA_BYTESTRING((char *)"Man");
+	expectString(decodeScalar(&eo, &UA_TYPES[UA_TYPES_EXTENSIONOBJECT]), "TWFu");
+	UA_ExtensionObject_init(&eo);
+	expectString(decodeScalar(&eo, &UA_TYPES[UA_TYPES_EXTENSIONOBJECT]), "");
+}
+
+TEST(Decoder, DataValue)
+{
+	UA_Int32 i = 7;
+	UA_DataValue dv;
+	UA_DataValue_init(&dv);
+	UA_Variant_setScalar(&dv.value, &i, &UA_TYPES[UA_TYPES_INT32]);
+	dv.hasValue = true;
+	expectInteger(decodeScalar(&dv, &UA_TYPES[UA_TYPES_DATAVALUE]), 7);
+}
+
+TEST(Decoder, DataValueEmpty)
+{
+	UA_DataValue dv;
+	UA_DataValue_init(&dv);
+	UA_Variant variant;
+	UA_Variant_setScalar(&variant, &dv, &UA_TYPES[UA_TYPES_DATAVALUE]);
+	DatapointValue value(42L);
+	decodeVariant(&variant, value, MAX_ARRAY);
+	expectInteger(value, 42);
+}
+
+TEST(Decoder, Variant)
+{
+	UA_String str = UA_STRING((char *)"nested");
+	UA_Variant inner;
+	UA_Variant_setScalar(&inner, &str, &UA_TYPES[UA_TYPES_STRING]);
+	expectString(decodeScalar(&inner, &UA_TYPES[UA_TYPES_VARIANT]), "nested");
+
+	UA_Double values[] = { 1.0, 2.0 };
+	UA_Variant_setArray(&inner, values, 2, &UA_TYPES[UA_TYPES_DOUBLE]);
+	DatapointValue value = decodeScalar(&inner, &UA_TYPES[UA_TYPES_VARIANT]);
+	ASSERT_EQ(value.getType(), DatapointValue::T_FLOAT_ARRAY);
+	ASSERT_EQ(value.getDpArr()->size(), 2);
+}
+
+TEST(Decoder, DiagnosticInfo)
+{
+	UA_DiagnosticInfo info;
+	UA_DiagnosticInfo_init(&info);
+	info.hasSymbolicId = true;
+	info.symbolicId = 3;
+	expectInteger(decodeScalar(&info, &UA_TYPES[UA_TYPES_DIAGNOSTICINFO]), 3);
+	info.hasInnerStatusCode = true;
+	info.innerStatusCode = UA_STATUSCODE_BADTIMEOUT;
+	expectInteger(decodeScalar(&info, &UA_TYPES[UA_TYPES_DIAGNOSTICINFO]), UA_STATUSCODE_BADTIMEOUT);
+	info.hasAdditionalInfo = true;
+	info.additionalInfo = UA_STRING((char *)"sensor offline");
+	expectString(decodeScalar(&info, &UA_TYPES[UA_TYPES_DIAGNOSTICINFO]), "sensor offline");
+	UA_DiagnosticInfo_init(&info);
+	expectInteger(decodeScalar(&info, &UA_TYPES[UA_TYPES_DIAGNOSTICINFO]), 0);
+}
+
+TEST(Decoder, Decimal)
+{
+	UA_DataType type = typeOfKind(UA_DATATYPEKIND_DECIMAL, "Decimal");
+	UA_ReadValueId data;
+	UA_ReadValueId_init(&data);
+	expectString(decodeScalar(&data, &type), "Decimal");
+}
+
+TEST(Decoder, Enum)
+{
+	UA_NodeClass nodeClass = UA_NODECLASS_VARIABLE;
+	ASSERT_EQ(UA_TYPES[UA_TYPES_NODECLASS].typeKind, UA_DATATYPEKIND_ENUM);
+	expectInteger(decodeScalar(&nodeClass, &UA_TYPES[UA_TYPES_NODECLASS]), 2);
+}
+
+TEST(Decoder, Structure)
+{
+	UA_ReadValueId data;
+	UA_ReadValueId_init(&data);
+	ASSERT_EQ(UA_TYPES[UA_TYPES_READVALUEID].typeKind, UA_DATATYPEKIND_STRUCTURE);
+	expectString(decodeScalar(&data, &UA_TYPES[UA_TYPES_READVALUEID]), "ReadValueId");
+
+	UA_DataType unnamed = typeOfKind(UA_DATATYPEKIND_STRUCTURE, NULL);
+	expectString(decodeScalar(&data, &unnamed), "Structure");
+}
+
+TEST(Decoder, OptionalStructure)
+{
+	UA_DataType type = typeOfKind(UA_DATATYPEKIND_OPTSTRUCT, "Options");
+	UA_ReadValueId data;
+	UA_ReadValueId_init(&data);
+	expectString(decodeScalar(&data, &type), "Options");
+}
+
+TEST(Decoder, Union)
+{
+	UA_DataType type = typeOfKind(UA_DATATYPEKIND_UNION, "Choice");
+	UA_ReadValueId data;
+	UA_ReadValueId_init(&data);
+	expectString(decodeScalar(&data, &type), "Choice");
+}
+
+TEST(Decoder, BitfieldCluster)
+{
+	UA_DataType type = typeOfKind(UA_DATATYPEKIND_BITFIELDCLUSTER, "Flags");
+	UA_ReadValueId data;
+	UA_ReadValueId_init(&data);
+	expectString(decodeScalar(&data, &type), "Flags");
+}
+
+TEST(Decoder, UnknownKind)
+{
+	UA_DataType type = typeOfKind(UA_DATATYPEKINDS, "Future");
+	UA_ReadValueId data;
+	UA_ReadValueId_init(&data);
+	expectInteger(decodeScalar(&data, &type), 0);
+}
+
+TEST(Decoder, NullVariant)
+{
+	UA_Variant variant;
+	UA_Variant_init(&variant);
+	DatapointValue value(42L);
+	decodeVariant(&variant, value, MAX_ARRAY);
+	expectInteger(value, 42);
+
+	for (UA_UInt32 kind = 0; kind <= UA_DATATYPEKIND_DIAGNOSTICINFO; kind++)
+	{
+		UA_NodeId dataType = UA_NODEID_NUMERIC(0, kind + 1);
+		selectDecoder(&dataType)(&variant, value, MAX_ARRAY);
+		expectInteger(value, 42);
+	}
+}
+
+TEST(Decoder, EmptyArray)
+{
+	UA_Variant variant;
+	UA_Variant_setArray(&variant, UA_EMPTY_ARRAY_SENTINEL, 0, &UA_TYPES[UA_TYPES_DOUBLE]);
+	DatapointValue value(42L);
+	decodeVariant(&variant, value, MAX_ARRAY);
+	expectInteger(value, 42);
+
+	UA_NodeId dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_DOUBLE);
+	selectDecoder(&dataType)(&variant, value, MAX_ARRAY);
+	expectInteger(value, 42);
+}
+
+TEST(Decoder, NumericArrays)
+{
+	UA_Boolean booleans[] = { true, false, true };
+	UA_Variant variant;
+	UA_Variant_setArray(&variant, booleans, 3, &UA_TYPES[UA_TYPES_BOOLEAN]);
+	DatapointValue value = decode(&variant);
+	ASSERT_EQ(value.getType(), DatapointValue::T_FLOAT_ARRAY);
+	ASSERT_EQ(*value.getDpArr(), vector<double>({ 1, 0, 1 }));
+
+	UA_SByte sbytes[] = { -1, 2 };
+	UA_Variant_setArray(&variant, sbytes, 2, &UA_TYPES[UA_TYPES_SBYTE]);
+	value = decode(&variant);
+	ASSERT_EQ(*value.getDpArr(), vector<double>({ -1, 2 }));
+
+	UA_UInt64 longs[] = { 1ULL << 40, 5 };
+	UA_Variant_setArray(&variant, longs, 2, &UA_TYPES[UA_TYPES_UINT64]);
+	value = decode(&variant);
+	ASSERT_EQ(*value.getDpArr(), vector<double>({ (double)(1ULL << 40), 5 }));
+
+	UA_UInt64 large[] = { UINT64_MAX, (UA_UInt64)LONG_MAX + 1 };
+	UA_Variant_setArray(&variant, large, 2, &UA_TYPES[UA_TYPES_UINT64]);
+	value = decode(&variant);
+	ASSERT_EQ(*value.getDpArr(), vector<double>({ (double)UINT64_MAX, (double)((UA_UInt64)LONG_MAX + 1) }));
+
+	UA_Float floats[] = { 0.5, -1.25 };
+	UA_Variant_setArray(&variant, floats, 2, &UA_TYPES[UA_TYPES_FLOAT]);
+	value = decode(&variant);
+	ASSERT_EQ(*value.getDpArr(), vector<double>({ 0.5, -1.25 }));
+}
+
+TEST(Decoder, ArrayTruncated)
+{
+	UA_Int32 values[] = { 1, 2, 3, 4, 5 };
+	UA_Variant variant;
+	UA_Variant_setArray(&variant, values, 5, &UA_TYPES[UA_TYPES_INT32]);
+	DatapointValue value = decode(&variant, 3);
+	ASSERT_EQ(value.getType(), DatapointValue::T_FLOAT_ARRAY);
+	ASSERT_EQ(*value.getDpArr(), vector<double>({ 1, 2, 3 }));
+}
+
+TEST(Decoder, TwoDimensionalArray)
+{
+	UA_Int16 values[] = { 1, 2, 3, 4, 5, 6 };
+	UA_UInt32 dimensions[] = { 2, 3 };
+	UA_Variant variant;
+	UA_Variant_setArray(&variant, values, 6, &UA_TYPES[UA_TYPES_INT16]);
+	variant.arrayDimensions = dimensions;
+	variant.arrayDimensionsSize = 2;
+	DatapointValue value = decode(&variant);
+	ASSERT_EQ(value.getType(), DatapointValue::T_2D_FLOAT_ARRAY);
+	vector<vector<double> *> *matrix = value.getDp2DArr();
+	ASSERT_EQ(matrix->size(), 2);
+	ASSERT_EQ(*(*matrix)[0], vector<double>({ 1, 2, 3 }));
+	ASSERT_EQ(*(*matrix)[1], vector<double>({ 4, 5, 6 }));
+
+	// Truncation discards the incomplete last row
+	value = decode(&variant, 5);
+	ASSERT_EQ(value.getType(), DatapointValue::T_2D_FLOAT_ARRAY);
+	ASSERT_EQ(value.getDp2DArr()->size(), 1);
+}
+
+TEST(Decoder, NonNumericArray)
+{
+	UA_String values[] = { UA_STRING((char *)"a"), UA_STRING((char *)"b") };
+	UA_Variant variant;
+	UA_Variant_setArray(&variant, values, 2, &UA_TYPES[UA_TYPES_STRING]);
+	DatapointValue value(42L);
+	decodeVariant(&variant, value, MAX_ARRAY);
+	expectInteger(value, 42);
+}
+
+TEST(Decoder, DeclaredTypeMismatch)
+{
+	UA_Double d = 2.5;
+	UA_Variant variant;
+	UA_Variant_setScalar(&variant, &d, &UA_TYPES[UA_TYPES_DOUBLE]);
+	UA_NodeId dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_INT32);
+	DatapointValue value(0L);
+	selectDecoder(&dataType)(&variant, value, MAX_ARRAY);
+	expectDouble(value, 2.5);
+}
+
+TEST(Decoder, SelectDecoder)
+{
+	for (UA_UInt32 kind = 0; kind <= UA_DATATYPEKIND_DIAGNOSTICINFO; kind++)
+	{
+		UA_NodeId dataType = UA_NODEID_NUMERIC(0, kind + 1);
+		ASSERT_NE(selectDecoder(&dataType), (VariantDecoder)decodeVariant);
+	}
+	UA_NodeId dataType = UA_NODEID_NUMERIC(0, 0);
+	ASSERT_EQ(selectDecoder(&dataType), (VariantDecoder)decodeVariant);
+	dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_ENUMERATION);
+	ASSERT_EQ(selectDecoder(&dataType), (VariantDecoder)decodeVariant);
+	dataType = UA_NODEID_NUMERIC(2, UA_NS0ID_DOUBLE);
+	ASSERT_EQ(selectDecoder(&dataType), (VariantDecoder)decodeVariant);
+	dataType = UA_NODEID_STRING(0, (char *)"Double");
+	ASSERT_EQ(selectDecoder(&dataType), (VariantDecoder)decodeVariant);
+}
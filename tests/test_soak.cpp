@@ -0,0 +1,169 @@
+/*
+ * Fledge south service plugin
+ *
+ * Soak test of the reconfiguration of the plugin against an embedded
+ * OPC UA server. The plugin is reconfigured thousands of times, cycling
+ * through changes to settings that are applied in place and to settings
+ * that reconnect to the server, and the resident set size of the process
+ * must not grow.
+ *
+ * The number of reconfigurations is taken from SOAK_ITERATIONS and the
+ * growth allowed, in kilobytes, from SOAK_RSS_TOLERANCE.
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <gtest/gtest.h>
+#include <opcua.h>
+#include <testserver.h>
+#include <testconfig.h>
+#include <config_category.h>
+#include <reading.h>
+#include <stdlib.h>
+#include <chrono>
+
+using namespace std;
+
+#define SOAK_PORT		4842
+#define SOAK_ITERATIONS		2000
+#define SOAK_RSS_TOLERANCE	2048	// Kilobytes
+#define SOAK_SAMPLE_INTERVAL	100	// Reconfigurations between samples of the RSS
+
+static atomic<unsigned long> ingested(0);
+
+static void ingestCallback(void *, Reading)
+{
+	ingested.fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * Return the value of a numeric environment variable
+ */
+static unsigned long environment(const char *name, unsigned long value)
+{
+	const char *str = getenv(name);
+	if (str && *str)
+		value = strtoul(str, NULL, 10);
+	return value;
+}
+
+/**
+ * Wait for the plugin to ingest another reading
+ *
+ * @param seconds	The time to wait
+ * @return		True if a reading was ingested
+ */
+static bool waitForReading(unsigned int seconds)
+{
+	unsigned long count = ingested.load();
+	auto until = chrono::steady_clock::now() + chrono::seconds(seconds);
+	while (chrono::steady_clock::now() < until)
+	{
+		if (ingested.load() != count)
+			return true;
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+	return false;
+}
+
+/**
+ * Return the configuration of the n'th reconfiguration. Every item that is
+ * changed by any reconfiguration is given, so that each one sets the whole
+ * of the configuration that it tests. Most change a setting that is applied
+ * without reconnecting, the number of sessions changes every 50
+ * reconfigurations so the plugin also reconnects to the server.
+ *
+ * @param server	The embedded server
+ * @param n		The number of the reconfiguration
+ * @return		The configuration category
+ */
+static string configuration(const TestServer& server, unsigned long n)
+{
+	TestConfig config(server.url(), server.root());
+	config.set("reportingInterval", "100");
+	config.set("reportByException", "{}");
+	config.set("traceTags", "");
+	config.set("aggregateWindow", "0");
+	config.set("batching", "false");
+	config.set("sessions", (n / 50) % 2 ? "2" : "1");
+	switch (n % 8)
+	{
+		case 1:
+			config.set("reportingInterval", "200");
+			break;
+		case 2:
+			config.set("reportByException",
+				"{ \"default\" : { \"deadbandType\" : \"Absolute\", \"deadbandValue\" : 0.5, \"maxAge\" : 1000 } }");
+			break;
+		case 3:
+			config.set("traceTags", "Variable1*");
+			break;
+		case 4:
+			config.set("aggregateWindow", "1000");
+			break;
+		case 5:
+			config.set("batching", "true");
+			break;
+		case 6:
+			config.set("asset", "soak");
+			break;
+		case 7:
+			config.set("subscription", "{ \"subscriptions\" : [ \"ns=1;s=Object0\" ] }");
+			break;
+	}
+	return config.toJSON();
+}
+
+TEST(Soak, ReconfigureKeepsMemoryFlat)
+{
+	unsigned long iterations = environment("SOAK_ITERATIONS", SOAK_ITERATIONS);
+	unsigned long tolerance = environment("SOAK_RSS_TOLERANCE", SOAK_RSS_TOLERANCE) * 1024;
+	// Allow the allocator and the caches of the plugin to reach their working size
+	unsigned long warmup = iterations / 10 > 200 ? iterations / 10 : 200;
+
+	vector<const UA_DataType *> types = { &UA_TYPES[UA_TYPES_DOUBLE], &UA_TYPES[UA_TYPES_INT32],
+		&UA_TYPES[UA_TYPES_STRING] };
+	TestServer server(SOAK_PORT, 10, 10, types, 10);
+	ASSERT_TRUE(server.start());
+
+	ConfigCategory initial("opcua", configuration(server, 0));
+	OPCUA *opcua = new OPCUA(server.url());
+	opcua->setConfiguration(&initial);
+	opcua->registerIngest(NULL, ingestCallback);
+	opcua->start();
+	ASSERT_TRUE(waitForReading(30));
+
+	uint64_t baseline = 0, peak = 0;
+	for (unsigned long n = 1; n <= warmup + iterations; n++)
+	{
+		ConfigCategory config("opcua", configuration(server, n));
+		opcua->reconfigure(&config);
+		if (n == warmup)
+		{
+			baseline = residentSize();
+		}
+		else if (n > warmup && n % SOAK_SAMPLE_INTERVAL == 0)
+		{
+			uint64_t rss = residentSize();
+			if (rss > peak)
+				peak = rss;
+			EXPECT_LE(rss, baseline + tolerance) << "Resident set grew by "
+				<< (rss - baseline) / 1024 << " KB after " << n - warmup << " reconfigurations";
+		}
+	}
+	uint64_t last = residentSize();
+
+	// The plugin is still ingesting after the last reconfiguration
+	EXPECT_TRUE(waitForReading(30));
+
+	opcua->stop();
+	delete opcua;
+	server.stop();
+
+	RecordProperty("BaselineKB", (int)(baseline / 1024));
+	RecordProperty("PeakKB", (int)(peak / 1024));
+	RecordProperty("FinalKB", (int)(last / 1024));
+	ASSERT_LE(last, baseline + tolerance) << "Resident set grew from " << baseline / 1024
+		<< " KB to " << last / 1024 << " KB over " << iterations << " reconfigurations";
+}
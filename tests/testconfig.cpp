@@ -0,0 +1,89 @@
+/*
+ * Fledge south service plugin
+ *
+ * The configuration of the plugin used by the benchmarks and tests
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <testconfig.h>
+
+using namespace std;
+
+/**
+ * Escape a string for inclusion in a JSON document
+ */
+static string escape(const string& str)
+{
+	string rval;
+	for (auto c : str)
+	{
+		if (c == '"' || c == '\\')
+			rval += '\\';
+		rval += c;
+	}
+	return rval;
+}
+
+/**
+ * Construct the configuration for a server with a single subscription.
+ * The node cache is disabled so that every start browses the server.
+ *
+ * @param url	The URL of the OPC UA server
+ * @param root	The node id to subscribe to
+ */
+TestConfig::TestConfig(const string& url, const string& root)
+{
+	m_items["url"] = url;
+	m_items["asset"] = "opcua";
+	m_items["subscription"] = "{ \"subscriptions\" : [ \"" + root + "\" ] }";
+	m_items["cacheNodes"] = "false";
+}
+
+/**
+ * Set the value of a configuration item
+ *
+ * @param name	The name of the item
+ * @param value	The value of the item
+ */
+void TestConfig::set(const string& name, const string& value)
+{
+	m_items[name] = value;
+}
+
+/**
+ * Set the value of a configuration item given as name=value
+ *
+ * @param assignment	The item and its value
+ * @return		False if the assignment has no value
+ */
+bool TestConfig::set(const string& assignment)
+{
+	size_t pos = assignment.find('=');
+	if (pos == string::npos || pos == 0)
+		return false;
+	m_items[assignment.substr(0, pos)] = assignment.substr(pos + 1);
+	return true;
+}
+
+/**
+ * Return the configuration category as JSON
+ *
+ * @return	The JSON of the configuration category
+ */
+string TestConfig::toJSON() const
+{
+	string json = "{";
+	for (auto& item : m_items)
+	{
+		if (json.size() > 1)
+			json += ",";
+		string value = escape(item.second);
+		json += " \"" + item.first + "\" : { \"description\" : \"" + item.first
+			+ "\", \"type\" : \"string\", \"default\" : \"" + value
+			+ "\", \"value\" : \"" + value + "\" }";
+	}
+	json += " }";
+	return json;
+}
@@ -0,0 +1,30 @@
+#ifndef _TESTCONFIG_H
+#define _TESTCONFIG_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <string>
+#include <map>
+
+/**
+ * The configuration of the plugin used by the benchmarks and tests, the
+ * items given are turned into the JSON of a configuration category. Items
+ * that are not given take the default of the plugin.
+ */
+class TestConfig
+{
+	public:
+		TestConfig(const std::string& url, const std::string& root);
+		void		set(const std::string& name, const std::string& value);
+		bool		set(const std::string& assignment);
+		std::string	toJSON() const;
+	private:
+		std::map<std::string, std::string>
+				m_items;
+};
+
+#endif
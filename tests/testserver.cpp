@@ -0,0 +1,369 @@
+/*
+ * Fledge south service plugin
+ *
+ * An OPC UA server embedded in the benchmark and test executables
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <testserver.h>
+#include <open62541/server_config_default.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * The data types the server can give its variables
+ */
+static const struct {
+	const char	*name;
+	int		type;
+} types[] = {
+	{ "Boolean",	UA_TYPES_BOOLEAN },
+	{ "SByte",	UA_TYPES_SBYTE },
+	{ "Byte",	UA_TYPES_BYTE },
+	{ "Int16",	UA_TYPES_INT16 },
+	{ "UInt16",	UA_TYPES_UINT16 },
+	{ "Int32",	UA_TYPES_INT32 },
+	{ "UInt32",	UA_TYPES_UINT32 },
+	{ "Int64",	UA_TYPES_INT64 },
+	{ "UInt64",	UA_TYPES_UINT64 },
+	{ "Float",	UA_TYPES_FLOAT },
+	{ "Double",	UA_TYPES_DOUBLE },
+	{ "String",	UA_TYPES_STRING },
+	{ "DateTime",	UA_TYPES_DATETIME }
+};
+
+/**
+ * Only warnings and errors of the server are shown, so that they do not
+ * swamp the output of the benchmarks and tests
+ */
+static void serverLog(void *, UA_LogLevel level, UA_LogCategory, const char *msg, va_list args)
+{
+	if (level < UA_LOGLEVEL_WARNING)
+		return;
+	fprintf(stderr, "OPC UA server: ");
+	vfprintf(stderr, msg, args);
+	fprintf(stderr, "\n");
+}
+
+/**
+ * Construct the test server
+ *
+ * @param port		The port the server listens on
+ * @param objects	The number of objects in the address space
+ * @param variables	The number of variables of each object
+ * @param types		The data types of the variables, used in turn
+ * @param rate		The number of times a second the value of each
+ *			variable changes, 0 if the values never change
+ */
+TestServer::TestServer(unsigned short port, unsigned int objects, unsigned int variables,
+		const vector<const UA_DataType *>& types, double rate) :
+	m_port(port), m_objects(objects), m_variables(variables), m_types(types), m_rate(rate),
+	m_server(NULL), m_thread(NULL), m_stop(false), m_state(Starting), m_count(0), m_changes(0)
+{
+	if (m_types.empty())
+		m_types.push_back(&UA_TYPES[UA_TYPES_DOUBLE]);
+}
+
+/**
+ * Destructor for the test server
+ */
+TestServer::~TestServer()
+{
+	stop();
+}
+
+/**
+ * Return the data type with the given name
+ *
+ * @param name	The name of the data type
+ * @return	The data type or NULL if the server does not support it
+ */
+const UA_DataType *TestServer::parseType(const string& name)
+{
+	for (auto& t : types)
+	{
+		if (name.compare(t.name) == 0)
+			return &UA_TYPES[t.type];
+	}
+	return NULL;
+}
+
+/**
+ * Return the endpoint URL of the server
+ *
+ * @return	The URL to connect to
+ */
+string TestServer::url() const
+{
+	return "opc.tcp://localhost:" + to_string(m_port);
+}
+
+/**
+ * Create the server, build the address space and start the server thread
+ *
+ * @return	True if the server is running
+ */
+bool TestServer::start()
+{
+	m_server = UA_Server_new();
+	UA_ServerConfig *config = UA_Server_getConfig(m_server);
+	UA_ServerConfig_setMinimal(config, m_port, NULL);
+	if (config->logger.clear)
+		config->logger.clear(config->logger.context);
+	config->logger.log = serverLog;
+	config->logger.context = NULL;
+	config->logger.clear = NULL;
+	// Allow the client to sample and publish as fast as the values change
+	config->samplingIntervalLimits.min = 1.0;
+	config->publishingIntervalLimits.min = 1.0;
+	config->maxMonitoredItemsPerCall = 0;
+	config->maxNodesPerRead = 0;
+	config->maxNodesPerBrowse = 0;
+
+	addNodes();
+	if (m_rate > 0)
+	{
+		UA_Server_addRepeatedCallback(m_server, changeCallback, this, 1000.0 / m_rate, NULL);
+	}
+
+	m_stop = false;
+	m_state = Starting;
+	m_thread = new thread(&TestServer::run, this);
+	pthread_getcpuclockid(m_thread->native_handle(), &m_cpuClock);
+
+	unique_lock<mutex> lck(m_startMutex);
+	m_startCV.wait(lck, [this] { return m_state != Starting; });
+	if (m_state == Failed)
+	{
+		lck.unlock();
+		stop();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Stop the server thread and delete the server
+ */
+void TestServer::stop()
+{
+	if (m_thread)
+	{
+		m_stop = true;
+		m_thread->join();
+		delete m_thread;
+		m_thread = NULL;
+	}
+	if (m_server)
+	{
+		UA_Server_delete(m_server);
+		m_server = NULL;
+	}
+	for (auto& id : m_nodes)
+		UA_NodeId_clear(&id);
+	m_nodes.clear();
+}
+
+/**
+ * Return the CPU time used by the server thread, so that it can be
+ * excluded from the CPU time of the process
+ *
+ * @return	The CPU time in nanoseconds
+ */
+uint64_t TestServer::cpuTime() const
+{
+	struct timespec ts;
+	if (!m_thread || clock_gettime(m_cpuClock, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * The server thread
+ */
+void TestServer::run()
+{
+	UA_StatusCode rval = UA_Server_run_startup(m_server);
+	{
+		lock_guard<mutex> guard(m_startMutex);
+		m_state = rval == UA_STATUSCODE_GOOD ? Running : Failed;
+	}
+	m_startCV.notify_all();
+	if (rval != UA_STATUSCODE_GOOD)
+	{
+		fprintf(stderr, "Unable to start the OPC UA server on port %d: %s\n",
+				m_port, UA_StatusCode_name(rval));
+		return;
+	}
+	while (!m_stop)
+	{
+		UA_Server_run_iterate(m_server, true);
+	}
+	UA_Server_run_shutdown(m_server);
+}
+
+/**
+ * Build the address space. The root object is organised by the objects
+ * folder, the objects are components of the root and the variables are
+ * components of their object.
+ */
+void TestServer::addNodes()
+{
+	UA_ObjectAttributes oattr = UA_ObjectAttributes_default;
+	oattr.displayName = UA_LOCALIZEDTEXT((char *)"", (char *)"Root");
+	UA_Server_addObjectNode(m_server, UA_NODEID_STRING(1, (char *)"Root"),
+			UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+			UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+			UA_QUALIFIEDNAME(1, (char *)"Root"),
+			UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE), oattr, NULL, NULL);
+
+	m_nodes.reserve(m_objects * m_variables);
+	for (unsigned int i = 0; i < m_objects; i++)
+	{
+		string object = "Object" + to_string(i);
+		UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+		attr.displayName = UA_LOCALIZEDTEXT((char *)"", (char *)object.c_str());
+		UA_Server_addObjectNode(m_server, UA_NODEID_STRING(1, (char *)object.c_str()),
+				UA_NODEID_STRING(1, (char *)"Root"),
+				UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+				UA_QUALIFIEDNAME(1, (char *)object.c_str()),
+				UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE), attr, NULL, NULL);
+
+		for (unsigned int j = 0; j < m_variables; j++)
+		{
+			string name = "Variable" + to_string(j);
+			string id = object + "." + name;
+			const UA_DataType *type = m_types[(i * m_variables + j) % m_types.size()];
+			uint64_t storage[2];
+			string str;
+			UA_VariableAttributes vattr = UA_VariableAttributes_default;
+			vattr.displayName = UA_LOCALIZEDTEXT((char *)"", (char *)name.c_str());
+			vattr.dataType = type->typeId;
+			vattr.accessLevel = UA_ACCESSLEVELMASK_READ;
+			setValue(&vattr.value, type, 0, storage, str);
+			UA_NodeId nodeId = UA_NODEID_STRING_ALLOC(1, id.c_str());
+			UA_Server_addVariableNode(m_server, nodeId,
+					UA_NODEID_STRING(1, (char *)object.c_str()),
+					UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+					UA_QUALIFIEDNAME(1, (char *)name.c_str()),
+					UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE), vattr, NULL, NULL);
+			m_nodes.push_back(nodeId);
+		}
+	}
+}
+
+/**
+ * Set a variant to the n'th value of a variable of the given type. The
+ * variant refers to the storage passed in rather than allocating memory.
+ *
+ * @param variant	The variant to set
+ * @param type		The data type of the value
+ * @param n		The number of the value
+ * @param storage	Storage of at least 16 bytes for the value
+ * @param str		Storage for the characters of a string value
+ */
+void TestServer::setValue(UA_Variant *variant, const UA_DataType *type, uint64_t n,
+		void *storage, string& str)
+{
+	memset(storage, 0, 16);
+	switch (type->typeKind)
+	{
+		case UA_DATATYPEKIND_BOOLEAN:
+			*(UA_Boolean *)storage = n & 1;
+			break;
+		case UA_DATATYPEKIND_SBYTE:
+			*(UA_SByte *)storage = (UA_SByte)n;
+			break;
+		case UA_DATATYPEKIND_BYTE:
+			*(UA_Byte *)storage = (UA_Byte)n;
+			break;
+		case UA_DATATYPEKIND_INT16:
+			*(UA_Int16 *)storage = (UA_Int16)n;
+			break;
+		case UA_DATATYPEKIND_UINT16:
+			*(UA_UInt16 *)storage = (UA_UInt16)n;
+			break;
+		case UA_DATATYPEKIND_INT32:
+			*(UA_Int32 *)storage = (UA_Int32)n;
+			break;
+		case UA_DATATYPEKIND_UINT32:
+			*(UA_UInt32 *)storage = (UA_UInt32)n;
+			break;
+		case UA_DATATYPEKIND_INT64:
+			*(UA_Int64 *)storage = (UA_Int64)n;
+			break;
+		case UA_DATATYPEKIND_UINT64:
+			*(UA_UInt64 *)storage = n;
+			break;
+		case UA_DATATYPEKIND_FLOAT:
+			*(UA_Float *)storage = (UA_Float)n * 0.5f;
+			break;
+		case UA_DATATYPEKIND_DOUBLE:
+			*(UA_Double *)storage = (UA_Double)n * 0.25;
+			break;
+		case UA_DATATYPEKIND_STRING:
+			str = "Value " + to_string(n);
+			*(UA_String *)storage = UA_STRING((char *)str.c_str());
+			break;
+		case UA_DATATYPEKIND_DATETIME:
+			*(UA_DateTime *)storage = UA_DateTime_now();
+			break;
+	}
+	UA_Variant_setScalar(variant, storage, type);
+}
+
+/**
+ * The repeated callback of the server that changes the values
+ */
+void TestServer::changeCallback(UA_Server *, void *data)
+{
+	((TestServer *)data)->change();
+}
+
+/**
+ * Change the value of every variable, the values are written with a source
+ * timestamp of the time of the change so that the latency of each value
+ * can be measured once it has been ingested
+ */
+void TestServer::change()
+{
+	m_count++;
+	UA_DataValue value;
+	UA_DataValue_init(&value);
+	value.hasValue = true;
+	value.hasSourceTimestamp = true;
+	uint64_t storage[2];
+	string str;
+	for (size_t i = 0; i < m_nodes.size(); i++)
+	{
+		setValue(&value.value, m_types[i % m_types.size()], m_count, storage, str);
+		value.sourceTimestamp = UA_DateTime_now();
+		UA_Server_writeDataValue(m_server, m_nodes[i], value);
+	}
+	m_changes.fetch_add(m_nodes.size(), memory_order_relaxed);
+}
+
+/**
+ * Return the resident set size of the process
+ *
+ * @return	The resident set size in bytes
+ */
+uint64_t residentSize()
+{
+	unsigned long size, resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp)
+	{
+		if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+			resident = 0;
+		fclose(fp);
+	}
+	return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
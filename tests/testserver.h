@@ -0,0 +1,80 @@
+#ifndef _TESTSERVER_H
+#define _TESTSERVER_H
+/*
+ * Fledge south service plugin
+ *
+ * Copyright (c) 2021 Dianomic Systems
+ *
+ * Released under the Apache 2.0 Licence
+ */
+#include <open62541/server.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * An OPC UA server embedded in the benchmark and test executables. The
+ * address space holds a number of objects below a single root object, each
+ * object having the same number of variables. The data types of the
+ * variables are taken in turn from a list of types and the server changes
+ * the value of every variable a fixed number of times a second, setting the
+ * source timestamp to the time of the change.
+ *
+ * The server runs in a thread of its own once started.
+ */
+class TestServer
+{
+	public:
+		TestServer(unsigned short port, unsigned int objects, unsigned int variables,
+				const std::vector<const UA_DataType *>& types, double rate);
+		~TestServer();
+		bool		start();
+		void		stop();
+		std::string	url() const;
+		/**
+		 * The node id of the object the address space is built below
+		 */
+		std::string	root() const { return "ns=1;s=Root"; };
+		unsigned int	variables() const { return m_objects * m_variables; };
+		/**
+		 * The number of value changes made since the server started
+		 */
+		uint64_t	changes() const { return m_changes.load(std::memory_order_relaxed); };
+		uint64_t	cpuTime() const;
+		static const UA_DataType
+				*parseType(const std::string& name);
+	private:
+		void		run();
+		void		addNodes();
+		void		change();
+		static void	changeCallback(UA_Server *server, void *data);
+		static void	setValue(UA_Variant *variant, const UA_DataType *type, uint64_t n,
+					void *storage, std::string& str);
+	private:
+		unsigned short		m_port;
+		unsigned int		m_objects;
+		unsigned int		m_variables;
+		std::vector<const UA_DataType *>
+					m_types;
+		double			m_rate;
+		UA_Server		*m_server;
+		std::vector<UA_NodeId>	m_nodes;
+		std::thread		*m_thread;
+		clockid_t		m_cpuClock;
+		std::atomic<bool>	m_stop;
+		std::mutex		m_startMutex;
+		std::condition_variable	m_startCV;
+		enum { Starting, Running, Failed }
+					m_state;
+		uint64_t		m_count;
+		std::atomic<uint64_t>	m_changes;
+};
+
+uint64_t	residentSize();
+
+#endif